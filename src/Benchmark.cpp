@@ -0,0 +1,404 @@
+// Microbenchmarks for Cakelisp's internals. These are kept out of the cakelisp executable; build
+// the cakelisp_benchmark target and run it on a corpus of .cake files, e.g.
+//  cakelisp_benchmark tokenizer runtime/*.cake test/*.cake
+
+#include <stdio.h>
+#include <string.h>
+
+#include <cctype>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "FileUtilities.hpp"
+#include "HashTable.hpp"
+#include "Logging.hpp"
+#include "Symbols.hpp"
+#include "Tokenizer.hpp"
+#include "Utilities.hpp"
+
+static const int numIterations = 20;
+
+// Returns false if any file failed to tokenize
+static bool tokenizeFiles(const std::vector<const char*>& filenames, std::vector<Token>& tokensOut)
+{
+	for (const char* filename : filenames)
+	{
+		const char* contents = nullptr;
+		unsigned long contentsSize = 0;
+		if (!fileMapReadOnly(filename, &contents, &contentsSize))
+			return false;
+
+		unsigned int lineNumber = 0;
+		const char* error = tokenizeFile(contents, contentsSize, filename,
+		                                 /*firstLineNumber=*/1, &lineNumber, tokensOut);
+		fileUnmap(contents, contentsSize);
+		if (error)
+		{
+			Logf("%s:%d: error: %s\n", filename, lineNumber, error);
+			return false;
+		}
+	}
+	return true;
+}
+
+//
+// Tokenizer
+//
+
+enum OriginalTokenizeState
+{
+	OriginalTokenizeState_Normal,
+	OriginalTokenizeState_Symbol,
+	OriginalTokenizeState_InString
+};
+
+// The tokenizer before delimiter scanning was vectorized, which the benchmark compares against. It
+// checks one character at a time with std::isspace(), and is fed one line at a time
+static const char* originalTokenizeLine(const char* inputLine, const char* source,
+                                        unsigned int lineNumber, std::vector<Token>& tokensOut)
+{
+	const char* A_OK = nullptr;
+
+	OriginalTokenizeState tokenizeState = OriginalTokenizeState_Normal;
+	char previousChar = 0;
+
+	char contentsBuffer[1024] = {0};
+	char* contentsBufferWrite = contentsBuffer;
+#define WriteContents(character)                                                 \
+	{                                                                            \
+		if (contentsBufferWrite - contentsBuffer < (long)sizeof(contentsBuffer)) \
+		{                                                                        \
+			*contentsBufferWrite = *currentChar;                                 \
+			++contentsBufferWrite;                                               \
+			*contentsBufferWrite = '\0';                                         \
+		}                                                                        \
+		else                                                                     \
+		{                                                                        \
+			return "String too long!";                                           \
+		}                                                                        \
+	}
+#define CopyContentsAndReset(outputString)    \
+	{                                         \
+		outputString = contentsBuffer;        \
+		contentsBufferWrite = contentsBuffer; \
+	}
+
+	int columnStart = 0;
+
+	for (const char* currentChar = inputLine; *currentChar != '\0'; ++currentChar)
+	{
+		int currentColumn = currentChar - inputLine;
+
+		switch (tokenizeState)
+		{
+			case OriginalTokenizeState_Normal:
+				// The whole rest of the line is ignored
+				if (*currentChar == ';')
+					return A_OK;
+				else if (*currentChar == '(')
+				{
+					Token openParen = {TokenType_OpenParen, EmptyString,   source,
+					                   lineNumber,          currentColumn, currentColumn + 1};
+					tokensOut.push_back(openParen);
+				}
+				else if (*currentChar == ')')
+				{
+					Token closeParen = {TokenType_CloseParen, EmptyString,   source,
+					                    lineNumber,           currentColumn, currentColumn + 1};
+					tokensOut.push_back(closeParen);
+				}
+				else if (*currentChar == '"')
+				{
+					tokenizeState = OriginalTokenizeState_InString;
+					columnStart = currentColumn;
+				}
+				else if (std::isspace(*currentChar))
+				{
+				}
+				else
+				{
+					tokenizeState = OriginalTokenizeState_Symbol;
+					columnStart = currentColumn;
+					WriteContents(*currentChar);
+				}
+				break;
+			case OriginalTokenizeState_Symbol:
+			{
+				bool isParenthesis = *currentChar == ')' || *currentChar == '(';
+				// Finished the symbol
+				if (std::isspace(*currentChar) || *currentChar == '\n' || isParenthesis)
+				{
+					Token symbol = {TokenType_Symbol, EmptyString, source,
+					                lineNumber,       columnStart, currentColumn};
+					CopyContentsAndReset(symbol.contents);
+					tokensOut.push_back(symbol);
+
+					if (*currentChar == '(')
+					{
+						Token openParen = {TokenType_OpenParen, EmptyString,   source,
+						                   lineNumber,          currentColumn, currentColumn + 1};
+						tokensOut.push_back(openParen);
+					}
+					else if (*currentChar == ')')
+					{
+						Token closeParen = {TokenType_CloseParen, EmptyString,   source,
+						                    lineNumber,           currentColumn, currentColumn + 1};
+						tokensOut.push_back(closeParen);
+					}
+
+					tokenizeState = OriginalTokenizeState_Normal;
+				}
+				else
+				{
+					WriteContents(*currentChar);
+				}
+				break;
+			}
+			case OriginalTokenizeState_InString:
+				if (*currentChar == '"' && previousChar != '\\')
+				{
+					Token string = {TokenType_String, EmptyString, source,
+					                lineNumber,       columnStart, currentColumn + 1};
+					CopyContentsAndReset(string.contents);
+					tokensOut.push_back(string);
+
+					contentsBufferWrite = contentsBuffer;
+					tokenizeState = OriginalTokenizeState_Normal;
+				}
+				else
+				{
+					WriteContents(*currentChar);
+				}
+				break;
+			default:
+				return "Unknown state! Aborting";
+		}
+
+		previousChar = *currentChar;
+	}
+#undef WriteContents
+#undef CopyContentsAndReset
+
+	if (tokenizeState == OriginalTokenizeState_Symbol)
+		return "Unterminated symbol (code error?)";
+	if (tokenizeState == OriginalTokenizeState_InString)
+		return "Unterminated string";
+
+	return A_OK;
+}
+
+// Splits the contents into lines like the original file reading did with fgets()
+static const char* originalTokenizeFile(const char* contents, unsigned long contentsSize,
+                                        const char* source, std::vector<Token>& tokensOut)
+{
+	char lineBuffer[2048] = {0};
+	unsigned int lineNumber = 1;
+	const char* end = contents + contentsSize;
+	for (const char* lineStart = contents; lineStart < end; ++lineNumber)
+	{
+		const char* lineEnd = (const char*)memchr(lineStart, '\n', end - lineStart);
+		lineEnd = lineEnd ? lineEnd + 1 : end;
+		size_t lineLength = lineEnd - lineStart;
+		if (lineLength >= sizeof(lineBuffer))
+			return "Line too long for the original tokenizer";
+		memcpy(lineBuffer, lineStart, lineLength);
+		lineBuffer[lineLength] = '\0';
+
+		const char* error = originalTokenizeLine(lineBuffer, source, lineNumber, tokensOut);
+		if (error)
+			return error;
+		lineStart = lineEnd;
+	}
+	return nullptr;
+}
+
+// Tokenize the files repeatedly with the original and the current tokenizer. Returns false if any
+// file failed to tokenize
+static bool benchmarkTokenizer(const std::vector<const char*>& filenames)
+{
+	std::vector<std::string> fileContents;
+	unsigned long totalBytes = 0;
+	for (const char* filename : filenames)
+	{
+		const char* contents = nullptr;
+		unsigned long contentsSize = 0;
+		if (!fileMapReadOnly(filename, &contents, &contentsSize))
+			return false;
+		fileContents.push_back(std::string(contents ? contents : "", contentsSize));
+		totalBytes += contentsSize;
+		fileUnmap(contents, contentsSize);
+	}
+
+	bool useOriginalModes[] = {true, false};
+	for (bool useOriginal : useOriginalModes)
+	{
+		unsigned long totalTokens = 0;
+		// Reused so that the timings are dominated by tokenization rather than allocation
+		std::vector<Token> tokens;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int iteration = 0; iteration < numIterations; ++iteration)
+		{
+			for (size_t fileIndex = 0; fileIndex < fileContents.size(); ++fileIndex)
+			{
+				const std::string& contents = fileContents[fileIndex];
+				const char* filename = filenames[fileIndex];
+				tokens.clear();
+				unsigned int lineNumber = 0;
+				const char* error =
+				    useOriginal ?
+				        originalTokenizeFile(contents.data(), contents.size(), filename, tokens) :
+				        tokenizeFile(contents.data(), contents.size(), filename,
+				                     /*firstLineNumber=*/1, &lineNumber, tokens);
+				if (error)
+				{
+					Logf("%s: error: %s\n", filename, error);
+					return false;
+				}
+
+				totalTokens += tokens.size();
+			}
+		}
+		double seconds =
+		    std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		Logf("%-10s %d iterations over %lu bytes: %.3f seconds (%.1f MB/s, %lu tokens)\n",
+		     useOriginal ? "original" : "current", numIterations, totalBytes, seconds,
+		     (double)(totalBytes * numIterations) / (seconds * 1024.0 * 1024.0), totalTokens);
+	}
+
+	return true;
+}
+
+//
+// Hash tables
+//
+
+// Insert every distinct key, look up each key in lookups (hits and misses), then iterate
+template <typename TableType, typename KeyType>
+static void benchmarkHashTable(const char* tableName, const std::vector<KeyType>& keys,
+                               const std::vector<KeyType>& lookups)
+{
+	unsigned long numFound = 0;
+	double insertSeconds = 0.0;
+	double lookupSeconds = 0.0;
+	double iterateSeconds = 0.0;
+	for (int iteration = 0; iteration < numIterations; ++iteration)
+	{
+		TableType table;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		// Only even keys are inserted, so half the lookups miss, like checking for a generator
+		// before a macro or function
+		for (size_t i = 0; i < keys.size(); i += 2)
+			table[keys[i]] = (void*)&keys[i];
+		std::chrono::steady_clock::time_point inserted = std::chrono::steady_clock::now();
+		for (const KeyType& key : lookups)
+		{
+			if (table.find(key) != table.end())
+				++numFound;
+		}
+		std::chrono::steady_clock::time_point lookedUp = std::chrono::steady_clock::now();
+		for (const typename TableType::value_type& pair : table)
+		{
+			if (pair.second)
+				++numFound;
+		}
+		std::chrono::steady_clock::time_point iterated = std::chrono::steady_clock::now();
+
+		insertSeconds += std::chrono::duration<double>(inserted - start).count();
+		lookupSeconds += std::chrono::duration<double>(lookedUp - inserted).count();
+		iterateSeconds += std::chrono::duration<double>(iterated - lookedUp).count();
+	}
+
+	Logf("%-32s insert %.3f ms  lookup %.3f ms  iterate %.3f ms  (%lu found)\n", tableName,
+	     insertSeconds * 1000.0 / numIterations, lookupSeconds * 1000.0 / numIterations,
+	     iterateSeconds * 1000.0 / numIterations, numFound / numIterations);
+}
+
+// Compare the evaluator's tables against std::unordered_map. The keys are the symbols in the given
+// files, and every symbol token is looked up, which approximates what evaluation does
+static bool benchmarkHashTables(const std::vector<const char*>& filenames)
+{
+	std::vector<Token> tokens;
+	if (!tokenizeFiles(filenames, tokens))
+		return false;
+
+	std::vector<Symbol> lookupSymbols;
+	std::unordered_map<Symbol, bool, SymbolHash> uniqueSymbols;
+	std::vector<Symbol> keySymbols;
+	for (const Token& token : tokens)
+	{
+		if (token.type != TokenType_Symbol)
+			continue;
+		lookupSymbols.push_back(token.contents);
+		if (uniqueSymbols.insert(std::make_pair(token.contents, true)).second)
+			keySymbols.push_back(token.contents);
+	}
+
+	std::vector<std::string> lookupStrings;
+	lookupStrings.reserve(lookupSymbols.size());
+	for (const Symbol& symbol : lookupSymbols)
+		lookupStrings.push_back(symbol.str());
+	std::vector<std::string> keyStrings;
+	keyStrings.reserve(keySymbols.size());
+	for (const Symbol& symbol : keySymbols)
+		keyStrings.push_back(symbol.str());
+
+	Logf("%lu distinct symbols (half inserted), %lu lookups\n", keySymbols.size(),
+	     lookupSymbols.size());
+	benchmarkHashTable<std::unordered_map<Symbol, void*, SymbolHash>>(
+	    "std::unordered_map<Symbol>", keySymbols, lookupSymbols);
+	benchmarkHashTable<HashTable<Symbol, void*, SymbolHash>>("HashTable<Symbol>", keySymbols,
+	                                                         lookupSymbols);
+	benchmarkHashTable<std::unordered_map<std::string, void*>>("std::unordered_map<std::string>",
+	                                                           keyStrings, lookupStrings);
+	benchmarkHashTable<HashTable<std::string, void*>>("HashTable<std::string>", keyStrings,
+	                                                  lookupStrings);
+	return true;
+}
+
+//
+// Main
+//
+
+typedef bool (*BenchmarkFunc)(const std::vector<const char*>& filenames);
+
+struct Benchmark
+{
+	const char* name;
+	BenchmarkFunc run;
+	const char* help;
+};
+
+int main(int numArguments, char* arguments[])
+{
+	const Benchmark benchmarks[] = {
+	    {"tokenizer", benchmarkTokenizer,
+	     "Tokenize the given files many times, with both the original (scalar) tokenizer and the "
+	     "current one, and output the timings"},
+	    {"hash-tables", benchmarkHashTables,
+	     "Time the evaluator's hash tables against std::unordered_map, using the symbols in the "
+	     "given files as keys"}};
+
+	const Benchmark* benchmark = nullptr;
+	if (numArguments >= 3)
+	{
+		for (const Benchmark& candidate : benchmarks)
+		{
+			if (strcmp(arguments[1], candidate.name) == 0)
+				benchmark = &candidate;
+		}
+	}
+
+	if (!benchmark)
+	{
+		Log("USAGE: cakelisp_benchmark <benchmark> <.cake files>\n\nBENCHMARKS:\n");
+		for (const Benchmark& candidate : benchmarks)
+			Logf("  %s\n    %s\n\n", candidate.name, candidate.help);
+		return 1;
+	}
+
+	std::vector<const char*> filenames(arguments + 2, arguments + numArguments);
+	return benchmark->run(filenames) ? 0 : 1;
+}
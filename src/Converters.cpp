@@ -8,12 +8,13 @@
 #include <stdio.h>
 #include <string.h>
 
-void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* bufferOut,
+bool lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* bufferOut,
                                int bufferOutSize, const Token& token)
 {
 	bool upcaseNextCharacter = false;
 	bool isPlural = false;
 	bool requiredSymbolConversion = false;
+	bool hasErrors = false;
 
 	char* bufferWrite = bufferOut;
 
@@ -26,7 +27,7 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 				case NameStyleMode_Underscores:
 					if (!writeCharToBufferErrorToken('_', &bufferWrite, bufferOut, bufferOutSize,
 					                                 token))
-						return;
+						return false;
 					break;
 				case NameStyleMode_CamelCase:
 					upcaseNextCharacter = true;
@@ -42,6 +43,7 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 					ErrorAtToken(token,
 					             "lispNameStyleToCNameStyle() encountered unrecognized separator "
 					             "mode\n");
+					hasErrors = true;
 					break;
 			}
 		}
@@ -51,21 +53,24 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 			if ((c == name && *c + 1 == ':') || (*(c + 1) == ':' || *(c - 1) == ':'))
 			{
 				if (!writeCharToBufferErrorToken(*c, &bufferWrite, bufferOut, bufferOutSize, token))
-					return;
+					return false;
 			}
 			else
 			{
 				if (c == name)
+				{
+					hasErrors = true;
 					ErrorAtToken(
 					    token,
 					    "lispNameStyleToCNameStyle() received name starting with : which "
 					    "wasn't a C++-style :: scope resolution operator; is a generator wrongly "
 					    "interpreting a special symbol?\n");
+				}
 
 				requiredSymbolConversion = true;
 				if (!writeStringToBufferErrorToken("Colon", &bufferWrite, bufferOut, bufferOutSize,
 				                                   token))
-					return;
+					return false;
 			}
 		}
 		else if (isalnum(*c) || *c == '_')
@@ -74,12 +79,12 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 			{
 				if (!writeCharToBufferErrorToken(toupper(*c), &bufferWrite, bufferOut,
 				                                 bufferOutSize, token))
-					return;
+					return false;
 			}
 			else
 			{
 				if (!writeCharToBufferErrorToken(*c, &bufferWrite, bufferOut, bufferOutSize, token))
-					return;
+					return false;
 			}
 
 			upcaseNextCharacter = false;
@@ -94,33 +99,33 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 				case '+':
 					if (!writeStringToBufferErrorToken("Add", &bufferWrite, bufferOut,
 					                                   bufferOutSize, token))
-						return;
+						return false;
 					break;
 				case '-':
 					if (!writeStringToBufferErrorToken("Sub", &bufferWrite, bufferOut,
 					                                   bufferOutSize, token))
-						return;
+						return false;
 					break;
 				case '*':
 					if (!writeStringToBufferErrorToken("Mul", &bufferWrite, bufferOut,
 					                                   bufferOutSize, token))
-						return;
+						return false;
 					break;
 				case '/':
 					if (!writeStringToBufferErrorToken("Div", &bufferWrite, bufferOut,
 					                                   bufferOutSize, token))
-						return;
+						return false;
 					break;
 				case '%':
 					if (!writeStringToBufferErrorToken("Mod", &bufferWrite, bufferOut,
 					                                   bufferOutSize, token))
-						return;
+						return false;
 					break;
 				case '.':
 					// TODO: Decide how to handle object pathing
 					if (!writeStringToBufferErrorToken(".", &bufferWrite, bufferOut, bufferOutSize,
 					                                   token))
-						return;
+						return false;
 					break;
 				default:
 					ErrorAtTokenf(
@@ -129,9 +134,10 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 					    "'%c' which has no conversion equivalent. It will be replaced with "
 					    "'BadChar'",
 					    name, *c);
+					hasErrors = true;
 					if (!writeStringToBufferErrorToken("BadChar", &bufferWrite, bufferOut,
 					                                   bufferOutSize, token))
-						return;
+						return false;
 					break;
 			}
 		}
@@ -153,4 +159,35 @@ void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* buffe
 		bufferOut[0] = tolower(bufferOut[0]);
 
 	*bufferWrite = '\0';
+	return !hasErrors;
+}
+
+Symbol lispNameStyleToCNameStyleCached(NameConversionCache& cache, NameStyleMode mode,
+                                       const Symbol& name, const Token& token)
+{
+	NameConversionCacheShard& shard = cache.shards[name.id % (ArraySize(cache.shards))];
+	uint64_t key = ((uint64_t)name.id << 8) | (uint64_t)mode;
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		std::unordered_map<uint64_t, SymbolId>::iterator findIt = shard.convertedNames.find(key);
+		if (findIt != shard.convertedNames.end())
+		{
+			Symbol convertedName;
+			convertedName.id = findIt->second;
+			return convertedName;
+		}
+	}
+
+	// Converted outside the lock. Another thread converting the same name at the same time gets
+	// the same result, so it doesn't matter which is stored
+	char convertedNameBuffer[MAX_NAME_LENGTH] = {0};
+	bool isConverted = lispNameStyleToCNameStyle(mode, name.c_str(), convertedNameBuffer,
+	                                             sizeof(convertedNameBuffer), token);
+	Symbol convertedName(convertedNameBuffer);
+	if (isConverted)
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.convertedNames[key] = convertedName.id;
+	}
+	return convertedName;
 }
@@ -1,6 +1,12 @@
 #pragma once
 
 #include "ConverterEnums.hpp"
+#include "Symbols.hpp"
+
+#include <stdint.h>
+
+#include <mutex>
+#include <unordered_map>
 
 struct Token;
 
@@ -26,5 +32,26 @@ struct NameStyleSettings
 // C names. It's safe to e.g. pass in valid C names because they cannot have lisp-allowed symbols in
 // them. This also means you can use whatever style you want in Cakelisp, and you'll get valid C/C++
 // generated (so long as your non-'-' strings match the other C/C++ names)
-void lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* bufferOut,
+// Returns false if the name could not be fully converted (an error will have been reported)
+bool lispNameStyleToCNameStyle(NameStyleMode mode, const char* name, char* bufferOut,
                                int bufferOutSize, const Token& token);
+
+// The same names are converted over and over (every reference to a function, for example), so
+// conversions are remembered per environment. Split into shards, each with its own lock, because
+// modules are written from several threads
+struct NameConversionCacheShard
+{
+	std::mutex mutex;
+	// Keyed by the name's SymbolId and the NameStyleMode
+	std::unordered_map<uint64_t, SymbolId> convertedNames;
+};
+
+struct NameConversionCache
+{
+	NameConversionCacheShard shards[16];
+};
+
+// Like lispNameStyleToCNameStyle(), but only converts each name once per mode. Names which fail to
+// convert aren't remembered, so their errors are reported every time
+Symbol lispNameStyleToCNameStyleCached(NameConversionCache& cache, NameStyleMode mode,
+                                       const Symbol& name, const Token& token);
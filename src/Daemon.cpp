@@ -0,0 +1,363 @@
+#include "Daemon.hpp"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#ifdef UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#else
+#error Platform support is needed for the build daemon
+#endif
+
+#include "Evaluator.hpp"
+#include "FileUtilities.hpp"
+#include "Logging.hpp"
+#include "Utilities.hpp"
+
+// The request is this header, then the client's working directory and arguments, each null
+// terminated. The client's stdout and stderr file descriptors are sent along with the header
+struct DaemonRequestHeader
+{
+	char magic[4];
+	uint32_t payloadSize;
+};
+
+struct DaemonResponse
+{
+	// The client must build by itself if the daemon refuses the request
+	int32_t isAccepted;
+	int32_t exitCode;
+};
+
+static const char daemonRequestMagic[4] = {'C', 'K', 'D', '1'};
+// Requests are only arguments, so anything larger is not from a Cakelisp client
+static const uint32_t maxDaemonPayloadSize = 1 << 20;
+
+static void getDaemonSocketFilename(char* bufferOut, int bufferSize)
+{
+	SafeSnprinf(bufferOut, bufferSize, "%s/daemon.socket", cakelispWorkingDir);
+}
+
+static bool sendAll(int socketFileDescriptor, const void* data, size_t size)
+{
+	const char* dataHead = (const char*)data;
+	while (size)
+	{
+		ssize_t numSent = send(socketFileDescriptor, dataHead, size, MSG_NOSIGNAL);
+		if (numSent < 0 && errno == EINTR)
+			continue;
+		if (numSent <= 0)
+			return false;
+		dataHead += numSent;
+		size -= numSent;
+	}
+	return true;
+}
+
+static bool receiveAll(int socketFileDescriptor, void* dataOut, size_t size)
+{
+	char* dataHead = (char*)dataOut;
+	while (size)
+	{
+		ssize_t numReceived = recv(socketFileDescriptor, dataHead, size, 0);
+		if (numReceived < 0 && errno == EINTR)
+			continue;
+		if (numReceived <= 0)
+			return false;
+		dataHead += numReceived;
+		size -= numReceived;
+	}
+	return true;
+}
+
+//
+// Daemon
+//
+
+static volatile sig_atomic_t s_daemonShouldStop = 0;
+
+static void onDaemonStopSignal(int signalNumber)
+{
+	s_daemonShouldStop = 1;
+}
+
+// Returns false if the header couldn't be received. Any file descriptors received are output
+static bool daemonReceiveRequestHeader(int connection, DaemonRequestHeader& headerOut,
+                                       int* outputFileDescriptorsOut)
+{
+	struct iovec headerVector = {&headerOut, sizeof(headerOut)};
+	union
+	{
+		char buffer[CMSG_SPACE(2 * sizeof(int))];
+		struct cmsghdr align;
+	} controlMessage;
+	struct msghdr message = {};
+	message.msg_iov = &headerVector;
+	message.msg_iovlen = 1;
+	message.msg_control = controlMessage.buffer;
+	message.msg_controllen = sizeof(controlMessage.buffer);
+
+	ssize_t numReceived = 0;
+	do
+	{
+		numReceived = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+	} while (numReceived < 0 && errno == EINTR);
+
+	for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header;
+	     header = CMSG_NXTHDR(&message, header))
+	{
+		if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS &&
+		    header->cmsg_len == CMSG_LEN(2 * sizeof(int)))
+			memcpy(outputFileDescriptorsOut, CMSG_DATA(header), 2 * sizeof(int));
+	}
+
+	if (numReceived <= 0)
+		return false;
+	// The rest of the header is small enough to never be split in practice, but it may be
+	if ((size_t)numReceived < sizeof(headerOut) &&
+	    !receiveAll(connection, (char*)&headerOut + numReceived, sizeof(headerOut) - numReceived))
+		return false;
+
+	return memcmp(headerOut.magic, daemonRequestMagic, sizeof(headerOut.magic)) == 0 &&
+	       headerOut.payloadSize <= maxDaemonPayloadSize;
+}
+
+static void daemonServeConnection(int connection, const char* workingDirectory,
+                                  DaemonBuildFunc build, void* userData)
+{
+	DaemonRequestHeader header = {};
+	int outputFileDescriptors[2] = {-1, -1};
+	std::vector<char> payload;
+	bool isValidRequest = daemonReceiveRequestHeader(connection, header, outputFileDescriptors) &&
+	                      outputFileDescriptors[0] != -1 && outputFileDescriptors[1] != -1;
+	if (isValidRequest)
+	{
+		payload.resize(header.payloadSize + 1, '\0');
+		isValidRequest = receiveAll(connection, payload.data(), header.payloadSize);
+	}
+
+	// Payload is the working directory, then the arguments
+	std::vector<char*> arguments;
+	const char* clientWorkingDirectory = nullptr;
+	for (size_t i = 0; isValidRequest && i < header.payloadSize; i += strlen(&payload[i]) + 1)
+	{
+		if (!clientWorkingDirectory)
+			clientWorkingDirectory = &payload[i];
+		else
+			arguments.push_back(&payload[i]);
+	}
+
+	DaemonResponse response = {};
+	// Paths in the build are relative to the working directory, and the cache is in it
+	if (isValidRequest && !arguments.empty() && clientWorkingDirectory &&
+	    strcmp(clientWorkingDirectory, workingDirectory) == 0)
+	{
+		response.isAccepted = 1;
+
+		fflush(stdout);
+		fflush(stderr);
+		int daemonStdOut = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+		int daemonStdErr = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+		dup2(outputFileDescriptors[0], STDOUT_FILENO);
+		dup2(outputFileDescriptors[1], STDERR_FILENO);
+
+		arguments.push_back(nullptr);
+		response.exitCode = build((int)arguments.size() - 1, arguments.data(), userData);
+
+		fflush(stdout);
+		fflush(stderr);
+		dup2(daemonStdOut, STDOUT_FILENO);
+		dup2(daemonStdErr, STDERR_FILENO);
+		close(daemonStdOut);
+		close(daemonStdErr);
+
+		Logf("daemon: served build of %s (exit code %d)\n", arguments[arguments.size() - 2],
+		     response.exitCode);
+	}
+	else if (isValidRequest)
+	{
+		Logf("daemon: refused build from %s, which is not the daemon's working directory\n",
+		     clientWorkingDirectory ? clientWorkingDirectory : "(none)");
+	}
+	else
+	{
+		Log("daemon: ignored malformed request\n");
+	}
+
+	for (int fileDescriptor : outputFileDescriptors)
+	{
+		if (fileDescriptor != -1)
+			close(fileDescriptor);
+	}
+
+	sendAll(connection, &response, sizeof(response));
+}
+
+bool daemonServe(DaemonBuildFunc build, void* userData)
+{
+	char workingDirectory[MAX_PATH_LENGTH] = {0};
+	if (!getcwd(workingDirectory, sizeof(workingDirectory)))
+	{
+		perror("daemon: getcwd() error: ");
+		return false;
+	}
+
+	char socketFilename[MAX_PATH_LENGTH] = {0};
+	getDaemonSocketFilename(socketFilename, sizeof(socketFilename));
+	struct sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (strlen(socketFilename) >= sizeof(address.sun_path))
+	{
+		Logf("daemon: error: socket path %s is too long\n", socketFilename);
+		return false;
+	}
+	PrintBuffer(address.sun_path, socketFilename);
+
+	makeDirectory(cakelispWorkingDir);
+
+	int listenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listenSocket == -1)
+	{
+		perror("daemon: socket() error: ");
+		return false;
+	}
+
+	// A socket file left by a daemon which didn't shut down cleanly would prevent binding. If
+	// another daemon is actually serving, it stays running but no longer receives requests
+	remove(socketFilename);
+	if (bind(listenSocket, (struct sockaddr*)&address, sizeof(address)) == -1 ||
+	    listen(listenSocket, /*backlog=*/16) == -1)
+	{
+		perror("daemon: bind() error: ");
+		close(listenSocket);
+		return false;
+	}
+
+	// No SA_RESTART, so accept() returns when the daemon is asked to stop
+	struct sigaction stopAction = {};
+	stopAction.sa_handler = onDaemonStopSignal;
+	sigemptyset(&stopAction.sa_mask);
+	struct sigaction previousInterruptAction;
+	struct sigaction previousTerminateAction;
+	sigaction(SIGINT, &stopAction, &previousInterruptAction);
+	sigaction(SIGTERM, &stopAction, &previousTerminateAction);
+
+	Logf("daemon: serving builds for %s at %s\n", workingDirectory, socketFilename);
+
+	s_daemonShouldStop = 0;
+	while (!s_daemonShouldStop)
+	{
+		int connection = accept4(listenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+		if (connection == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("daemon: accept() error: ");
+			break;
+		}
+
+		daemonServeConnection(connection, workingDirectory, build, userData);
+		close(connection);
+	}
+
+	sigaction(SIGINT, &previousInterruptAction, nullptr);
+	sigaction(SIGTERM, &previousTerminateAction, nullptr);
+	close(listenSocket);
+	remove(socketFilename);
+
+	Log("daemon: stopped\n");
+	return true;
+}
+
+//
+// Client
+//
+
+bool daemonRequestBuild(int numArguments, char* arguments[], int* exitCodeOut)
+{
+	char socketFilename[MAX_PATH_LENGTH] = {0};
+	getDaemonSocketFilename(socketFilename, sizeof(socketFilename));
+	if (!fileExists(socketFilename))
+		return false;
+
+	struct sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (strlen(socketFilename) >= sizeof(address.sun_path))
+		return false;
+	PrintBuffer(address.sun_path, socketFilename);
+
+	char workingDirectory[MAX_PATH_LENGTH] = {0};
+	if (!getcwd(workingDirectory, sizeof(workingDirectory)))
+		return false;
+
+	int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (connection == -1)
+		return false;
+	// Fails if the socket was left by a daemon which is no longer running
+	if (connect(connection, (struct sockaddr*)&address, sizeof(address)) == -1)
+	{
+		close(connection);
+		return false;
+	}
+
+	std::string payload = workingDirectory;
+	payload.push_back('\0');
+	for (int i = 0; i < numArguments; ++i)
+	{
+		payload.append(arguments[i]);
+		payload.push_back('\0');
+	}
+
+	DaemonRequestHeader header = {};
+	memcpy(header.magic, daemonRequestMagic, sizeof(header.magic));
+	header.payloadSize = (uint32_t)payload.size();
+
+	// Send our output file descriptors with the header, so the build outputs straight to them
+	int outputFileDescriptors[2] = {STDOUT_FILENO, STDERR_FILENO};
+	struct iovec headerVector = {&header, sizeof(header)};
+	union
+	{
+		char buffer[CMSG_SPACE(sizeof(outputFileDescriptors))];
+		struct cmsghdr align;
+	} controlMessage;
+	struct msghdr message = {};
+	message.msg_iov = &headerVector;
+	message.msg_iovlen = 1;
+	message.msg_control = controlMessage.buffer;
+	message.msg_controllen = sizeof(controlMessage.buffer);
+	struct cmsghdr* controlHeader = CMSG_FIRSTHDR(&message);
+	controlHeader->cmsg_level = SOL_SOCKET;
+	controlHeader->cmsg_type = SCM_RIGHTS;
+	controlHeader->cmsg_len = CMSG_LEN(sizeof(outputFileDescriptors));
+	memcpy(CMSG_DATA(controlHeader), outputFileDescriptors, sizeof(outputFileDescriptors));
+
+	fflush(stdout);
+	fflush(stderr);
+
+	ssize_t numSent = 0;
+	do
+	{
+		numSent = sendmsg(connection, &message, MSG_NOSIGNAL);
+	} while (numSent < 0 && errno == EINTR);
+
+	DaemonResponse response = {};
+	bool isServed = numSent == (ssize_t)sizeof(header) &&
+	                sendAll(connection, payload.data(), payload.size()) &&
+	                receiveAll(connection, &response, sizeof(response)) && response.isAccepted;
+	close(connection);
+
+	if (!isServed)
+		return false;
+
+	*exitCodeOut = response.exitCode;
+	return true;
+}
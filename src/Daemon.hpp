@@ -0,0 +1,18 @@
+#pragma once
+
+// A resident Cakelisp process can serve builds requested by other Cakelisp processes, over a Unix
+// socket in the cache directory. The daemon keeps the tokens of unchanged files and the loaded
+// compile-time function libraries between builds (see ModuleResidentState). Each build still
+// evaluates every module in a fresh environment, so it saves loading, not evaluating
+
+// Runs one build in the daemon. The arguments are the client's, so they are parsed as usual.
+// Output goes to the client's stdout and stderr while the build runs
+typedef int (*DaemonBuildFunc)(int numArguments, char* arguments[], void* userData);
+
+// Serves builds one at a time until interrupted (SIGINT or SIGTERM). Only clients in the same
+// working directory are served. Returns false if the socket could not be set up
+bool daemonServe(DaemonBuildFunc build, void* userData);
+
+// Returns false if no daemon is serving this working directory, in which case the build should be
+// run in this process instead. Otherwise, exitCodeOut is set to the build's exit code
+bool daemonRequestBuild(int numArguments, char* arguments[], int* exitCodeOut);
@@ -4,9 +4,12 @@
 
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #ifdef UNIX
 #include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #elif WINDOWS
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -14,19 +17,83 @@
 #error Platform support is needed for dynamic loading
 #endif
 
+// Identifies which build of a library file was loaded. Linkers write a new file rather than
+// overwriting the old one, so the inode changes even if the rebuild is within the same second
+struct DynamicLibraryFileVersion
+{
+	unsigned long inode;
+	unsigned long modificationTime;
+};
+
 struct DynamicLibrary
 {
 	DynamicLibHandle handle;
+	DynamicLibraryFileVersion fileVersion;
 };
 
+// Returns false if the version can't be determined, in which case the loaded library is reused
+static bool getDynamicLibraryFileVersion(const char* libraryPath,
+                                         DynamicLibraryFileVersion* versionOut)
+{
+#ifdef UNIX
+	struct stat fileStat;
+	if (stat(libraryPath, &fileStat) == -1)
+		return false;
+	versionOut->inode = (unsigned long)fileStat.st_ino;
+	versionOut->modificationTime = (unsigned long)fileStat.st_mtime;
+	return true;
+#else
+	return false;
+#endif
+}
+
 typedef std::unordered_map<std::string, DynamicLibrary> DynamicLibraryMap;
 static DynamicLibraryMap dynamicLibraries;
 
+// Versions of libraries which have since been rebuilt. These stay open until everything is closed
+static std::vector<DynamicLibHandle> replacedDynamicLibraries;
+
 DynamicLibHandle loadDynamicLibrary(const char* libraryPath)
 {
 	void* libHandle = nullptr;
 
+	// Libraries stay loaded between builds in a resident process. The loader would return the old
+	// library even if the file had been rebuilt since, so only reuse it if it is unchanged
+	DynamicLibraryFileVersion fileVersion = {};
+	bool hasFileVersion = getDynamicLibraryFileVersion(libraryPath, &fileVersion);
+	bool isReload = false;
+	DynamicLibraryMap::iterator findIt = dynamicLibraries.find(libraryPath);
+	if (findIt != dynamicLibraries.end())
+	{
+		const DynamicLibraryFileVersion& loadedVersion = findIt->second.fileVersion;
+		if (!hasFileVersion || (loadedVersion.inode == fileVersion.inode &&
+		                        loadedVersion.modificationTime == fileVersion.modificationTime))
+			return findIt->second.handle;
+		isReload = true;
+	}
+
 #ifdef UNIX
+	// Other libraries may have bound to symbols in the old version (RTLD_GLOBAL), so it must not be
+	// closed. The loader matches libraries by path, so load the rebuilt one through a new link
+	const char* loadPath = libraryPath;
+	std::string reloadPath;
+	if (isReload)
+	{
+		static unsigned int numReloads = 0;
+		char reloadSuffix[64] = {0};
+		snprintf(reloadSuffix, sizeof(reloadSuffix), ".%lu.%u.reload", (unsigned long)getpid(),
+		         numReloads++);
+		reloadPath = libraryPath;
+		reloadPath.append(reloadSuffix);
+		if (link(libraryPath, reloadPath.c_str()) == -1)
+		{
+			perror("link: ");
+			fprintf(stderr, "DynamicLoader Error: could not link %s to reload it\n", libraryPath);
+			return nullptr;
+		}
+		loadPath = reloadPath.c_str();
+	}
+
 	// Clear error
 	dlerror();
 
@@ -34,7 +101,11 @@ DynamicLibHandle loadDynamicLibrary(const char* libraryPath)
 	// RTLD_GLOBAL: Allow subsequently loaded libraries to resolve from this library (mainly for
 	// compile-time function execution)
 	// Note that this requires linking with -Wl,-rpath,. in order to turn up relative path .so files
-	libHandle = dlopen(libraryPath, RTLD_LAZY | RTLD_GLOBAL);
+	libHandle = dlopen(loadPath, RTLD_LAZY | RTLD_GLOBAL);
+
+	// The library stays mapped, so the link isn't needed after loading
+	if (isReload)
+		unlink(loadPath);
 
 	const char* error = dlerror();
 	if (!libHandle || error)
@@ -43,12 +114,15 @@ DynamicLibHandle loadDynamicLibrary(const char* libraryPath)
 		return nullptr;
 	}
 
+	if (isReload)
+		replacedDynamicLibraries.push_back(findIt->second.handle);
+
 #elif WINDOWS
 	// TODO: Any way to get errors if this fails?
 	libHandle = LoadLibrary(libraryPath);
 #endif
 
-	dynamicLibraries[libraryPath] = {libHandle};
+	dynamicLibraries[libraryPath] = {libHandle, fileVersion};
 	return libHandle;
 }
 
@@ -97,6 +171,15 @@ void closeAllDynamicLibraries()
 		dlclose(libraryPair.second.handle);
 #endif
 	}
+	dynamicLibraries.clear();
+
+	for (DynamicLibHandle replacedHandle : replacedDynamicLibraries)
+	{
+#ifdef UNIX
+		dlclose(replacedHandle);
+#endif
+	}
+	replacedDynamicLibraries.clear();
 }
 
 void closeDynamicLibrary(DynamicLibHandle handleToClose)
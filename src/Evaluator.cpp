@@ -6,6 +6,7 @@
 #include "GeneratorHelpers.hpp"
 #include "Generators.hpp"
 #include "Logging.hpp"
+#include "ModuleManager.hpp"
 #include "OutputPreambles.hpp"
 #include "RunProcess.hpp"
 #include "Tokenizer.hpp"
@@ -16,6 +17,10 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
+
 //
 // Environment
 //
@@ -31,47 +36,91 @@ const char* g_environmentPostReferencesResolvedHookSignature =
 
 static const char* g_environmentCompileTimeVariableDestroySignature = "('data (* void))";
 
-GeneratorFunc findGenerator(EvaluatorEnvironment& environment, const char* functionName)
+// Generators add output without passing the environment, so StringOutput text goes to the pool of
+// the environment which last allocated an output. Only one environment evaluates at a time
+static GeneratorOutputPool* s_textOutputPool = nullptr;
+
+GeneratorFunc findGenerator(EvaluatorEnvironment& environment, const Symbol& functionName)
 {
-	GeneratorIterator findIt = environment.generators.find(std::string(functionName));
+	GeneratorIterator findIt = environment.generators.find(functionName);
 	if (findIt != environment.generators.end())
 		return findIt->second;
 	return nullptr;
 }
 
-static MacroFunc findMacro(EvaluatorEnvironment& environment, const char* functionName)
+GeneratorFunc findGenerator(EvaluatorEnvironment& environment, const char* functionName)
+{
+	Symbol functionNameSymbol;
+	if (!symbolFind(functionName, &functionNameSymbol))
+		return nullptr;
+	return findGenerator(environment, functionNameSymbol);
+}
+
+static MacroFunc findMacro(EvaluatorEnvironment& environment, const Symbol& functionName)
 {
-	MacroIterator findIt = environment.macros.find(std::string(functionName));
+	MacroIterator findIt = environment.macros.find(functionName);
 	if (findIt != environment.macros.end())
 		return findIt->second;
 	return nullptr;
 }
 
-void* findCompileTimeFunction(EvaluatorEnvironment& environment, const char* functionName)
+void* findCompileTimeFunction(EvaluatorEnvironment& environment, const Symbol& functionName)
 {
-	CompileTimeFunctionTableIterator findIt =
-	    environment.compileTimeFunctions.find(std::string(functionName));
+	CompileTimeFunctionTableIterator findIt = environment.compileTimeFunctions.find(functionName);
 	if (findIt != environment.compileTimeFunctions.end())
 		return findIt->second;
 	return nullptr;
 }
 
+void* findCompileTimeFunction(EvaluatorEnvironment& environment, const char* functionName)
+{
+	Symbol functionNameSymbol;
+	if (!symbolFind(functionName, &functionNameSymbol))
+		return nullptr;
+	return findCompileTimeFunction(environment, functionNameSymbol);
+}
+
 static bool isCompileTimeCodeLoaded(EvaluatorEnvironment& environment,
                                     const ObjectDefinition& definition)
 {
 	switch (definition.type)
 	{
 		case ObjectType_CompileTimeMacro:
-			return findMacro(environment, definition.name.c_str()) != nullptr;
+			return findMacro(environment, definition.name) != nullptr;
 		case ObjectType_CompileTimeGenerator:
-			return findGenerator(environment, definition.name.c_str()) != nullptr;
+			return findGenerator(environment, definition.name) != nullptr;
 		case ObjectType_CompileTimeFunction:
-			return findCompileTimeFunction(environment, definition.name.c_str()) != nullptr;
+			return findCompileTimeFunction(environment, definition.name) != nullptr;
 		default:
 			return false;
 	}
 }
 
+// Make sure BuildEvaluateReferences() looks at the definition on its next pass
+static void QueueReferenceCheck(EvaluatorEnvironment& environment, ObjectDefinition& definition)
+{
+	if (definition.isReferenceCheckQueued)
+		return;
+	definition.isReferenceCheckQueued = true;
+	environment.definitionsToCheckReferences.push_back(definition.name);
+}
+
+// Something referenced by name changed (e.g. it was defined or loaded), which may let the
+// definitions referencing it build
+static void QueueReferencingDefinitionsCheck(EvaluatorEnvironment& environment, const Symbol& name)
+{
+	ReferencingDefinitionsTable::iterator findReferencers =
+	    environment.referencingDefinitions.find(name);
+	if (findReferencers == environment.referencingDefinitions.end())
+		return;
+	for (const Symbol& referencerName : findReferencers->second)
+	{
+		ObjectDefinition* referencer = findObjectDefinition(environment, referencerName);
+		if (referencer)
+			QueueReferenceCheck(environment, *referencer);
+	}
+}
+
 bool addObjectDefinition(EvaluatorEnvironment& environment, ObjectDefinition& definition)
 {
 	ObjectDefinitionMap::iterator findIt = environment.definitions.find(definition.name);
@@ -86,7 +135,13 @@ bool addObjectDefinition(EvaluatorEnvironment& environment, ObjectDefinition& de
 			return false;
 		}
 
-		environment.definitions[definition.name] = definition;
+		ObjectDefinition& newDefinition = environment.definitions[definition.name];
+		newDefinition = definition;
+		newDefinition.isReferenceCheckQueued = false;
+		++environment.numDefinitionsAdded;
+		environment.definitionsToPropagate.push_back(definition.name);
+		QueueReferenceCheck(environment, newDefinition);
+		QueueReferencingDefinitionsCheck(environment, definition.name);
 		return true;
 	}
 	else
@@ -98,7 +153,7 @@ bool addObjectDefinition(EvaluatorEnvironment& environment, ObjectDefinition& de
 	}
 }
 
-ObjectDefinition* findObjectDefinition(EvaluatorEnvironment& environment, const char* name)
+ObjectDefinition* findObjectDefinition(EvaluatorEnvironment& environment, const Symbol& name)
 {
 	ObjectDefinitionMap::iterator findIt = environment.definitions.find(name);
 	if (findIt != environment.definitions.end())
@@ -106,12 +161,35 @@ ObjectDefinition* findObjectDefinition(EvaluatorEnvironment& environment, const
 	return nullptr;
 }
 
+ObjectDefinition* findObjectDefinition(EvaluatorEnvironment& environment, const char* name)
+{
+	Symbol nameSymbol;
+	if (!symbolFind(name, &nameSymbol))
+		return nullptr;
+	return findObjectDefinition(environment, nameSymbol);
+}
+
+ObjectDefinition* findReferencedDefinition(EvaluatorEnvironment& environment,
+                                           ObjectReferenceStatus& referenceStatus)
+{
+	if (!referenceStatus.definition &&
+	    referenceStatus.numDefinitionsAddedAtMiss != environment.numDefinitionsAdded)
+	{
+		referenceStatus.definition =
+		    findObjectDefinition(environment, referenceStatus.name->contents);
+		if (!referenceStatus.definition)
+			referenceStatus.numDefinitionsAddedAtMiss = environment.numDefinitionsAdded;
+	}
+	return referenceStatus.definition;
+}
+
 const ObjectReferenceStatus* addObjectReference(EvaluatorEnvironment& environment,
                                                 const Token& referenceNameToken,
                                                 ObjectReference& reference)
 {
 	// Default to the module requiring the reference, for top-level references
-	std::string definitionName = globalDefinitionName;
+	static const Symbol globalDefinitionSymbol(globalDefinitionName);
+	Symbol definitionName = globalDefinitionSymbol;
 	if (!reference.context.definitionName && reference.context.scope != EvaluatorScope_Module)
 		Log("error: addObjectReference() expects a definitionName\n");
 
@@ -129,7 +207,7 @@ const ObjectReferenceStatus* addObjectReference(EvaluatorEnvironment& environmen
 	ObjectDefinitionMap::iterator findDefinition = environment.definitions.find(definitionName);
 	if (findDefinition == environment.definitions.end())
 	{
-		if (definitionName.compare(globalDefinitionName) != 0)
+		if (definitionName != globalDefinitionSymbol)
 		{
 			Logf("error: expected definition %s to already exist. Things will break\n",
 			       definitionName.c_str());
@@ -147,23 +225,34 @@ const ObjectReferenceStatus* addObjectReference(EvaluatorEnvironment& environmen
 		// make a good link to the reference in the reference pool, because it can easily be moved
 		// by hash realloc or vector resize
 		ObjectReferenceStatusMap::iterator findRefIt =
-		    findDefinition->second.references.find(referenceNameToken.contents.c_str());
+		    findDefinition->second.references.find(referenceNameToken.contents);
 		if (findRefIt == findDefinition->second.references.end())
 		{
 			ObjectReferenceStatus newStatus;
 			newStatus.name = &referenceNameToken;
+			newStatus.definition = nullptr;
+			// Not looked up yet
+			newStatus.numDefinitionsAddedAtMiss = -1;
 			newStatus.guessState = GuessState_None;
+			newStatus.wasUnknownWhenChecked = false;
 			newStatus.references.push_back(reference);
 			std::pair<ObjectReferenceStatusMap::iterator, bool> newRefStatusResult =
 			    findDefinition->second.references.emplace(
 			        std::make_pair(referenceNameToken.contents, std::move(newStatus)));
 			refStatus = &newRefStatusResult.first->second;
+
+			environment.referencingDefinitions[referenceNameToken.contents].push_back(
+			    definitionName);
+			ObjectReferenceEdge newEdge = {definitionName, referenceNameToken.contents};
+			environment.referencesToPropagate.push_back(newEdge);
 		}
 		else
 		{
 			findRefIt->second.references.push_back(reference);
 			refStatus = &findRefIt->second;
 		}
+
+		QueueReferenceCheck(environment, findDefinition->second);
 	}
 
 	// Add the reference to the reference pool. This makes it easier to find all places where it is
@@ -184,6 +273,34 @@ const ObjectReferenceStatus* addObjectReference(EvaluatorEnvironment& environmen
 	return refStatus;
 }
 
+void addObjectLocalUse(EvaluatorEnvironment& environment, const EvaluatorContext& context,
+                       const Token& usedNameToken)
+{
+	// Only module-local functions start out not required. Nothing needs to be tracked once the
+	// used definition is required
+	ObjectDefinition* usedDefinition = findObjectDefinition(environment, usedNameToken.contents);
+	if (!usedDefinition || usedDefinition->type != ObjectType_Function ||
+	    usedDefinition->isRequired)
+		return;
+
+	static const Symbol globalDefinitionSymbol(globalDefinitionName);
+	Symbol definitionName =
+	    context.definitionName ? context.definitionName->contents : globalDefinitionSymbol;
+	ObjectDefinition* definition = findObjectDefinition(environment, definitionName);
+	if (!definition || definition == usedDefinition ||
+	    FindInContainer(definition->usedLocalDefinitions, usedNameToken.contents) !=
+	        definition->usedLocalDefinitions.end())
+		return;
+
+	if (log.references)
+		Logf("Adding local use of %s to %s\n", usedNameToken.contents.c_str(),
+		     definitionName.c_str());
+
+	definition->usedLocalDefinitions.push_back(usedNameToken.contents);
+	ObjectReferenceEdge newEdge = {definitionName, usedNameToken.contents};
+	environment.referencesToPropagate.push_back(newEdge);
+}
+
 int getNextFreeBuildId(EvaluatorEnvironment& environment)
 {
 	return ++environment.nextFreeBuildId;
@@ -243,124 +360,282 @@ bool GetCompileTimeVariable(EvaluatorEnvironment& environment, const char* name,
 	return true;
 }
 
+//
+// Profiling
+//
+
+static double profileGetTimeSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch())
+	    .count();
+}
+
+InvocationProfileSample profileInvocationBegin(EvaluatorEnvironment& environment,
+                                               const Symbol& name, ObjectType type)
+{
+	InvocationProfileSample sample = {};
+	if (!environment.enableProfiling)
+		return sample;
+
+	InvocationProfileTable::iterator findIt = environment.invocationProfiles.find(name);
+	if (findIt == environment.invocationProfiles.end())
+	{
+		InvocationProfile newProfile = {};
+		newProfile.type = type;
+		findIt = environment.invocationProfiles.insert(std::make_pair(name, newProfile)).first;
+	}
+
+	sample.profile = &findIt->second;
+	++sample.profile->numActiveInvocations;
+	environment.profileNestedSecondsStack.push_back(0.0);
+	sample.startSeconds = profileGetTimeSeconds();
+	return sample;
+}
+
+void profileInvocationEnd(EvaluatorEnvironment& environment, InvocationProfileSample& sample,
+                          unsigned long numOutputTokens)
+{
+	if (!sample.profile)
+		return;
+
+	double elapsedSeconds = profileGetTimeSeconds() - sample.startSeconds;
+	double nestedSeconds = environment.profileNestedSecondsStack.back();
+	environment.profileNestedSecondsStack.pop_back();
+	if (!environment.profileNestedSecondsStack.empty())
+		environment.profileNestedSecondsStack.back() += elapsedSeconds;
+
+	InvocationProfile& profile = *sample.profile;
+	++profile.numInvocations;
+	profile.exclusiveSeconds += elapsedSeconds - nestedSeconds;
+	profile.numOutputTokens += numOutputTokens;
+	// The outermost invocation's time already includes any recursive invocations
+	if (--profile.numActiveInvocations == 0)
+		profile.inclusiveSeconds += elapsedSeconds;
+
+	sample.profile = nullptr;
+}
+
+bool findCompileTimeFunctionName(EvaluatorEnvironment& environment, void* function,
+                                 Symbol& nameOut)
+{
+	for (const CompileTimeFunctionTable::value_type& functionPair :
+	     environment.compileTimeFunctions)
+	{
+		if (functionPair.second == function)
+		{
+			nameOut = functionPair.first;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Ties are sorted by name, so the order is the same every run
+static bool isMoreExpensiveInvocationProfile(const InvocationProfileTablePair* a,
+                                             const InvocationProfileTablePair* b)
+{
+	if (a->second.exclusiveSeconds != b->second.exclusiveSeconds)
+		return a->second.exclusiveSeconds > b->second.exclusiveSeconds;
+	return strcmp(a->first.c_str(), b->first.c_str()) < 0;
+}
+
+static void getSortedInvocationProfiles(EvaluatorEnvironment& environment,
+                                        std::vector<const InvocationProfileTablePair*>& sortedOut)
+{
+	for (const InvocationProfileTablePair& profilePair : environment.invocationProfiles)
+		sortedOut.push_back(&profilePair);
+	std::sort(sortedOut.begin(), sortedOut.end(), isMoreExpensiveInvocationProfile);
+}
+
+void printInvocationProfiles(EvaluatorEnvironment& environment)
+{
+	std::vector<const InvocationProfileTablePair*> sortedProfiles;
+	getSortedInvocationProfiles(environment, sortedProfiles);
+
+	Logf("%-40s %-22s %11s %13s %13s %13s\n", "Name", "Type", "Invocations", "Exclusive ms",
+	     "Inclusive ms", "Output tokens");
+	for (const InvocationProfileTablePair* profilePair : sortedProfiles)
+	{
+		const InvocationProfile& profile = profilePair->second;
+		Logf("%-40s %-22s %11d %13.3f %13.3f %13lu\n", profilePair->first.c_str(),
+		     objectTypeToString(profile.type), profile.numInvocations,
+		     profile.exclusiveSeconds * 1000.0, profile.inclusiveSeconds * 1000.0,
+		     profile.numOutputTokens);
+	}
+}
+
+bool writeInvocationProfiles(EvaluatorEnvironment& environment, const char* filename)
+{
+	std::vector<const InvocationProfileTablePair*> sortedProfiles;
+	getSortedInvocationProfiles(environment, sortedProfiles);
+
+	FILE* file = fileOpen(filename, "w");
+	if (!file)
+		return false;
+
+	fprintf(file,
+	        "name\ttype\tinvocations\texclusive_seconds\tinclusive_seconds\toutput_tokens\n");
+	for (const InvocationProfileTablePair* profilePair : sortedProfiles)
+	{
+		const InvocationProfile& profile = profilePair->second;
+		fprintf(file, "%s\t%s\t%d\t%.9f\t%.9f\t%lu\n", profilePair->first.c_str(),
+		        objectTypeToString(profile.type), profile.numInvocations,
+		        profile.exclusiveSeconds, profile.inclusiveSeconds, profile.numOutputTokens);
+	}
+	fclose(file);
+	return true;
+}
+
 //
 // Evaluator
 //
 
-// Dispatch to a generator or expand a macro and evaluate its output recursively. If the reference
-// is unknown, add it to a list so EvaluateResolveReferences() can come back and decide what to do
-// with it. Only EvaluateResolveReferences() decides whether to create a C/C++ invocation
-bool HandleInvocation_Recursive(EvaluatorEnvironment& environment, const EvaluatorContext& context,
-                                const std::vector<Token>& tokens, int invocationStartIndex,
-                                GeneratorOutput& output)
+// Expand the macro and evaluate its output. numOutputTokensOut is set to the size of the expansion
+static bool HandleMacroInvocation_Recursive(EvaluatorEnvironment& environment,
+                                            const EvaluatorContext& context,
+                                            const std::vector<Token>& tokens,
+                                            int invocationStartIndex, MacroFunc invokedMacro,
+                                            GeneratorOutput& output,
+                                            unsigned long& numOutputTokensOut)
 {
 	const Token& invocationStart = tokens[invocationStartIndex];
 	const Token& invocationName = tokens[invocationStartIndex + 1];
-	if (!ExpectTokenType("evaluator", invocationName, TokenType_Symbol))
-		return false;
 
-	MacroFunc invokedMacro = findMacro(environment, invocationName.contents.c_str());
-	if (invokedMacro)
+	// We must use a separate vector for each macro because Token lists must be immutable. If
+	// they weren't, pointers to tokens would be invalidated
+	const std::vector<Token>* macroOutputTokens = nullptr;
+	bool macroSucceeded;
 	{
-		// We must use a separate vector for each macro because Token lists must be immutable. If
-		// they weren't, pointers to tokens would be invalidated
-		const std::vector<Token>* macroOutputTokens = nullptr;
-		bool macroSucceeded;
-		{
-			// Do NOT modify token lists after they are created. You can change the token contents
-			std::vector<Token>* macroOutputTokensNoConst_CREATIONONLY = new std::vector<Token>();
+		// Do NOT modify token lists after they are created. You can change the token contents
+		std::vector<Token>* macroOutputTokensNoConst_CREATIONONLY = new std::vector<Token>();
 
-			// Have the macro generate some code for us!
-			macroSucceeded = invokedMacro(environment, context, tokens, invocationStartIndex,
-			                              *macroOutputTokensNoConst_CREATIONONLY);
+		// Have the macro generate some code for us!
+		macroSucceeded = invokedMacro(environment, context, tokens, invocationStartIndex,
+		                              *macroOutputTokensNoConst_CREATIONONLY);
 
-			// Make it const to save any temptation of modifying the list and breaking everything
-			macroOutputTokens = macroOutputTokensNoConst_CREATIONONLY;
-		}
+		// Make it const to save any temptation of modifying the list and breaking everything
+		macroOutputTokens = macroOutputTokensNoConst_CREATIONONLY;
+	}
+	numOutputTokensOut = macroOutputTokens->size();
 
-		// Don't even try to validate the code if the macro wasn't satisfied
-		if (!macroSucceeded)
-		{
-			ErrorAtToken(invocationName, "macro returned failure");
+	// Don't even try to validate the code if the macro wasn't satisfied
+	if (!macroSucceeded)
+	{
+		ErrorAtToken(invocationName, "macro returned failure");
 
-			// Deleting these tokens is only safe at this point because we know we have not
-			// evaluated them. As soon as they are evaluated, they must be kept around
-			delete macroOutputTokens;
-			return false;
-		}
+		// Deleting these tokens is only safe at this point because we know we have not
+		// evaluated them. As soon as they are evaluated, they must be kept around
+		delete macroOutputTokens;
+		return false;
+	}
 
-		// The macro had no output, but we won't let that bother us
-		if (macroOutputTokens->empty())
-		{
-			delete macroOutputTokens;
-			return true;
-		}
+	// The macro had no output, but we won't let that bother us
+	if (macroOutputTokens->empty())
+	{
+		delete macroOutputTokens;
+		return true;
+	}
 
-		// TODO: Pretty print to macro expand file and change output token source to
-		// point there
+	// TODO: Pretty print to macro expand file and change output token source to
+	// point there
 
-		// Macro must generate valid parentheses pairs!
-		bool validateResult = validateParentheses(*macroOutputTokens);
-		if (!validateResult)
-		{
-			NoteAtToken(invocationStart,
-			            "code was generated from macro. See erroneous macro "
-			            "expansion below:");
-			printTokens(*macroOutputTokens);
-			Log("\n");
-			// Deleting these tokens is only safe at this point because we know we have not
-			// evaluated them. As soon as they are evaluated, they must be kept around
-			delete macroOutputTokens;
-			return false;
-		}
+	// Macro must generate valid parentheses pairs!
+	// The environment releases the index when it destroys the expansion
+	bool validateResult = validateAndIndexParentheses(*macroOutputTokens);
+	if (!validateResult)
+	{
+		NoteAtToken(invocationStart,
+		            "code was generated from macro. See erroneous macro "
+		            "expansion below:");
+		printTokens(*macroOutputTokens);
+		Log("\n");
+		// Deleting these tokens is only safe at this point because we know we have not
+		// evaluated them. As soon as they are evaluated, they must be kept around
+		delete macroOutputTokens;
+		return false;
+	}
 
-		// Macro succeeded and output valid tokens. Keep its tokens for later referencing and
-		// destruction. Note that macroOutputTokens cannot be destroyed safely until all pointers to
-		// its Tokens are cleared. This means even if we fail while evaluating the tokens, we will
-		// keep the array around because the environment might still hold references to the tokens.
-		// It's also necessary for error reporting
-		environment.comptimeTokens.push_back(macroOutputTokens);
+	// Macro succeeded and output valid tokens. Keep its tokens for later referencing and
+	// destruction. Note that macroOutputTokens cannot be destroyed safely until all pointers to
+	// its Tokens are cleared. This means even if we fail while evaluating the tokens, we will
+	// keep the array around because the environment might still hold references to the tokens.
+	// It's also necessary for error reporting
+	environment.comptimeTokens.push_back(macroOutputTokens);
 
-		// Let the definition know about the expansion so it is easy to construct an expanded list
-		// of all tokens in the definition
-		if (context.definitionName)
+	// Let the definition know about the expansion so it is easy to construct an expanded list
+	// of all tokens in the definition
+	if (context.definitionName)
+	{
+		ObjectDefinitionMap::iterator findIt =
+		    environment.definitions.find(context.definitionName->contents);
+		if (findIt != environment.definitions.end())
 		{
-			ObjectDefinitionMap::iterator findIt =
-			    environment.definitions.find(context.definitionName->contents);
-			if (findIt != environment.definitions.end())
-			{
-				ObjectDefinition& definition = findIt->second;
-				definition.macroExpansions.push_back({&invocationStart, macroOutputTokens});
-			}
-			else
-				ErrorAtTokenf(invocationStart,
-				              "could not find definition '%s' to associate macro expansion "
-				              "(internal code error)",
-				              context.definitionName->contents.c_str());
+			ObjectDefinition& definition = findIt->second;
+			definition.macroExpansions.push_back({&invocationStart, macroOutputTokens});
 		}
+		else
+			ErrorAtTokenf(invocationStart,
+			              "could not find definition '%s' to associate macro expansion "
+			              "(internal code error)",
+			              context.definitionName->contents.c_str());
+	}
 
-		// Note that macros always inherit the current context, whereas bodies change it
-		int result = EvaluateGenerateAll_Recursive(environment, context, *macroOutputTokens,
-		                                           /*startTokenIndex=*/0, output);
-		if (result != 0)
-		{
-			NoteAtToken(invocationStart,
-			            "code was generated from macro. See macro expansion below:");
-			printTokens(*macroOutputTokens);
-			Log("\n");
-			return false;
-		}
+	// Note that macros always inherit the current context, whereas bodies change it
+	int result = EvaluateGenerateAll_Recursive(environment, context, *macroOutputTokens,
+	                                           /*startTokenIndex=*/0, output);
+	if (result != 0)
+	{
+		NoteAtToken(invocationStart,
+		            "code was generated from macro. See macro expansion below:");
+		printTokens(*macroOutputTokens);
+		Log("\n");
+		return false;
+	}
 
-		return true;
+	return true;
+}
+
+// Dispatch to a generator or expand a macro and evaluate its output recursively. If the reference
+// is unknown, add it to a list so EvaluateResolveReferences() can come back and decide what to do
+// with it. Only EvaluateResolveReferences() decides whether to create a C/C++ invocation
+bool HandleInvocation_Recursive(EvaluatorEnvironment& environment, const EvaluatorContext& context,
+                                const std::vector<Token>& tokens, int invocationStartIndex,
+                                GeneratorOutput& output)
+{
+	const Token& invocationStart = tokens[invocationStartIndex];
+	const Token& invocationName = tokens[invocationStartIndex + 1];
+	if (!ExpectTokenType("evaluator", invocationName, TokenType_Symbol))
+		return false;
+
+	MacroFunc invokedMacro = findMacro(environment, invocationName.contents);
+	if (invokedMacro)
+	{
+		InvocationProfileSample profileSample = profileInvocationBegin(
+		    environment, invocationName.contents, ObjectType_CompileTimeMacro);
+		unsigned long numOutputTokens = 0;
+		bool result = HandleMacroInvocation_Recursive(environment, context, tokens,
+		                                              invocationStartIndex, invokedMacro, output,
+		                                              numOutputTokens);
+		profileInvocationEnd(environment, profileSample, numOutputTokens);
+		return result;
 	}
 
-	GeneratorFunc invokedGenerator = findGenerator(environment, invocationName.contents.c_str());
+	GeneratorFunc invokedGenerator = findGenerator(environment, invocationName.contents);
 	if (invokedGenerator)
 	{
-		environment.lastGeneratorReferences[invocationName.contents.c_str()] =
+		environment.lastGeneratorReferences[invocationName.contents] =
 		    &tokens[invocationStartIndex];
 
-		return invokedGenerator(environment, context, tokens, invocationStartIndex, output);
+		if (!environment.enableProfiling)
+			return invokedGenerator(environment, context, tokens, invocationStartIndex, output);
+
+		InvocationProfileSample profileSample = profileInvocationBegin(
+		    environment, invocationName.contents, ObjectType_CompileTimeGenerator);
+		size_t numOutputsBefore = output.source.size() + output.header.size();
+		bool result = invokedGenerator(environment, context, tokens, invocationStartIndex, output);
+		profileInvocationEnd(environment, profileSample,
+		                     output.source.size() + output.header.size() - numOutputsBefore);
+		return result;
 	}
 
 	// Check for known Cakelisp functions
@@ -368,7 +643,7 @@ bool HandleInvocation_Recursive(EvaluatorEnvironment& environment, const Evaluat
 	if (findIt != environment.definitions.end() &&
 	    (!isCompileTimeObject(findIt->second.type) ||
 	     (findIt->second.type == ObjectType_CompileTimeFunction &&
-	      findCompileTimeFunction(environment, invocationName.contents.c_str()))))
+	      findCompileTimeFunction(environment, invocationName.contents))))
 	{
 		return FunctionInvocationGenerator(environment, context, tokens, invocationStartIndex,
 		                                   output);
@@ -385,7 +660,7 @@ bool HandleInvocation_Recursive(EvaluatorEnvironment& environment, const Evaluat
 		newReference.startIndex = invocationStartIndex;
 		newReference.context = context;
 		// Make room for whatever gets output once this reference is resolved
-		newReference.spliceOutput = new GeneratorOutput;
+		newReference.spliceOutput = newGeneratorOutput(environment);
 
 		// We push in a StringOutMod_Splice as a sentinel that the splice list needs to be
 		// checked. Otherwise, it will be a no-op to Writer. It's useful to have this sentinel
@@ -484,6 +759,8 @@ int EvaluateGenerate_Recursive(EvaluatorEnvironment& environment, const Evaluato
 						// Potential lisp name. Convert
 						addStringOutput(output.source, token.contents,
 						                StringOutMod_ConvertVariableName, &token);
+						// e.g. taking the address of a module-local function
+						addObjectLocalUse(environment, context, token);
 					}
 					break;
 				}
@@ -514,10 +791,11 @@ int EvaluateGenerateAll_Recursive(EvaluatorEnvironment& environment,
 	// Note that in most cases, we will continue evaluation in order to turn up more errors
 	int numErrors = 0;
 
-	bool isDelimiterUsed = !context.delimiterTemplate.output.empty() ||
-	                       context.delimiterTemplate.modifiers != StringOutMod_None;
-	bool isDelimiterSyntactic = !context.delimiterTemplate.output.empty() ||
-	                            context.delimiterTemplate.modifiers != StringOutMod_NewlineAfter;
+	bool hasDelimiterText = *stringOutputGetText(context.delimiterTemplate, /*lengthOut=*/nullptr);
+	bool isDelimiterUsed =
+	    hasDelimiterText || context.delimiterTemplate.modifiers != StringOutMod_None;
+	bool isDelimiterSyntactic =
+	    hasDelimiterText || context.delimiterTemplate.modifiers != StringOutMod_NewlineAfter;
 
 	// Used to detect when something was actually output during evaluation
 	int lastOutputTotalSize = output.source.size() + output.header.size();
@@ -567,7 +845,10 @@ bool ReplaceAndEvaluateDefinition(EvaluatorEnvironment& environment,
                                   const char* definitionToReplaceName,
                                   const std::vector<Token>& newDefinitionTokens)
 {
-	ObjectDefinitionMap::iterator findIt = environment.definitions.find(definitionToReplaceName);
+	Symbol definitionToReplaceSymbol;
+	ObjectDefinitionMap::iterator findIt = environment.definitions.end();
+	if (symbolFind(definitionToReplaceName, &definitionToReplaceSymbol))
+		findIt = environment.definitions.find(definitionToReplaceSymbol);
 	if (findIt == environment.definitions.end())
 	{
 		Logf("error: ReplaceAndEvaluateDefinition() could not find definition '%s'\n",
@@ -587,8 +868,18 @@ bool ReplaceAndEvaluateDefinition(EvaluatorEnvironment& environment,
 
 	// This output is still referred to by the module (etc.) output's splice. When a replacement
 	// definition is added, it will actually add a splice to the old definiton's output and create
-	// its own output. Have the environment hold on to it for later destruction
-	environment.orphanedOutputs.push_back(definitionOutput);
+	// its own output. The environment's output pool keeps the orphan alive until destruction
+
+	// References to the old definition need to find the replacement instead
+	ObjectDefinition* replacedDefinition = &findIt->second;
+	for (ObjectDefinitionPair& definitionPair : environment.definitions)
+	{
+		for (ObjectReferenceStatusPair& reference : definitionPair.second.references)
+		{
+			if (reference.second.definition == replacedDefinition)
+				reference.second.definition = nullptr;
+		}
+	}
 
 	// This makes me nervous because the user could have a reference to this when calling this
 	// function. I can't think of a safer way to get rid of the reference without deleting it
@@ -617,69 +908,130 @@ bool ReplaceAndEvaluateDefinition(EvaluatorEnvironment& environment,
 	return result;
 }
 
-// Determine what needs to be built, iteratively
-// TODO This can be made faster. I did the most naive version first, for now
+// Mark the definition required, and queue it so its references will be required too. Returns
+// whether it wasn't already required
+static bool InfectRequired(EvaluatorEnvironment& environment, ObjectDefinition& definition,
+                           const Symbol& requiredBy, std::vector<ObjectDefinition*>& worklist)
+{
+	if (definition.isRequired)
+		return false;
+
+	if (log.dependencyPropagation)
+		Logf("\t Infecting %s with required due to %s\n", definition.name.c_str(),
+		     requiredBy.c_str());
+
+	definition.isRequired = true;
+	worklist.push_back(&definition);
+	QueueReferenceCheck(environment, definition);
+	return true;
+}
+
+// Determine what needs to be built. Rather than scanning every definition until nothing changes,
+// only the definitions and references added since the last call are examined, and only what they
+// newly make required is visited
 static void PropagateRequiredToReferences(EvaluatorEnvironment& environment)
 {
-	// Figure out what is required
-	// This needs to loop so long as it doesn't recurse to references
-	int numRequiresStatusChanged = 0;
-	do
+	// Definitions which became required, but whose references haven't been made required yet.
+	// Pointers are fine because definitions can't be added or removed while propagating
+	std::vector<ObjectDefinition*> worklist;
+
+	for (const Symbol& definitionName : environment.definitionsToPropagate)
 	{
-		numRequiresStatusChanged = 0;
-		for (ObjectDefinitionPair& definitionPair : environment.definitions)
+		ObjectDefinition* definition = findObjectDefinition(environment, definitionName);
+		// It could have been replaced since being added
+		if (!definition)
+			continue;
+
+		if (log.dependencyPropagation)
 		{
-			ObjectDefinition& definition = definitionPair.second;
+			const char* status = definition->isRequired ? "(required)" : "(not required)";
+			Logf("Define %s %s\n", definition->name.c_str(), status);
+		}
+
+		if (definition->isRequired)
+		{
+			worklist.push_back(definition);
+			continue;
+		}
 
-			// Automatically require a compile-time function if the environment needs it (typically
-			// because some other function was called that added the requirement before the
-			// definition was available)
-			if (definition.type == ObjectType_CompileTimeFunction && !definition.isRequired)
+		// Required definitions may have referred to it before it was defined
+		ReferencingDefinitionsTable::iterator findReferencers =
+		    environment.referencingDefinitions.find(definitionName);
+		if (findReferencers == environment.referencingDefinitions.end())
+			continue;
+		for (const Symbol& referencerName : findReferencers->second)
+		{
+			ObjectDefinition* referencer = findObjectDefinition(environment, referencerName);
+			if (referencer && referencer->isRequired)
 			{
-				RequiredCompileTimeFunctionReasonsTableIterator findIt =
-				    environment.requiredCompileTimeFunctions.find(definition.name.c_str());
+				InfectRequired(environment, *definition, referencerName, worklist);
+				break;
+			}
+		}
+	}
+	environment.definitionsToPropagate.clear();
 
-				if (findIt != environment.requiredCompileTimeFunctions.end())
-				{
-					if (log.dependencyPropagation)
-						Logf("Define %s promoted to required because %s\n",
-						       definition.name.c_str(), findIt->second);
+	for (const ObjectReferenceEdge& edge : environment.referencesToPropagate)
+	{
+		ObjectDefinition* definition = findObjectDefinition(environment, edge.definitionName);
+		if (!definition || !definition->isRequired)
+			continue;
 
-					definition.isRequired = true;
-					definition.environmentRequired = true;
-				}
-			}
+		ObjectDefinition* referencedDefinition =
+		    findObjectDefinition(environment, edge.referencedName);
+		if (referencedDefinition)
+			InfectRequired(environment, *referencedDefinition, edge.definitionName, worklist);
+	}
+	environment.referencesToPropagate.clear();
 
-			if (log.dependencyPropagation)
-			{
-				const char* status = definition.isRequired ? "(required)" : "(not required)";
-				Logf("Define %s %s\n", definition.name.c_str(), status);
-			}
+	// Automatically require a compile-time function if the environment needs it (typically because
+	// some other function was called that added the requirement before the definition was
+	// available)
+	for (RequiredCompileTimeFunctionReasonsTable::value_type& requiredFunction :
+	     environment.requiredCompileTimeFunctions)
+	{
+		ObjectDefinition* definition =
+		    findObjectDefinition(environment, requiredFunction.first.c_str());
+		if (!definition || definition->type != ObjectType_CompileTimeFunction ||
+		    definition->isRequired)
+			continue;
 
-			for (ObjectReferenceStatusPair& reference : definition.references)
-			{
-				ObjectReferenceStatus& referenceStatus = reference.second;
+		if (log.dependencyPropagation)
+			Logf("Define %s promoted to required because %s\n", definition->name.c_str(),
+			     requiredFunction.second);
 
-				if (log.dependencyPropagation)
-					Logf("\tRefers to %s\n", referenceStatus.name->contents.c_str());
+		definition->isRequired = true;
+		definition->environmentRequired = true;
+		worklist.push_back(definition);
+		QueueReferenceCheck(environment, *definition);
+	}
 
-				if (definition.isRequired)
-				{
-					ObjectDefinitionMap::iterator findIt =
-					    environment.definitions.find(referenceStatus.name->contents);
-					if (findIt != environment.definitions.end() && !findIt->second.isRequired)
-					{
-						if (log.dependencyPropagation)
-							Logf("\t Infecting %s with required due to %s\n",
-							       referenceStatus.name->contents.c_str(), definition.name.c_str());
+	while (!worklist.empty())
+	{
+		ObjectDefinition* definition = worklist.back();
+		worklist.pop_back();
 
-						++numRequiresStatusChanged;
-						findIt->second.isRequired = true;
-					}
-				}
-			}
+		for (ObjectReferenceStatusPair& reference : definition->references)
+		{
+			ObjectReferenceStatus& referenceStatus = reference.second;
+
+			if (log.dependencyPropagation)
+				Logf("\t%s refers to %s\n", definition->name.c_str(),
+				     referenceStatus.name->contents.c_str());
+
+			ObjectDefinition* referencedDefinition =
+			    findReferencedDefinition(environment, referenceStatus);
+			if (referencedDefinition)
+				InfectRequired(environment, *referencedDefinition, definition->name, worklist);
+		}
+
+		for (const Symbol& usedName : definition->usedLocalDefinitions)
+		{
+			ObjectDefinition* usedDefinition = findObjectDefinition(environment, usedName);
+			if (usedDefinition)
+				InfectRequired(environment, *usedDefinition, definition->name, worklist);
 		}
-	} while (numRequiresStatusChanged);
+	}
 }
 
 static void OnCompileProcessOutput(const char* output)
@@ -694,435 +1046,1313 @@ enum BuildStage
 	BuildStage_Linking,
 	BuildStage_Loading,
 	BuildStage_ResolvingReferences,
-	BuildStage_Finished
+	BuildStage_Finished,
+	BuildStage_Failed
 };
 
-// Note: environment.definitions can be resized/rehashed during evaluation, which invalidates
-// iterators. For now, I will rely on the fact that std::unordered_map does not invalidate
-// references on resize. This will need to change if the data structure changes
+// Each object moves through the stages on its own, as the processes building it finish. Objects are
+// stored in a std::deque, so objects may be added while others are building without invalidating
+// the status pointers handed to runProcess()
 struct BuildObject
 {
 	int buildId = -1;
 	int status = -1;
 	BuildStage stage = BuildStage_None;
 	bool hasAnyRefs = false;
+	// Objects built with guesses are more likely to fail, so they are kept out of batches
+	bool hasGuessedRefs = false;
 	std::string artifactsName;
+	std::string sourceOutputName;
+	// Only used if the source is piped to the compiler instead of written to sourceOutputName
+	std::string sourceText;
 	std::string dynamicLibraryPath;
 	std::string buildObjectName;
 	ObjectDefinition* definition = nullptr;
+	// Found once loaded, but only added to the environment when it is this object's turn to
+	// resolve references
+	void* compileTimeFunction = nullptr;
 };
 
-int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
-                                     std::vector<BuildObject>& definitionsToBuild,
-                                     int& numErrorsOut)
+typedef std::deque<BuildObject> BuildObjectList;
+
+static void BuildGetCakelispHeadersInclude(EvaluatorEnvironment& environment, char* bufferOut,
+                                           int bufferSize)
 {
-	int numReferencesResolved = 0;
+	const char* cakelispSrcDir =
+	    environment.cakelispSrcDir.empty() ? "src/" : environment.cakelispSrcDir.c_str();
+	SafeSnprinf(bufferOut, bufferSize, "-I%s", cakelispSrcDir);
+}
 
-	// Spin up as many compile processes as necessary
-	// TODO: Combine sure-thing builds into batches (ones where we know all references)
-	// TODO: Instead of creating files, pipe straight to compiler?
-	// TODO: Make pipeline able to start e.g. linker while other objects are still compiling
-	// NOTE: definitionsToBuild must not be resized from when runProcess() is called until
-	// waitForAllProcessesClosed(), else the status pointer could be invalidated
-	int currentNumProcessesSpawned = 0;
-	for (BuildObject& buildObject : definitionsToBuild)
+// sourceText is used instead of sourceFilename if environment.pipeCompileTimeSource
+static bool BuildSpawnCompile(EvaluatorEnvironment& environment, const char* sourceFilename,
+                              const std::string& sourceText, const char* objectFilename,
+                              int* statusOut)
+{
+	char headerInclude[MAX_PATH_LENGTH] = {0};
+	BuildGetCakelispHeadersInclude(environment, headerInclude, sizeof(headerInclude));
+
+	ProcessCommandInput compileTimeInputs[] = {
+	    {ProcessCommandArgumentType_SourceInput, {sourceFilename}},
+	    {ProcessCommandArgumentType_ObjectOutput, {objectFilename}},
+	    {ProcessCommandArgumentType_CakelispHeadersInclude, {headerInclude}}};
+	char cacheInclude[MAX_PATH_LENGTH] = {0};
+	if (environment.pipeCompileTimeSource)
 	{
-		ObjectDefinition* definition = buildObject.definition;
-
-		if (log.buildProcess)
-			Logf("Build %s\n", definition->name.c_str());
-
-		if (!definition->output)
-		{
-			ErrorAtToken(*buildObject.definition->definitionInvocation,
-			             "missing compile-time output. Internal code error?");
-			continue;
-		}
+		// Read the source from stdin. The language can't be inferred without a file extension.
+		// Generated code includes other compile-time headers relative to the cache, which would
+		// otherwise be found relative to the source file
+		compileTimeInputs[0].value = {"-x", "c++", "-"};
+		PrintfBuffer(cacheInclude, "-I%s", cakelispWorkingDir);
+		compileTimeInputs[2].value.push_back(cacheInclude);
+	}
+	// The compiler will use the precompiled version of the prelude instead of parsing it, then
+	// the object's own includes of the same headers do nothing
+	if (!environment.compileTimePreludeHeader.empty())
+	{
+		compileTimeInputs[2].value.push_back("-include");
+		compileTimeInputs[2].value.push_back(environment.compileTimePreludeHeader.c_str());
+	}
+	const char** buildArguments = MakeProcessArgumentsFromCommand(
+	    environment.compileTimeBuildCommand, compileTimeInputs, ArraySize(compileTimeInputs));
+	if (!buildArguments)
+	{
+		// TODO: Abort building if cannot invoke compiler
+		return false;
+	}
 
-		char convertedNameBuffer[MAX_NAME_LENGTH] = {0};
-		lispNameStyleToCNameStyle(NameStyleMode_Underscores, definition->name.c_str(),
-		                          convertedNameBuffer, sizeof(convertedNameBuffer),
-		                          *definition->definitionInvocation);
-		char artifactsName[MAX_PATH_LENGTH] = {0};
-		// Various stages will append the appropriate file extension
-		PrintfBuffer(artifactsName, "comptime_%s", convertedNameBuffer);
-		buildObject.artifactsName = artifactsName;
-		char fileOutputName[MAX_PATH_LENGTH] = {0};
-		// Writer will append the appropriate file extensions
-		PrintfBuffer(fileOutputName, "%s/%s", cakelispWorkingDir,
-		             buildObject.artifactsName.c_str());
-
-		// Output definition to a file our compiler will be happy with
-		// TODO: Make these come from the top
-		NameStyleSettings nameSettings;
-		WriterFormatSettings formatSettings;
-		WriterOutputSettings outputSettings = {};
-
-		GeneratorOutput header;
-		GeneratorOutput footer;
-		GeneratorOutput autoIncludes;
-		makeCompileTimeHeaderFooter(header, footer, &autoIncludes,
-		                            definition->definitionInvocation);
-		outputSettings.heading = &header;
-		outputSettings.footer = &footer;
-
-		// Automatically include referenced compile-time function headers
-		bool foundHeaders = true;
-		for (ObjectReferenceStatusPair& reference : definition->references)
-		{
-			ObjectReferenceStatus& referenceStatus = reference.second;
+	RunProcessArguments compileArguments = {};
+	compileArguments.fileToExecute = environment.compileTimeBuildCommand.fileToExecute.c_str();
+	compileArguments.arguments = buildArguments;
+	if (environment.pipeCompileTimeSource)
+		compileArguments.standardInput = sourceText.c_str();
+	if (runProcess(compileArguments, statusOut) != 0)
+	{
+		// TODO: Abort building if cannot invoke compiler?
+		// free(buildArguments);
+		// return 0;
+	}
 
-			ObjectDefinitionMap::iterator findIt =
-			    environment.definitions.find(referenceStatus.name->contents);
-			// Ignore unknown references, because we only care about already-loaded compile-time
-			// functions in this case
-			if (findIt == environment.definitions.end())
-				continue;
+	free(buildArguments);
+	return true;
+}
 
-			ObjectDefinition* requiredDefinition = &findIt->second;
-			// It's not really possible to invoke macros or generators because the evaluator will
-			// expand them on the spot (while evaluating this definition's body)
-			if (requiredDefinition->type != ObjectType_CompileTimeFunction)
-				continue;
+static bool BuildSpawnLink(EvaluatorEnvironment& environment, const char* objectFilename,
+                           const char* dynamicLibraryFilename, int* statusOut)
+{
+	ProcessCommandInput linkTimeInputs[] = {
+	    {ProcessCommandArgumentType_DynamicLibraryOutput, {dynamicLibraryFilename}},
+	    {ProcessCommandArgumentType_ObjectInput, {objectFilename}}};
+	const char** linkArgumentList = MakeProcessArgumentsFromCommand(
+	    environment.compileTimeLinkCommand, linkTimeInputs, ArraySize(linkTimeInputs));
+	if (!linkArgumentList)
+	{
+		// TODO: Abort building if cannot invoke compiler
+		return false;
+	}
+	RunProcessArguments linkArguments = {};
+	linkArguments.fileToExecute = environment.compileTimeLinkCommand.fileToExecute.c_str();
+	linkArguments.arguments = linkArgumentList;
+	if (runProcess(linkArguments, statusOut) != 0)
+	{
+		// TODO: Abort if linker failed?
+		// free(linkArgumentList);
+	}
+	free(linkArgumentList);
+	return true;
+}
 
-			if (requiredDefinition->compileTimeHeaderName.empty())
-			{
-				ErrorAtToken(*referenceStatus.name,
-				             "could not find generated header for referenced compile-time "
-				             "function. Internal code error?\n");
-				foundHeaders = false;
-				continue;
-			}
+// A single translation unit which #includes the sources of several compile-time objects, so they
+// can be compiled and linked with one invocation each
+struct BuildBatch
+{
+	int status = -1;
+	std::string sourceName;
+	// Only used if the source is piped to the compiler instead of written to sourceName
+	std::string sourceText;
+	std::string buildObjectName;
+	std::string dynamicLibraryPath;
+	std::vector<BuildObject*> buildObjects;
+	BuildStage stage = BuildStage_None;
+};
 
-			addStringOutput(autoIncludes.source, "#include", StringOutMod_SpaceAfter,
-			                referenceStatus.name);
-			addStringOutput(autoIncludes.source, requiredDefinition->compileTimeHeaderName.c_str(),
-			                StringOutMod_SurroundWithQuotes, referenceStatus.name);
-			addLangTokenOutput(autoIncludes.source, StringOutMod_NewlineAfter,
-			                   referenceStatus.name);
-		}
-		if (!foundHeaders)
-			continue;
+// Returns false if the batch could not be written, in which case its objects should be built
+// individually. Sets isCachedOut if the library from a previous identical batch is up to date
+static bool BuildWriteBatch(EvaluatorEnvironment& environment, BuildBatch& batch,
+                            bool& isCachedOut)
+{
+	isCachedOut = false;
 
-		outputSettings.sourceCakelispFilename = fileOutputName;
+	// Name the batch after its contents, so the same set of definitions will hit the cache
+	uint32_t batchCrc = 0;
+	if (environment.pipeCompileTimeSource)
+	{
+		// There are no files to include, so concatenate the sources instead
+		for (BuildObject* buildObject : batch.buildObjects)
 		{
-			char writerSourceOutputName[MAX_PATH_LENGTH] = {0};
-			PrintfBuffer(writerSourceOutputName, "%s.cpp", fileOutputName);
-			char writerHeaderOutputName[MAX_PATH_LENGTH] = {0};
-			PrintfBuffer(writerHeaderOutputName, "%s.hpp", fileOutputName);
-			outputSettings.sourceOutputName = writerSourceOutputName;
-			outputSettings.headerOutputName = writerHeaderOutputName;
-
-			// Facilitates this function being used later by other compile-time functions
-			char localHeaderOutputName[MAX_PATH_LENGTH] = {0};
-			PrintfBuffer(localHeaderOutputName, "%s.hpp", artifactsName);
-			definition->compileTimeHeaderName = localHeaderOutputName;
-		}
-		// Use the separate output prepared specifically for this compile-time object
-		if (!writeGeneratorOutput(*definition->output, nameSettings, formatSettings,
-		                          outputSettings))
-		{
-			ErrorAtToken(*buildObject.definition->definitionInvocation,
-			             "Failed to write to compile-time source file");
-			continue;
+			batch.sourceText.append(buildObject->sourceText);
+			// Each source ends with the closing brace of its extern "C", which cannot share a line
+			// with the next source's #includes
+			batch.sourceText.append("\n");
 		}
+		crc32(batch.sourceText.data(), batch.sourceText.size(), &batchCrc);
+	}
+	else
+	{
+		for (BuildObject* buildObject : batch.buildObjects)
+			crc32(buildObject->artifactsName.c_str(), buildObject->artifactsName.size() + 1,
+			      &batchCrc);
+	}
+
+	char batchFilename[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(batchFilename, "%s/comptime_batch_%08x", cakelispWorkingDir,
+	             (unsigned int)batchCrc);
+	char sourceOutputName[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(sourceOutputName, "%s.cpp", batchFilename);
+	batch.sourceName = sourceOutputName;
+	char buildObjectName[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(buildObjectName, "%s.o", batchFilename);
+	batch.buildObjectName = buildObjectName;
+	char dynamicLibraryOut[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(dynamicLibraryOut, "%s/libcomptime_batch_%08x.so", cakelispWorkingDir,
+	             (unsigned int)batchCrc);
+	batch.dynamicLibraryPath = dynamicLibraryOut;
+
+	// The name covers the entire source, so the library is up to date if it exists
+	if (environment.pipeCompileTimeSource)
+	{
+		isCachedOut = environment.useCachedFiles && fileExists(dynamicLibraryOut);
+		return true;
+	}
 
-		buildObject.stage = BuildStage_Compiling;
+	std::string batchSource = "// Compile-time objects batched into one translation unit\n";
+	for (BuildObject* buildObject : batch.buildObjects)
+	{
+		batchSource.append("#include \"");
+		batchSource.append(buildObject->artifactsName);
+		batchSource.append(".cpp\"\n");
+	}
 
-		// The evaluator is written in C++, so all generators and macros need to support the C++
-		// features used (e.g. their signatures have std::vector<>)
-		char sourceOutputName[MAX_PATH_LENGTH] = {0};
-		PrintfBuffer(sourceOutputName, "%s/%s.cpp", cakelispWorkingDir,
-		             buildObject.artifactsName.c_str());
+	// Leave the batch source untouched if it is the same, so its library can be reused
+	if (!writeIfContentsChanged(batchSource.data(), batchSource.size(), sourceOutputName))
+		return false;
 
-		char buildObjectName[MAX_PATH_LENGTH] = {0};
-		PrintfBuffer(buildObjectName, "%s/%s.o", cakelispWorkingDir,
-		             buildObject.artifactsName.c_str());
-		buildObject.buildObjectName = buildObjectName;
+	isCachedOut =
+	    canUseCachedFile(environment, sourceOutputName, batch.dynamicLibraryPath.c_str());
+	for (BuildObject* buildObject : batch.buildObjects)
+	{
+		if (!isCachedOut)
+			break;
+		isCachedOut = canUseCachedFile(environment, buildObject->sourceOutputName.c_str(),
+		                               batch.dynamicLibraryPath.c_str());
+	}
 
-		char dynamicLibraryOut[MAX_PATH_LENGTH] = {0};
-		PrintfBuffer(dynamicLibraryOut, "%s/lib%s.so", cakelispWorkingDir,
-		             buildObject.artifactsName.c_str());
-		buildObject.dynamicLibraryPath = dynamicLibraryOut;
+	return true;
+}
+
+// Writes the object's source and decides where its artifacts go. Returns false if it cannot be
+// built. Sets isCachedOut if the library from a previous build is up to date
+static bool BuildWriteObject(EvaluatorEnvironment& environment, BuildObject& buildObject,
+                             bool& isCachedOut)
+{
+	isCachedOut = false;
+
+	ObjectDefinition* definition = buildObject.definition;
+
+	if (log.buildProcess)
+		Logf("Build %s\n", definition->name.c_str());
+
+	if (!definition->output)
+	{
+		ErrorAtToken(*buildObject.definition->definitionInvocation,
+		             "missing compile-time output. Internal code error?");
+		return false;
+	}
+
+	Symbol convertedName =
+	    lispNameStyleToCNameStyleCached(environment.nameConversionCache, NameStyleMode_Underscores,
+	                                    definition->name, *definition->definitionInvocation);
+	char artifactsName[MAX_PATH_LENGTH] = {0};
+	// Various stages will append the appropriate file extension
+	PrintfBuffer(artifactsName, "comptime_%s", convertedName.c_str());
+	buildObject.artifactsName = artifactsName;
+	char fileOutputName[MAX_PATH_LENGTH] = {0};
+	// Writer will append the appropriate file extensions
+	PrintfBuffer(fileOutputName, "%s/%s", cakelispWorkingDir, buildObject.artifactsName.c_str());
+
+	// Output definition to a file our compiler will be happy with
+	// TODO: Make these come from the top
+	NameStyleSettings nameSettings;
+	WriterFormatSettings formatSettings;
+	WriterOutputSettings outputSettings = {};
+
+	GeneratorOutput header;
+	GeneratorOutput footer;
+	GeneratorOutput autoIncludes;
+	makeCompileTimeHeaderFooter(header, footer, &autoIncludes, definition->definitionInvocation);
+	outputSettings.heading = &header;
+	outputSettings.footer = &footer;
+	outputSettings.nameConversionCache = &environment.nameConversionCache;
+
+	// Automatically include referenced compile-time function headers
+	bool foundHeaders = true;
+	for (ObjectReferenceStatusPair& reference : definition->references)
+	{
+		ObjectReferenceStatus& referenceStatus = reference.second;
+
+		ObjectDefinition* requiredDefinition =
+		    findReferencedDefinition(environment, referenceStatus);
+		// Ignore unknown references, because we only care about already-loaded compile-time
+		// functions in this case
+		if (!requiredDefinition)
+			continue;
+
+		// It's not really possible to invoke macros or generators because the evaluator will
+		// expand them on the spot (while evaluating this definition's body)
+		if (requiredDefinition->type != ObjectType_CompileTimeFunction)
+			continue;
 
-		if (canUseCachedFile(environment, sourceOutputName, buildObject.dynamicLibraryPath.c_str()))
+		if (requiredDefinition->compileTimeHeaderName.empty())
 		{
-			if (log.buildProcess)
-				Logf("Skipping compiling %s (using cached library)\n", sourceOutputName);
-			// Skip straight to linking, which immediately becomes loading
-			buildObject.stage = BuildStage_Linking;
-			buildObject.status = 0;
+			ErrorAtToken(*referenceStatus.name,
+			             "could not find generated header for referenced compile-time "
+			             "function. Internal code error?\n");
+			foundHeaders = false;
 			continue;
 		}
 
-		char headerInclude[MAX_PATH_LENGTH] = {0};
-		if (environment.cakelispSrcDir.empty())
+		addStringOutput(autoIncludes.source, "#include", StringOutMod_SpaceAfter,
+		                referenceStatus.name);
+		addStringOutput(autoIncludes.source, requiredDefinition->compileTimeHeaderName.c_str(),
+		                StringOutMod_SurroundWithQuotes, referenceStatus.name);
+		addLangTokenOutput(autoIncludes.source, StringOutMod_NewlineAfter, referenceStatus.name);
+	}
+	if (!foundHeaders)
+		return false;
+
+	outputSettings.sourceCakelispFilename = fileOutputName;
+	{
+		char writerSourceOutputName[MAX_PATH_LENGTH] = {0};
+		PrintfBuffer(writerSourceOutputName, "%s.cpp", fileOutputName);
+		char writerHeaderOutputName[MAX_PATH_LENGTH] = {0};
+		PrintfBuffer(writerHeaderOutputName, "%s.hpp", fileOutputName);
+		outputSettings.sourceOutputName = writerSourceOutputName;
+		outputSettings.headerOutputName = writerHeaderOutputName;
+		// The header is still written, because other compile-time objects may include it
+		if (environment.pipeCompileTimeSource)
+			outputSettings.sourceOutputBuffer = &buildObject.sourceText;
+
+		// Facilitates this function being used later by other compile-time functions
+		char localHeaderOutputName[MAX_PATH_LENGTH] = {0};
+		PrintfBuffer(localHeaderOutputName, "%s.hpp", artifactsName);
+		definition->compileTimeHeaderName = localHeaderOutputName;
+	}
+	// Use the separate output prepared specifically for this compile-time object
+	if (!writeGeneratorOutput(*definition->output, nameSettings, formatSettings, outputSettings))
+	{
+		ErrorAtToken(*buildObject.definition->definitionInvocation,
+		             "Failed to write to compile-time source file");
+		return false;
+	}
+
+	// The evaluator is written in C++, so all generators and macros need to support the C++
+	// features used (e.g. their signatures have std::vector<>)
+	char sourceOutputName[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(sourceOutputName, "%s/%s.cpp", cakelispWorkingDir,
+	             buildObject.artifactsName.c_str());
+
+	buildObject.sourceOutputName = sourceOutputName;
+
+	// Without a source file to compare modification times against, the library is named after
+	// the source's contents instead. It is up to date if it exists
+	char builtArtifactsName[MAX_PATH_LENGTH] = {0};
+	if (environment.pipeCompileTimeSource)
+	{
+		uint32_t sourceCrc = 0;
+		crc32(buildObject.sourceText.data(), buildObject.sourceText.size(), &sourceCrc);
+		PrintfBuffer(builtArtifactsName, "%s_%08x", buildObject.artifactsName.c_str(),
+		             (unsigned int)sourceCrc);
+	}
+	else
+		PrintfBuffer(builtArtifactsName, "%s", buildObject.artifactsName.c_str());
+
+	char buildObjectName[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(buildObjectName, "%s/%s.o", cakelispWorkingDir, builtArtifactsName);
+	buildObject.buildObjectName = buildObjectName;
+
+	char dynamicLibraryOut[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(dynamicLibraryOut, "%s/lib%s.so", cakelispWorkingDir, builtArtifactsName);
+	buildObject.dynamicLibraryPath = dynamicLibraryOut;
+
+	isCachedOut = environment.pipeCompileTimeSource ?
+	                  environment.useCachedFiles && fileExists(dynamicLibraryOut) :
+	                  canUseCachedFile(environment, sourceOutputName, dynamicLibraryOut);
+	if (isCachedOut && log.buildProcess)
+		Logf("Skipping compiling %s (using cached library)\n", sourceOutputName);
+
+	return true;
+}
+
+// Loads the built library and finds the object's function in it. The function isn't added to the
+// environment yet, because objects must do that (and resolve references) in a consistent order
+static void BuildLoadObject(EvaluatorEnvironment& environment, BuildObject& buildObject)
+{
+	if (buildObject.status != 0)
+	{
+		ErrorAtToken(*buildObject.definition->definitionInvocation, "Failed to link definition");
+		buildObject.stage = BuildStage_Failed;
+		return;
+	}
+
+	buildObject.stage = BuildStage_Loading;
+
+	if (log.buildProcess)
+		Logf("Linked %s successfully\n", buildObject.definition->name.c_str());
+
+	DynamicLibHandle builtLib = loadDynamicLibrary(buildObject.dynamicLibraryPath.c_str());
+	if (!builtLib)
+	{
+		ErrorAtToken(*buildObject.definition->definitionInvocation,
+		             "Failed to load compile-time library");
+		buildObject.stage = BuildStage_Failed;
+		return;
+	}
+
+	// We need to do name conversion to be compatible with C naming
+	// TODO: Make these come from the top
+	NameStyleSettings nameSettings;
+	Symbol symbolName = lispNameStyleToCNameStyleCached(
+	    environment.nameConversionCache, nameSettings.functionNameMode,
+	    buildObject.definition->name, *buildObject.definition->definitionInvocation);
+	buildObject.compileTimeFunction = getSymbolFromDynamicLibrary(builtLib, symbolName.c_str());
+	if (!buildObject.compileTimeFunction)
+	{
+		ErrorAtToken(*buildObject.definition->definitionInvocation,
+		             "Failed to find symbol in loaded library");
+		buildObject.stage = BuildStage_Failed;
+		return;
+	}
+}
+
+// Adds the loaded function to the environment, then evaluates the references which were waiting on
+// it. Returns false if the references could not be resolved
+static bool BuildResolveObject(EvaluatorEnvironment& environment, BuildObject& buildObject,
+                               int& numReferencesResolved, int& numErrorsOut)
+{
+	void* compileTimeFunction = buildObject.compileTimeFunction;
+	// Add to environment
+	switch (buildObject.definition->type)
+	{
+		case ObjectType_CompileTimeMacro:
+			if (findMacro(environment, buildObject.definition->name))
+				NoteAtToken(*buildObject.definition->definitionInvocation, "redefined macro");
+			environment.macros[buildObject.definition->name] = (MacroFunc)compileTimeFunction;
+			break;
+		case ObjectType_CompileTimeGenerator:
+			if (findGenerator(environment, buildObject.definition->name))
+				NoteAtToken(*buildObject.definition->definitionInvocation,
+				            "redefined generator");
+			environment.generators[buildObject.definition->name] =
+			    (GeneratorFunc)compileTimeFunction;
+			break;
+		case ObjectType_CompileTimeFunction:
+			if (findCompileTimeFunction(environment, buildObject.definition->name))
+				NoteAtToken(*buildObject.definition->definitionInvocation,
+				            "redefined function");
+			environment.compileTimeFunctions[buildObject.definition->name] =
+			    (void*)compileTimeFunction;
+			break;
+		default:
+			ErrorAtToken(
+			    *buildObject.definition->definitionInvocation,
+			    "Tried to build definition which is not compile-time object. Code error?");
+			break;
+	}
+
+	buildObject.stage = BuildStage_ResolvingReferences;
+
+	// Resolve references
+	ObjectReferencePoolMap::iterator referencePoolIt =
+	    environment.referencePools.find(buildObject.definition->name);
+	if (referencePoolIt == environment.referencePools.end())
+	{
+		if (!buildObject.definition->environmentRequired)
+			Log(
+			    "error: built an object which had no references. It should not have been "
+			    "required. There must be a problem with Cakelisp internally\n");
+		return false;
+	}
+
+	bool hasErrors = false;
+	std::vector<ObjectReference>& references = referencePoolIt->second.references;
+	// The old-style loop must be used here because EvaluateGenerate_Recursive can add to this
+	// list, which invalidates iterators
+	for (int i = 0; i < (int)references.size(); ++i)
+	{
+		const int maxNumReferences = 1 << 13;
+		if (i >= maxNumReferences)
+		{
+			ErrorAtTokenf(*buildObject.definition->definitionInvocation,
+			              "error: definition %s exceeded max number of references (%d). Is it "
+			              "in an infinite loop?",
+			              buildObject.definition->name.c_str(), maxNumReferences);
+			for (int n = 0; n < 10; ++n)
+			{
+				ErrorAtToken((*references[n].tokens)[references[n].startIndex],
+				             "Reference here");
+			}
+			hasErrors = true;
+			break;
+		}
+
+		if (references[i].isResolved)
+			continue;
+
+		if (references[i].type == ObjectReferenceResolutionType_Splice &&
+		    references[i].spliceOutput)
 		{
-			PrintBuffer(headerInclude, "-Isrc/");
+			ObjectReference* referenceValidPreEval = &references[i];
+			// In case a compile-time function has already guessed the invocation was a C/C++
+			// function, clear that invocation output
+			resetGeneratorOutput(*referenceValidPreEval->spliceOutput);
+
+			if (log.buildProcess)
+				NoteAtToken((*referenceValidPreEval->tokens)[referenceValidPreEval->startIndex],
+				            "resolving reference");
+
+			// Evaluate from that reference
+			int result = EvaluateGenerate_Recursive(
+			    environment, referenceValidPreEval->context, *referenceValidPreEval->tokens,
+			    referenceValidPreEval->startIndex, *referenceValidPreEval->spliceOutput);
+			referenceValidPreEval = nullptr;
+			hasErrors |= result > 0;
+			numErrorsOut += result;
 		}
 		else
 		{
-			PrintfBuffer(headerInclude, "-I%s", environment.cakelispSrcDir.c_str());
+			// Do not resolve, we don't know how to resolve this type of reference
+			ErrorAtToken((*references[i].tokens)[references[i].startIndex],
+			             "do not know how to resolve this reference (internal code error?)");
+			hasErrors = true;
+			continue;
 		}
 
-		ProcessCommandInput compileTimeInputs[] = {
-		    {ProcessCommandArgumentType_SourceInput, {sourceOutputName}},
-		    {ProcessCommandArgumentType_ObjectOutput, {buildObjectName}},
-		    {ProcessCommandArgumentType_CakelispHeadersInclude, {headerInclude}}};
-		const char** buildArguments = MakeProcessArgumentsFromCommand(
-		    environment.compileTimeBuildCommand, compileTimeInputs, ArraySize(compileTimeInputs));
-		if (!buildArguments)
+		if (hasErrors)
+			continue;
+
+		// Regardless of what evaluate turned up, we resolved this as far as we care. Trying
+		// again isn't going to change the number of errors
+		// Note that if new references emerge to this definition, they will automatically be
+		// recognized as the definition and handled then and there, so we don't need to make
+		// more than one pass
+		references[i].isResolved = true;
+
+		++numReferencesResolved;
+	}
+
+	if (hasErrors)
+		return false;
+
+	if (log.buildProcess)
+		Logf("Resolved %d references\n", numReferencesResolved);
+
+	// Remove need to build
+	buildObject.definition->isLoaded = true;
+	QueueReferencingDefinitionsCheck(environment, buildObject.definition->name);
+
+	buildObject.stage = BuildStage_Finished;
+
+	if (log.buildProcess)
+		Logf("Successfully built, loaded, and executed %s\n",
+		       buildObject.definition->name.c_str());
+
+	return true;
+}
+
+//
+// Reference guess cache
+//
+// Guessing that an unknown reference is a C/C++ function is wrong if it is later defined by
+// Cakelisp (e.g. by a macro expansion), in which case the definition fails to compile. Remembering
+// what the references turned out to be lets the next run wait for those definitions instead, and
+// know which guesses are safe
+
+static const char* referenceGuessCacheFilename = "ReferenceGuesses.cake";
+
+// Returns false if the definition isn't a list of tokens (e.g. the global pseudo-definition)
+static bool getDefinitionContentsCrc(const ObjectDefinition& definition, uint32_t* crcOut)
+{
+	const Token* currentToken = definition.definitionInvocation;
+	if (!currentToken || currentToken->type != TokenType_OpenParen)
+		return false;
+
+	// Only contents matter, so moving the definition around in its file doesn't invalidate it.
+	// Token arrays are validated, so the matching paren is always reached
+	uint32_t crc = 0;
+	int depth = 0;
+	do
+	{
+		if (currentToken->type == TokenType_OpenParen)
+			++depth;
+		else if (currentToken->type == TokenType_CloseParen)
+			--depth;
+		crc32(&currentToken->type, sizeof(currentToken->type), &crc);
+		crc32(currentToken->contents.c_str(), currentToken->contents.size() + 1, &crc);
+		++currentToken;
+	} while (depth > 0);
+
+	*crcOut = crc;
+	return true;
+}
+
+static const CachedReferenceGuesses* findCachedReferenceGuesses(
+    EvaluatorEnvironment& environment, const ObjectDefinition& definition)
+{
+	uint32_t definitionCrc = 0;
+	if (environment.referenceGuessCache.empty() ||
+	    !getDefinitionContentsCrc(definition, &definitionCrc))
+		return nullptr;
+
+	ReferenceGuessCache::iterator findIt =
+	    environment.referenceGuessCache.find(definition.name.c_str());
+	if (findIt == environment.referenceGuessCache.end() ||
+	    findIt->second.definitionCrc != definitionCrc)
+		return nullptr;
+	return &findIt->second;
+}
+
+static void readReferenceGuessCache(EvaluatorEnvironment& environment)
+{
+	char inputFilename[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(inputFilename, "%s/%s", cakelispWorkingDir, referenceGuessCacheFilename);
+	if (!fileExists(inputFilename))
+		return;
+
+	const std::vector<Token>* tokens = nullptr;
+	if (!moduleLoadTokenizeValidate(inputFilename, &tokens))
+		return;
+
+	// (reference-guesses "definition" crc (defined "name"...) (external "name"...))
+	// Anything unexpected means the whole cache is ignored, because it's only a hint
+	bool isValid = true;
+	ReferenceGuessCache readCache;
+	for (int i = 0; isValid && i < (int)tokens->size(); ++i)
+	{
+		int endInvocationIndex = FindCloseParenTokenIndex(*tokens, i);
+		int nameIndex = getArgument(*tokens, i, 1, endInvocationIndex);
+		int crcIndex = getArgument(*tokens, i, 2, endInvocationIndex);
+		if ((*tokens)[i].type != TokenType_OpenParen ||
+		    (*tokens)[i + 1].contents.compare("reference-guesses") != 0 || nameIndex == -1 ||
+		    crcIndex == -1 || (*tokens)[nameIndex].type != TokenType_String ||
+		    (*tokens)[crcIndex].type != TokenType_Symbol)
+		{
+			isValid = false;
+			break;
+		}
+
+		CachedReferenceGuesses& guesses = readCache[(*tokens)[nameIndex].contents.c_str()];
+		char* endPtr;
+		guesses.definitionCrc =
+		    (uint32_t)strtoul((*tokens)[crcIndex].contents.c_str(), &endPtr, /*base=*/10);
+		for (int listIndex = getNextArgument(*tokens, crcIndex, endInvocationIndex);
+		     listIndex < endInvocationIndex;
+		     listIndex = getNextArgument(*tokens, listIndex, endInvocationIndex))
 		{
-			// TODO: Abort building if cannot invoke compiler
+			const Token& listName = (*tokens)[listIndex + 1];
+			std::vector<Symbol>* references = nullptr;
+			if ((*tokens)[listIndex].type == TokenType_OpenParen &&
+			    listName.contents.compare("defined") == 0)
+				references = &guesses.definedReferences;
+			else if ((*tokens)[listIndex].type == TokenType_OpenParen &&
+			         listName.contents.compare("external") == 0)
+				references = &guesses.externalReferences;
+			if (!references)
+			{
+				isValid = false;
+				break;
+			}
+
+			int endListIndex = FindCloseParenTokenIndex(*tokens, listIndex);
+			for (int nameIndex = listIndex + 2; nameIndex < endListIndex; ++nameIndex)
+				references->push_back((*tokens)[nameIndex].contents);
+		}
+
+		i = endInvocationIndex;
+	}
+
+	if (isValid)
+		environment.referenceGuessCache.swap(readCache);
+	else if (log.fileSystem)
+		Logf("Ignoring unrecognized reference guess cache %s\n", inputFilename);
+
+	releaseTokenIndex(*tokens);
+	delete tokens;
+}
+
+// Entries for definitions which weren't in this run are kept, because the cache directory may be
+// shared by several builds. Entries for older versions of this run's definitions are replaced
+static void updateWriteReferenceGuessCache(EvaluatorEnvironment& environment)
+{
+	for (ObjectDefinitionPair& definitionPair : environment.definitions)
+	{
+		ObjectDefinition& definition = definitionPair.second;
+		uint32_t definitionCrc = 0;
+		if (!isCompileTimeObject(definition.type) ||
+		    !getDefinitionContentsCrc(definition, &definitionCrc))
 			continue;
+
+		CachedReferenceGuesses guesses;
+		guesses.definitionCrc = definitionCrc;
+		for (ObjectReferenceStatusPair& referencePair : definition.references)
+		{
+			ObjectReferenceStatus& referenceStatus = referencePair.second;
+			if (!referenceStatus.wasUnknownWhenChecked)
+				continue;
+
+			if (findReferencedDefinition(environment, referenceStatus))
+				guesses.definedReferences.push_back(referencePair.first);
+			else if (referenceStatus.guessState == GuessState_Guessed && definition.isLoaded)
+				guesses.externalReferences.push_back(referencePair.first);
 		}
 
-		RunProcessArguments compileArguments = {};
-		compileArguments.fileToExecute = environment.compileTimeBuildCommand.fileToExecute.c_str();
-		compileArguments.arguments = buildArguments;
-		if (runProcess(compileArguments, &buildObject.status) != 0)
+		if (guesses.definedReferences.empty() && guesses.externalReferences.empty())
 		{
-			// TODO: Abort building if cannot invoke compiler?
-			// free(buildArguments);
-			// return 0;
+			// Nothing was learned this run, but what is known about this version may still help
+			ReferenceGuessCache::iterator findIt =
+			    environment.referenceGuessCache.find(definition.name.c_str());
+			if (findIt != environment.referenceGuessCache.end() &&
+			    findIt->second.definitionCrc != definitionCrc)
+				environment.referenceGuessCache.erase(findIt);
+			continue;
 		}
+		environment.referenceGuessCache[definition.name.c_str()] = guesses;
+	}
 
-		free(buildArguments);
+	char outputFilename[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(outputFilename, "%s/%s", cakelispWorkingDir, referenceGuessCacheFilename);
+
+	// An empty file would fail to load as a module
+	if (environment.referenceGuessCache.empty())
+	{
+		remove(outputFilename);
+		return;
+	}
 
-		// TODO: Move this to other processes as well
-		// TODO This could be made smarter by allowing more spawning right when a process closes,
-		// instead of starting in waves
-		++currentNumProcessesSpawned;
-		if (currentNumProcessesSpawned >= maxProcessesRecommendedSpawned)
+	const char* source = "Evaluator.cpp";
+	const Token openParen = {TokenType_OpenParen, EmptyString, source, 1, 0, 0};
+	const Token closeParen = {TokenType_CloseParen, EmptyString, source, 1, 0, 0};
+	const Token guessesInvoke = {TokenType_Symbol, "reference-guesses", source, 1, 0, 0};
+	const Token definedInvoke = {TokenType_Symbol, "defined", source, 1, 0, 0};
+	const Token externalInvoke = {TokenType_Symbol, "external", source, 1, 0, 0};
+
+	std::vector<Token> outputTokens;
+	for (const ReferenceGuessCachePair& guessesPair : environment.referenceGuessCache)
+	{
+		outputTokens.push_back(openParen);
+		outputTokens.push_back(guessesInvoke);
+		Token definitionNameToken = {TokenType_String, guessesPair.first, source, 1, 0, 0};
+		outputTokens.push_back(definitionNameToken);
+		std::string definitionCrc = std::to_string(guessesPair.second.definitionCrc);
+		Token crcToken = {TokenType_Symbol, definitionCrc, source, 1, 0, 0};
+		outputTokens.push_back(crcToken);
+
+		const std::vector<Symbol>* referenceLists[] = {&guessesPair.second.definedReferences,
+		                                               &guessesPair.second.externalReferences};
+		const Token* listInvokes[] = {&definedInvoke, &externalInvoke};
+		for (int listIndex = 0; listIndex < (int)(ArraySize(referenceLists)); ++listIndex)
 		{
-			waitForAllProcessesClosed(OnCompileProcessOutput);
-			currentNumProcessesSpawned = 0;
+			if (referenceLists[listIndex]->empty())
+				continue;
+			outputTokens.push_back(openParen);
+			outputTokens.push_back(*listInvokes[listIndex]);
+			for (const Symbol& referenceName : *referenceLists[listIndex])
+			{
+				Token nameToken = {TokenType_String, referenceName, source, 1, 0, 0};
+				outputTokens.push_back(nameToken);
+			}
+			outputTokens.push_back(closeParen);
 		}
+
+		outputTokens.push_back(closeParen);
+	}
+
+	FILE* file = fileOpen(outputFilename, "w");
+	if (!file)
+	{
+		Logf("error: Could not write cache file %s\n", outputFilename);
+		return;
 	}
 
-	// The result of the builds will go straight to our definitionsToBuild
-	waitForAllProcessesClosed(OnCompileProcessOutput);
-	currentNumProcessesSpawned = 0;
+	prettyPrintTokensToFile(file, outputTokens);
 
-	// Linking
-	for (BuildObject& buildObject : definitionsToBuild)
+	fclose(file);
+}
+
+static bool symbolListContains(const std::vector<Symbol>& symbols, const Symbol& symbol)
+{
+	return FindInContainer(symbols, symbol) != symbols.end();
+}
+
+// Checks whether the definition's references allow it to be built, guessing at any unknown
+// references. Returns true if it should be built, in which case objectToBuildOut is filled in
+static bool BuildCheckDefinition(EvaluatorEnvironment& environment, ObjectDefinition& definition,
+                                 BuildObject& objectToBuildOut,
+                                 bool& requireDependencyPropagationOut)
+{
+	const char* defName = definition.name.c_str();
+
+	if (log.compileTimeBuildReasons)
+		Logf("Checking to build %s\n", defName);
+
+	// Can it be built in the current environment?
+	bool canBuild = true;
+	bool hasRelevantChangeOccurred = false;
+	bool hasGuessedRefs = false;
+	// Guesses the reference guess cache says were right last time aren't likely to fail
+	bool hasUnconfirmedGuessedRefs = false;
+	bool isWaitingOnCachedGuesses = false;
+	bool hasAnyRefs = false;
+	const CachedReferenceGuesses* cachedGuesses =
+	    isCompileTimeObject(definition.type) ? findCachedReferenceGuesses(environment, definition) :
+	                                           nullptr;
+	// If there were new guesses, we will do another pass over this definition's references in
+	// case new references turned up
+	bool guessMaybeDirtiedReferences = false;
+	do
 	{
-		if (buildObject.stage != BuildStage_Compiling)
-			continue;
+		guessMaybeDirtiedReferences = false;
 
-		if (buildObject.status != 0)
+		if (definition.references.empty())
 		{
-			ErrorAtTokenf(*buildObject.definition->definitionInvocation,
-			              "failed to compile definition '%s' with status %d",
-			              buildObject.definition->name.c_str(), buildObject.status);
-			// Special case: If the definition has no references, prevent it from ever having a
-			// chance to fail again, because there's nothing we can do if it fails
-			if (!buildObject.hasAnyRefs)
+			hasAnyRefs = false;
+			break;
+		}
+
+		// Copy pointers to refs in case of iterator invalidation
+		std::vector<ObjectReferenceStatus*> referencesToCheck;
+		referencesToCheck.reserve(definition.references.size());
+		for (ObjectReferenceStatusPair& referencePair : definition.references)
+		{
+			referencesToCheck.push_back(&referencePair.second);
+		}
+		for (ObjectReferenceStatus* referencePointer : referencesToCheck)
+		{
+			ObjectReferenceStatus& referenceStatus = *referencePointer;
+
+			ObjectDefinition* referencedDefinition =
+			    findReferencedDefinition(environment, referenceStatus);
+			if (referencedDefinition)
 			{
-				buildObject.definition->forbidBuild = true;
-				NoteAtToken(*buildObject.definition->definitionInvocation,
-				            "definition has no missing references. It must be a legitimate error "
-				            "Cakelisp cannot correct. It will not be rebuilt");
+				if (isCompileTimeObject(referencedDefinition->type))
+				{
+					bool refCompileTimeCodeLoaded = referencedDefinition->isLoaded;
+					if (refCompileTimeCodeLoaded)
+					{
+						// The reference is ready to go. Built objects immediately resolve
+						// references. We will react to it if the last thing we did was guess
+						// incorrectly that this was a C call
+						if (referenceStatus.guessState != GuessState_Resolved)
+						{
+							if (log.compileTimeBuildReasons)
+								Log("\tRequired code has been loaded\n");
+
+							hasRelevantChangeOccurred = true;
+						}
+
+						referenceStatus.guessState = GuessState_Resolved;
+					}
+					else
+					{
+						// If we know we are missing a compile time function, we won't try to
+						// guess
+						if (log.compileTimeBuildReasons)
+							Logf("\tCannot build until %s is loaded\n",
+							       referenceStatus.name->contents.c_str());
+
+						referenceStatus.guessState = GuessState_WaitingForLoad;
+						canBuild = false;
+					}
+				}
+				else if (referencedDefinition->type == ObjectType_Function &&
+				         referenceStatus.guessState != GuessState_Resolved)
+				{
+					// A known Cakelisp function call
+					for (int i = 0; i < (int)referenceStatus.references.size(); ++i)
+					{
+						ObjectReference& reference = referenceStatus.references[i];
+						// Run function invocation on it
+						// TODO: Make invocation generator know it is a Cakelisp function
+						bool result = FunctionInvocationGenerator(
+						    environment, reference.context, *reference.tokens,
+						    reference.startIndex, *reference.spliceOutput);
+						// Our guess didn't even evaluate
+						if (!result)
+							canBuild = false;
+					}
+
+					referenceStatus.guessState = GuessState_Resolved;
+				}
+				// TODO: Building references to non-comptime functions at comptime
 			}
+			else
+			{
+				bool isCachedAsExternal =
+				    cachedGuesses && symbolListContains(cachedGuesses->externalReferences,
+				                                        referenceStatus.name->contents);
+				if (referenceStatus.guessState == GuessState_None)
+					referenceStatus.wasUnknownWhenChecked = true;
+
+				if (referenceStatus.guessState == GuessState_None &&
+				    !environment.hasStoppedWaitingOnCachedGuesses && cachedGuesses &&
+				    symbolListContains(cachedGuesses->definedReferences,
+				                       referenceStatus.name->contents))
+				{
+					// Guessing would only fail to compile. Defining it will queue another check
+					if (log.compileTimeBuildReasons)
+						Logf("\tCannot build until %s is defined (it was defined last time)\n",
+						     referenceStatus.name->contents.c_str());
 
-			continue;
+					canBuild = false;
+					isWaitingOnCachedGuesses = true;
+				}
+				else if (referenceStatus.guessState == GuessState_None)
+				{
+					if (log.compileTimeBuildReasons)
+						Logf("\tCannot build until %s is guessed. Guessing now\n",
+						       referenceStatus.name->contents.c_str());
+
+					// Find all the times the definition makes this reference
+					// We must use indices because the call to FunctionInvocationGenerator can
+					// add new references to the list
+					// Note that if new references are added to other functions, they need to be
+					// handled in the next pass
+					for (int i = 0; i < (int)referenceStatus.references.size(); ++i)
+					{
+						ObjectReference& reference = referenceStatus.references[i];
+						// Run function invocation on it
+						bool result = FunctionInvocationGenerator(
+						    environment, reference.context, *reference.tokens,
+						    reference.startIndex, *reference.spliceOutput);
+						// Our guess didn't even evaluate
+						if (!result)
+							canBuild = false;
+					}
+
+					referenceStatus.guessState = GuessState_Guessed;
+					hasRelevantChangeOccurred = true;
+					hasGuessedRefs = true;
+					hasUnconfirmedGuessedRefs |= !isCachedAsExternal;
+					guessMaybeDirtiedReferences = true;
+					requireDependencyPropagationOut = true;
+				}
+				else if (referenceStatus.guessState == GuessState_Guessed)
+				{
+					// It has been guessed, and still isn't in definitions
+					hasGuessedRefs = true;
+					hasUnconfirmedGuessedRefs |= !isCachedAsExternal;
+				}
+			}
 		}
+	} while (guessMaybeDirtiedReferences);
+
+	// References added from now on could change the outcome, so will need another check
+	definition.isReferenceCheckQueued = false;
 
-		buildObject.stage = BuildStage_Linking;
+	if (isWaitingOnCachedGuesses)
+		environment.definitionsWaitingOnCachedGuesses.push_back(definition.name);
+
+	// hasRelevantChangeOccurred being false suppresses rebuilding compile-time functions which
+	// still have the same missing references. Note that only compile time objects can be built.
+	// We put normal functions through the guessing system too because they need their functions
+	// resolved as well. It's a bit dirty but not too bad
+	if (canBuild && (!hasGuessedRefs || hasRelevantChangeOccurred) &&
+	    isCompileTimeObject(definition.type))
+	{
+		objectToBuildOut.buildId = getNextFreeBuildId(environment);
+		objectToBuildOut.definition = &definition;
+		objectToBuildOut.hasAnyRefs = hasAnyRefs;
+		objectToBuildOut.hasGuessedRefs = hasUnconfirmedGuessedRefs;
+		return true;
+	}
+
+	return false;
+}
+
+// Precompiles the headers every compile-time object includes, unless an up-to-date precompiled
+// header is already in the cache. Only tried once per environment. If it fails, objects are simply
+// built without it
+static void BuildPrepareCompileTimePrelude(EvaluatorEnvironment& environment)
+{
+	if (!environment.usePrecompiledHeaders || environment.hasPreparedCompileTimePrelude)
+		return;
+	environment.hasPreparedCompileTimePrelude = true;
+
+	std::string prelude;
+	makeCompileTimePrelude(prelude);
+
+	char headerInclude[MAX_PATH_LENGTH] = {0};
+	BuildGetCakelispHeadersInclude(environment, headerInclude, sizeof(headerInclude));
+
+	// A precompiled header can only be used by the compiler and arguments which built it
+	uint32_t preludeCrc = 0;
+	crc32(prelude.data(), prelude.size(), &preludeCrc);
+	const ProcessCommand& buildCommand = environment.compileTimeBuildCommand;
+	crc32(buildCommand.fileToExecute.c_str(), buildCommand.fileToExecute.size() + 1, &preludeCrc);
+	for (const ProcessCommandArgument& argument : buildCommand.arguments)
+	{
+		crc32(&argument.type, sizeof(argument.type), &preludeCrc);
+		crc32(argument.contents.c_str(), argument.contents.size() + 1, &preludeCrc);
+	}
+	crc32(headerInclude, strlen(headerInclude), &preludeCrc);
+
+	char preludeFilename[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(preludeFilename, "%s/comptime_prelude_%08x.hpp", cakelispWorkingDir,
+	             (unsigned int)preludeCrc);
+	// GCC and Clang both look for <header>.gch when <header> is included
+	char precompiledHeaderFilename[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(precompiledHeaderFilename, "%s.gch", preludeFilename);
+
+	if (!writeIfContentsChanged(prelude.data(), prelude.size(), preludeFilename))
+		return;
+
+	// Cakelisp's headers change between versions of Cakelisp, so they need to be checked too
+	bool isCached = false;
+	if (environment.useCachedFiles && fileExists(precompiledHeaderFilename))
+	{
+		std::vector<std::string> headerSearchDirectories = {headerInclude + strlen("-I")};
+		HeaderModificationTimeTable headerModifiedCache;
+		unsigned long mostRecentHeaderModTime = GetMostRecentIncludeModified_Recursive(
+		    headerSearchDirectories, preludeFilename, /*includedBy*/ nullptr, headerModifiedCache);
+		isCached = fileGetLastModificationTime(precompiledHeaderFilename) > mostRecentHeaderModTime;
+	}
 
+	if (!isCached)
+	{
 		if (log.buildProcess)
-			Logf("Compiled %s successfully\n", buildObject.definition->name.c_str());
-
-		ProcessCommandInput linkTimeInputs[] = {
-		    {ProcessCommandArgumentType_DynamicLibraryOutput,
-		     {buildObject.dynamicLibraryPath.c_str()}},
-		    {ProcessCommandArgumentType_ObjectInput, {buildObject.buildObjectName.c_str()}}};
-		const char** linkArgumentList = MakeProcessArgumentsFromCommand(
-		    environment.compileTimeLinkCommand, linkTimeInputs, ArraySize(linkTimeInputs));
-		if (!linkArgumentList)
-		{
-			// TODO: Abort building if cannot invoke compiler
-			continue;
-		}
-		RunProcessArguments linkArguments = {};
-		linkArguments.fileToExecute = environment.compileTimeLinkCommand.fileToExecute.c_str();
-		linkArguments.arguments = linkArgumentList;
-		if (runProcess(linkArguments, &buildObject.status) != 0)
+			Logf("Precompiling %s\n", preludeFilename);
+
+		ProcessCommandInput compileTimeInputs[] = {
+		    {ProcessCommandArgumentType_SourceInput, {"-x", "c++-header", preludeFilename}},
+		    {ProcessCommandArgumentType_ObjectOutput, {precompiledHeaderFilename}},
+		    {ProcessCommandArgumentType_CakelispHeadersInclude, {headerInclude}}};
+		const char** buildArguments = MakeProcessArgumentsFromCommand(
+		    environment.compileTimeBuildCommand, compileTimeInputs, ArraySize(compileTimeInputs));
+		if (!buildArguments)
+			return;
+
+		RunProcessArguments compileArguments = {};
+		compileArguments.fileToExecute = environment.compileTimeBuildCommand.fileToExecute.c_str();
+		compileArguments.arguments = buildArguments;
+		int status = -1;
+		if (runProcess(compileArguments, &status) == 0)
+			waitForAllProcessesClosed(OnCompileProcessOutput);
+		free(buildArguments);
+
+		if (status != 0)
 		{
-			// TODO: Abort if linker failed?
-			// free(linkArgumentList);
+			Log("note: failed to precompile compile-time headers. Compile-time code will be built "
+			    "without them\n");
+			return;
 		}
-		free(linkArgumentList);
 	}
 
-	// The result of the linking will go straight to our definitionsToBuild
-	waitForAllProcessesClosed(OnCompileProcessOutput);
-	currentNumProcessesSpawned = 0;
+	environment.compileTimePreludeHeader = preludeFilename;
+}
 
-	for (BuildObject& buildObject : definitionsToBuild)
+// Objects which can't be batched, or whose batch failed, wait here for a process to compile them
+typedef std::deque<BuildObject*> BuildCompileQueue;
+
+static void BuildQueueCompileIndividually(BuildBatch& batch, BuildCompileQueue& compileQueue)
+{
+	for (BuildObject* buildObject : batch.buildObjects)
+		compileQueue.push_back(buildObject);
+	batch.buildObjects.clear();
+}
+
+// Writes the object, then either loads its cached library or queues it to be compiled. Objects
+// with no guessed references go into the batch instead, if there is one
+static void BuildStartObject(EvaluatorEnvironment& environment, BuildObject& buildObject,
+                             BuildBatch* batch, BuildCompileQueue& compileQueue)
+{
+	bool isCached = false;
+	if (!BuildWriteObject(environment, buildObject, isCached))
 	{
-		if (buildObject.stage != BuildStage_Linking)
-			continue;
+		buildObject.stage = BuildStage_Failed;
+		return;
+	}
+
+	if (isCached)
+	{
+		// Skip straight to loading
+		buildObject.status = 0;
+		BuildLoadObject(environment, buildObject);
+		return;
+	}
+
+	buildObject.stage = BuildStage_Compiling;
+	if (batch && !buildObject.hasGuessedRefs)
+		batch->buildObjects.push_back(&buildObject);
+	else
+		compileQueue.push_back(&buildObject);
+}
 
-		if (buildObject.status != 0)
+static void BuildOnCompiled(EvaluatorEnvironment& environment, BuildObject& buildObject,
+                            int& numProcessesRunning)
+{
+	if (buildObject.status != 0)
+	{
+		ErrorAtTokenf(*buildObject.definition->definitionInvocation,
+		              "failed to compile definition '%s' with status %d",
+		              buildObject.definition->name.c_str(), buildObject.status);
+		// Special case: If the definition has no references, prevent it from ever having a
+		// chance to fail again, because there's nothing we can do if it fails
+		if (!buildObject.hasAnyRefs)
 		{
-			ErrorAtToken(*buildObject.definition->definitionInvocation,
-			             "Failed to link definition");
-			continue;
+			buildObject.definition->forbidBuild = true;
+			NoteAtToken(*buildObject.definition->definitionInvocation,
+			            "definition has no missing references. It must be a legitimate error "
+			            "Cakelisp cannot correct. It will not be rebuilt");
 		}
 
-		buildObject.stage = BuildStage_Loading;
+		buildObject.stage = BuildStage_Failed;
+		return;
+	}
+
+	buildObject.stage = BuildStage_Linking;
 
-		if (log.buildProcess)
-			Logf("Linked %s successfully\n", buildObject.definition->name.c_str());
+	if (log.buildProcess)
+		Logf("Compiled %s successfully\n", buildObject.definition->name.c_str());
+
+	if (BuildSpawnLink(environment, buildObject.buildObjectName.c_str(),
+	                   buildObject.dynamicLibraryPath.c_str(), &buildObject.status))
+	{
+		++numProcessesRunning;
+	}
+	else
+	{
+		buildObject.status = -1;
+		BuildLoadObject(environment, buildObject);
+	}
+}
+
+// Objects in the batch are loaded from the batch library, so they skip individual linking
+static void BuildLoadBatch(EvaluatorEnvironment& environment, BuildBatch& batch)
+{
+	for (BuildObject* buildObject : batch.buildObjects)
+	{
+		buildObject->dynamicLibraryPath = batch.dynamicLibraryPath;
+		buildObject->status = batch.status;
+		BuildLoadObject(environment, *buildObject);
+	}
+	batch.buildObjects.clear();
+}
+
+static void BuildOnBatchProcessClosed(EvaluatorEnvironment& environment, BuildBatch& batch,
+                                      BuildCompileQueue& compileQueue, int& numProcessesRunning)
+{
+	if (batch.stage == BuildStage_Linking)
+	{
+		BuildLoadBatch(environment, batch);
+		return;
+	}
+
+	if (batch.status != 0)
+	{
+		// The batch shares one status, so there's no telling which object failed. Build them
+		// individually, which will also attribute errors to the right definitions
+		Logf("note: failed to compile batch %s. Compiling its objects individually\n",
+		     batch.sourceName.c_str());
+		BuildQueueCompileIndividually(batch, compileQueue);
+		return;
+	}
+
+	if (log.buildProcess)
+		Logf("Compiled %s successfully\n", batch.sourceName.c_str());
+
+	batch.stage = BuildStage_Linking;
+	if (BuildSpawnLink(environment, batch.buildObjectName.c_str(),
+	                   batch.dynamicLibraryPath.c_str(), &batch.status))
+	{
+		++numProcessesRunning;
+	}
+	else
+	{
+		batch.status = -1;
+		BuildLoadBatch(environment, batch);
+	}
+}
+
+// A definition is only built once per pass, so a failure isn't retried until something changes
+static bool isInBuildList(const BuildObjectList& definitionsToBuild,
+                          const ObjectDefinition* definition)
+{
+	for (const BuildObject& buildObject : definitionsToBuild)
+	{
+		if (buildObject.definition == definition)
+			return true;
+	}
+	return false;
+}
+
+// Definitions waiting on objects which have just been resolved may be buildable now. Start them
+// right away rather than in the next pass, so they build while the rest of this pass is building
+static void BuildStartDependents(EvaluatorEnvironment& environment,
+                                 BuildObjectList& definitionsToBuild,
+                                 BuildCompileQueue& compileQueue,
+                                 bool& requireDependencyPropagationOut)
+{
+	if (environment.definitionsToCheckReferences.empty())
+		return;
+
+	std::vector<Symbol> definitionNamesToCheck;
+	definitionNamesToCheck.swap(environment.definitionsToCheckReferences);
+	for (const Symbol& definitionName : definitionNamesToCheck)
+	{
+		ObjectDefinition* definition = findObjectDefinition(environment, definitionName);
+		if (!definition)
+			continue;
 
-		DynamicLibHandle builtLib = loadDynamicLibrary(buildObject.dynamicLibraryPath.c_str());
-		if (!builtLib)
+		if (!definition->isRequired || definition->isLoaded || definition->forbidBuild)
 		{
-			ErrorAtToken(*buildObject.definition->definitionInvocation,
-			             "Failed to load compile-time library");
+			definition->isReferenceCheckQueued = false;
 			continue;
 		}
 
-		// We need to do name conversion to be compatible with C naming
-		// TODO: Make these come from the top
-		NameStyleSettings nameSettings;
-		char symbolNameBuffer[MAX_NAME_LENGTH] = {0};
-		lispNameStyleToCNameStyle(
-		    nameSettings.functionNameMode, buildObject.definition->name.c_str(), symbolNameBuffer,
-		    sizeof(symbolNameBuffer), *buildObject.definition->definitionInvocation);
-		void* compileTimeFunction = getSymbolFromDynamicLibrary(builtLib, symbolNameBuffer);
-		if (!compileTimeFunction)
+		// Leave it queued for the next pass
+		if (isInBuildList(definitionsToBuild, definition))
 		{
-			ErrorAtToken(*buildObject.definition->definitionInvocation,
-			             "Failed to find symbol in loaded library");
+			environment.definitionsToCheckReferences.push_back(definitionName);
 			continue;
 		}
 
-		// Add to environment
-		switch (buildObject.definition->type)
+		BuildObject objectToBuild;
+		if (!BuildCheckDefinition(environment, *definition, objectToBuild,
+		                          requireDependencyPropagationOut))
+			continue;
+
+		if (log.compileTimeBuildObjects)
+			Logf("Building compile-time object %s\n", definition->name.c_str());
+
+		definitionsToBuild.push_back(objectToBuild);
+		BuildStartObject(environment, definitionsToBuild.back(), /*batch=*/nullptr,
+		                 compileQueue);
+	}
+}
+
+// Each object links as soon as its compile finishes, and loads as soon as its link finishes, while
+// other objects are still building. Objects add their functions to the environment and resolve
+// references in list order, so the generated code doesn't depend on which process happens to
+// finish first. Definitions which become buildable after an object resolves are added to the list
+int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
+                                     BuildObjectList& definitionsToBuild, int& numErrorsOut,
+                                     bool& requireDependencyPropagationOut)
+{
+	int numReferencesResolved = 0;
+
+	// Sure-thing builds (ones where we know all references) are combined into a batch, if enabled
+	BuildBatch batch;
+	BuildCompileQueue compileQueue;
+	for (BuildObject& buildObject : definitionsToBuild)
+		BuildStartObject(environment, buildObject,
+		                 environment.batchCompileTimeBuilds ? &batch : nullptr, compileQueue);
+
+	// Only worth precompiling headers once something needs compiling. No processes may be running
+	// yet, because this waits for the precompile to finish
+	if (!compileQueue.empty() || !batch.buildObjects.empty())
+		BuildPrepareCompileTimePrelude(environment);
+
+	int numProcessesRunning = 0;
+
+	// A batch of one would only add the cost of writing the batch
+	bool isBatchCached = false;
+	if (batch.buildObjects.size() > 1 && BuildWriteBatch(environment, batch, isBatchCached))
+	{
+		if (isBatchCached)
 		{
-			case ObjectType_CompileTimeMacro:
-				if (findMacro(environment, buildObject.definition->name.c_str()))
-					NoteAtToken(*buildObject.definition->definitionInvocation, "redefined macro");
-				environment.macros[buildObject.definition->name] = (MacroFunc)compileTimeFunction;
-				break;
-			case ObjectType_CompileTimeGenerator:
-				if (findGenerator(environment, buildObject.definition->name.c_str()))
-					NoteAtToken(*buildObject.definition->definitionInvocation,
-					            "redefined generator");
-				environment.generators[buildObject.definition->name] =
-				    (GeneratorFunc)compileTimeFunction;
-				break;
-			case ObjectType_CompileTimeFunction:
-				if (findCompileTimeFunction(environment, buildObject.definition->name.c_str()))
-					NoteAtToken(*buildObject.definition->definitionInvocation,
-					            "redefined function");
-				environment.compileTimeFunctions[buildObject.definition->name] =
-				    (void*)compileTimeFunction;
-				break;
-			default:
-				ErrorAtToken(
-				    *buildObject.definition->definitionInvocation,
-				    "Tried to build definition which is not compile-time object. Code error?");
-				break;
+			if (log.buildProcess)
+				Logf("Skipping compiling %s (using cached library)\n", batch.sourceName.c_str());
+			batch.status = 0;
+			BuildLoadBatch(environment, batch);
 		}
+		else
+		{
+			if (log.buildProcess)
+				Logf("Compiling %d compile-time objects in %s\n", (int)batch.buildObjects.size(),
+				     batch.sourceName.c_str());
+			batch.stage = BuildStage_Compiling;
+			if (BuildSpawnCompile(environment, batch.sourceName.c_str(), batch.sourceText,
+			                      batch.buildObjectName.c_str(), &batch.status))
+				++numProcessesRunning;
+			else
+				BuildQueueCompileIndividually(batch, compileQueue);
+		}
+	}
+	else
+	{
+		BuildQueueCompileIndividually(batch, compileQueue);
+	}
 
-		buildObject.stage = BuildStage_ResolvingReferences;
-
-		// Resolve references
-		ObjectReferencePoolMap::iterator referencePoolIt =
-		    environment.referencePools.find(buildObject.definition->name);
-		if (referencePoolIt == environment.referencePools.end())
+	size_t nextObjectToResolve = 0;
+	while (true)
+	{
+		// NOTE: definitionsToBuild is a deque, so adding objects does not invalidate the status
+		// pointers of objects which are building
+		while (!compileQueue.empty() && numProcessesRunning < maxProcessesRecommendedSpawned)
 		{
-			if (!buildObject.definition->environmentRequired)
-				Log(
-				    "error: built an object which had no references. It should not have been "
-				    "required. There must be a problem with Cakelisp internally\n");
-			continue;
+			BuildObject& buildObject = *compileQueue.front();
+			compileQueue.pop_front();
+			if (BuildSpawnCompile(environment, buildObject.sourceOutputName.c_str(),
+			                      buildObject.sourceText, buildObject.buildObjectName.c_str(),
+			                      &buildObject.status))
+				++numProcessesRunning;
+			else
+				BuildOnCompiled(environment, buildObject, numProcessesRunning);
 		}
 
-		bool hasErrors = false;
-		std::vector<ObjectReference>& references = referencePoolIt->second.references;
-		// The old-style loop must be used here because EvaluateGenerate_Recursive can add to this
-		// list, which invalidates iterators
-		for (int i = 0; i < (int)references.size(); ++i)
+		// An object which is still building holds up resolving the objects after it
+		for (; nextObjectToResolve < definitionsToBuild.size(); ++nextObjectToResolve)
 		{
-			const int maxNumReferences = 1 << 13;
-			if (i >= maxNumReferences)
-			{
-				ErrorAtTokenf(*buildObject.definition->definitionInvocation,
-				              "error: definition %s exceeded max number of references (%d). Is it "
-				              "in an infinite loop?",
-				              buildObject.definition->name.c_str(), maxNumReferences);
-				for (int n = 0; n < 10; ++n)
-				{
-					ErrorAtToken((*references[n].tokens)[references[n].startIndex],
-					             "Reference here");
-				}
-				hasErrors = true;
+			BuildObject& buildObject = definitionsToBuild[nextObjectToResolve];
+			if (buildObject.stage == BuildStage_Compiling ||
+			    buildObject.stage == BuildStage_Linking)
 				break;
-			}
-
-			if (references[i].isResolved)
-				continue;
-
-			if (references[i].type == ObjectReferenceResolutionType_Splice &&
-			    references[i].spliceOutput)
-			{
-				ObjectReference* referenceValidPreEval = &references[i];
-				// In case a compile-time function has already guessed the invocation was a C/C++
-				// function, clear that invocation output
-				resetGeneratorOutput(*referenceValidPreEval->spliceOutput);
-
-				if (log.buildProcess)
-					NoteAtToken((*referenceValidPreEval->tokens)[referenceValidPreEval->startIndex],
-					            "resolving reference");
-
-				// Evaluate from that reference
-				int result = EvaluateGenerate_Recursive(
-				    environment, referenceValidPreEval->context, *referenceValidPreEval->tokens,
-				    referenceValidPreEval->startIndex, *referenceValidPreEval->spliceOutput);
-				referenceValidPreEval = nullptr;
-				hasErrors |= result > 0;
-				numErrorsOut += result;
-			}
-			else
-			{
-				// Do not resolve, we don't know how to resolve this type of reference
-				ErrorAtToken((*references[i].tokens)[references[i].startIndex],
-				             "do not know how to resolve this reference (internal code error?)");
-				hasErrors = true;
-				continue;
-			}
 
-			if (hasErrors)
+			if (buildObject.stage != BuildStage_Loading)
 				continue;
 
-			// Regardless of what evaluate turned up, we resolved this as far as we care. Trying
-			// again isn't going to change the number of errors
-			// Note that if new references emerge to this definition, they will automatically be
-			// recognized as the definition and handled then and there, so we don't need to make
-			// more than one pass
-			references[i].isResolved = true;
-
-			++numReferencesResolved;
+			if (BuildResolveObject(environment, buildObject, numReferencesResolved, numErrorsOut))
+				BuildStartDependents(environment, definitionsToBuild, compileQueue,
+				                     requireDependencyPropagationOut);
 		}
 
-		if (hasErrors)
+		if (!numProcessesRunning)
+		{
+			if (compileQueue.empty())
+				break;
 			continue;
+		}
 
-		if (log.buildProcess)
-			Logf("Resolved %d references\n", numReferencesResolved);
+		int* closedProcessStatus = waitForAnyProcessClosed(OnCompileProcessOutput);
+		if (!closedProcessStatus)
+			break;
+		--numProcessesRunning;
 
-		// Remove need to build
-		buildObject.definition->isLoaded = true;
+		if (closedProcessStatus == &batch.status)
+		{
+			BuildOnBatchProcessClosed(environment, batch, compileQueue, numProcessesRunning);
+			continue;
+		}
 
-		buildObject.stage = BuildStage_Finished;
+		for (BuildObject& buildObject : definitionsToBuild)
+		{
+			if (&buildObject.status != closedProcessStatus)
+				continue;
 
-		if (log.buildProcess)
-			Logf("Successfully built, loaded, and executed %s\n",
-			       buildObject.definition->name.c_str());
+			if (buildObject.stage == BuildStage_Compiling)
+				BuildOnCompiled(environment, buildObject, numProcessesRunning);
+			else if (buildObject.stage == BuildStage_Linking)
+				BuildLoadObject(environment, buildObject);
+			break;
+		}
 	}
 
 	return numReferencesResolved;
@@ -1131,178 +2361,42 @@ int BuildExecuteCompileTimeFunctions(EvaluatorEnvironment& environment,
 // Returns true if progress was made resolving references (or finding new references)
 bool BuildEvaluateReferences(EvaluatorEnvironment& environment, int& numErrorsOut)
 {
-	// We must copy references in case environment.definitions is modified, which would invalidate
-	// iterators, but not references
+	// Only definitions which changed since the last pass could have a different outcome. Take the
+	// queue, because checking may queue definitions for the next pass. Copy pointers in case
+	// environment.definitions is modified, which would invalidate iterators, but not references
+	std::vector<Symbol> definitionNamesToCheck;
+	definitionNamesToCheck.swap(environment.definitionsToCheckReferences);
 	std::vector<ObjectDefinition*> definitionsToCheck;
-	definitionsToCheck.reserve(environment.definitions.size());
-	for (ObjectDefinitionPair& definitionPair : environment.definitions)
+	definitionsToCheck.reserve(definitionNamesToCheck.size());
+	for (const Symbol& definitionName : definitionNamesToCheck)
 	{
-		ObjectDefinition& definition = definitionPair.second;
-		// Does it need to be built?
-		if (!definition.isRequired)
-			continue;
-
-		// Is it already in the environment?
-		if (definition.isLoaded)
+		ObjectDefinition* definitionPointer = findObjectDefinition(environment, definitionName);
+		if (!definitionPointer)
 			continue;
+		ObjectDefinition& definition = *definitionPointer;
 
-		if (definition.forbidBuild)
+		// Does it need to be built? Note that it stays queued until it is checked below, because
+		// checking it will see any references added before then
+		if (!definition.isRequired || definition.isLoaded || definition.forbidBuild)
+		{
+			definition.isReferenceCheckQueued = false;
 			continue;
+		}
 
 		definitionsToCheck.push_back(&definition);
 	}
 
-	std::vector<BuildObject> definitionsToBuild;
+	BuildObjectList definitionsToBuild;
 	// If it's possible a definition has new requirements, make sure we do another pass to add those
 	// requirements to the build
 	bool requireDependencyPropagation = false;
 
 	for (ObjectDefinition* definitionPointer : definitionsToCheck)
 	{
-		ObjectDefinition& definition = *definitionPointer;
-		const char* defName = definition.name.c_str();
-
-		if (log.compileTimeBuildReasons)
-			Logf("Checking to build %s\n", defName);
-
-		// Can it be built in the current environment?
-		bool canBuild = true;
-		bool hasRelevantChangeOccurred = false;
-		bool hasGuessedRefs = false;
-		bool hasAnyRefs = false;
-		// If there were new guesses, we will do another pass over this definition's references in
-		// case new references turned up
-		bool guessMaybeDirtiedReferences = false;
-		do
-		{
-			guessMaybeDirtiedReferences = false;
-
-			if (definition.references.empty())
-			{
-				hasAnyRefs = false;
-				break;
-			}
-
-			// Copy pointers to refs in case of iterator invalidation
-			std::vector<ObjectReferenceStatus*> referencesToCheck;
-			referencesToCheck.reserve(definition.references.size());
-			for (ObjectReferenceStatusPair& referencePair : definition.references)
-			{
-				referencesToCheck.push_back(&referencePair.second);
-			}
-			for (ObjectReferenceStatus* referencePointer : referencesToCheck)
-			{
-				ObjectReferenceStatus& referenceStatus = *referencePointer;
-
-				// TODO: (Performance) Add shortcut in reference
-				ObjectDefinitionMap::iterator findIt =
-				    environment.definitions.find(referenceStatus.name->contents);
-				if (findIt != environment.definitions.end())
-				{
-					if (isCompileTimeObject(findIt->second.type))
-					{
-						bool refCompileTimeCodeLoaded = findIt->second.isLoaded;
-						if (refCompileTimeCodeLoaded)
-						{
-							// The reference is ready to go. Built objects immediately resolve
-							// references. We will react to it if the last thing we did was guess
-							// incorrectly that this was a C call
-							if (referenceStatus.guessState != GuessState_Resolved)
-							{
-								if (log.compileTimeBuildReasons)
-									Log("\tRequired code has been loaded\n");
-
-								hasRelevantChangeOccurred = true;
-							}
-
-							referenceStatus.guessState = GuessState_Resolved;
-						}
-						else
-						{
-							// If we know we are missing a compile time function, we won't try to
-							// guess
-							if (log.compileTimeBuildReasons)
-								Logf("\tCannot build until %s is loaded\n",
-								       referenceStatus.name->contents.c_str());
-
-							referenceStatus.guessState = GuessState_WaitingForLoad;
-							canBuild = false;
-						}
-					}
-					else if (findIt->second.type == ObjectType_Function &&
-					         referenceStatus.guessState != GuessState_Resolved)
-					{
-						// A known Cakelisp function call
-						for (int i = 0; i < (int)referenceStatus.references.size(); ++i)
-						{
-							ObjectReference& reference = referenceStatus.references[i];
-							// Run function invocation on it
-							// TODO: Make invocation generator know it is a Cakelisp function
-							bool result = FunctionInvocationGenerator(
-							    environment, reference.context, *reference.tokens,
-							    reference.startIndex, *reference.spliceOutput);
-							// Our guess didn't even evaluate
-							if (!result)
-								canBuild = false;
-						}
-
-						referenceStatus.guessState = GuessState_Resolved;
-					}
-					// TODO: Building references to non-comptime functions at comptime
-				}
-				else
-				{
-					if (referenceStatus.guessState == GuessState_None)
-					{
-						if (log.compileTimeBuildReasons)
-							Logf("\tCannot build until %s is guessed. Guessing now\n",
-							       referenceStatus.name->contents.c_str());
-
-						// Find all the times the definition makes this reference
-						// We must use indices because the call to FunctionInvocationGenerator can
-						// add new references to the list
-						// Note that if new references are added to other functions, they need to be
-						// handled in the next pass
-						for (int i = 0; i < (int)referenceStatus.references.size(); ++i)
-						{
-							ObjectReference& reference = referenceStatus.references[i];
-							// Run function invocation on it
-							bool result = FunctionInvocationGenerator(
-							    environment, reference.context, *reference.tokens,
-							    reference.startIndex, *reference.spliceOutput);
-							// Our guess didn't even evaluate
-							if (!result)
-								canBuild = false;
-						}
-
-						referenceStatus.guessState = GuessState_Guessed;
-						hasRelevantChangeOccurred = true;
-						hasGuessedRefs = true;
-						guessMaybeDirtiedReferences = true;
-						requireDependencyPropagation = true;
-					}
-					else if (referenceStatus.guessState == GuessState_Guessed)
-					{
-						// It has been guessed, and still isn't in definitions
-						hasGuessedRefs = true;
-					}
-				}
-			}
-		} while (guessMaybeDirtiedReferences);
-
-		// hasRelevantChangeOccurred being false suppresses rebuilding compile-time functions which
-		// still have the same missing references. Note that only compile time objects can be built.
-		// We put normal functions through the guessing system too because they need their functions
-		// resolved as well. It's a bit dirty but not too bad
-		if (canBuild && (!hasGuessedRefs || hasRelevantChangeOccurred) &&
-		    isCompileTimeObject(definition.type))
-		{
-			BuildObject objectToBuild = {};
-			objectToBuild.buildId = getNextFreeBuildId(environment);
-			objectToBuild.definition = &definition;
-			objectToBuild.hasAnyRefs = hasAnyRefs;
+		BuildObject objectToBuild;
+		if (BuildCheckDefinition(environment, *definitionPointer, objectToBuild,
+		                         requireDependencyPropagation))
 			definitionsToBuild.push_back(objectToBuild);
-		}
 	}
 
 	if (log.compileTimeBuildObjects && !definitionsToBuild.empty())
@@ -1316,8 +2410,15 @@ bool BuildEvaluateReferences(EvaluatorEnvironment& environment, int& numErrorsOu
 		}
 	}
 
-	int numReferencesResolved =
-	    BuildExecuteCompileTimeFunctions(environment, definitionsToBuild, numErrorsOut);
+	int numReferencesResolved = BuildExecuteCompileTimeFunctions(
+	    environment, definitionsToBuild, numErrorsOut, requireDependencyPropagation);
+
+	// Unsuccessful builds should be tried again if anything changes
+	for (BuildObject& buildObject : definitionsToBuild)
+	{
+		if (!buildObject.definition->isLoaded)
+			QueueReferenceCheck(environment, *buildObject.definition);
+	}
 
 	return numReferencesResolved > 0 || requireDependencyPropagation;
 }
@@ -1339,6 +2440,13 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 		}
 	}
 
+	if (!environment.hasReadReferenceGuessCache)
+	{
+		environment.hasReadReferenceGuessCache = true;
+		if (environment.useCachedFiles)
+			readReferenceGuessCache(environment);
+	}
+
 	int numBuildResolveErrors = 0;
 	bool codeModified = false;
 	do
@@ -1360,6 +2468,27 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 			needsAnotherPass = BuildEvaluateReferences(environment, numBuildResolveErrors);
 			if (numBuildResolveErrors)
 				break;
+
+			// Nothing else can be built, so anything still waited on won't be defined this time.
+			// Guess them after all
+			if (!needsAnotherPass && !environment.definitionsWaitingOnCachedGuesses.empty())
+			{
+				environment.hasStoppedWaitingOnCachedGuesses = true;
+				for (const Symbol& definitionName : environment.definitionsWaitingOnCachedGuesses)
+				{
+					ObjectDefinition* definition = findObjectDefinition(environment, definitionName);
+					if (!definition || definition->isLoaded)
+						continue;
+
+					if (log.compileTimeBuildReasons)
+						Logf("%s will guess references which were defined last time, but not "
+						     "this time\n",
+						     definitionName.c_str());
+					QueueReferenceCheck(environment, *definition);
+					needsAnotherPass = true;
+				}
+				environment.definitionsWaitingOnCachedGuesses.clear();
+			}
 		} while (needsAnotherPass);
 
 		if (numBuildResolveErrors)
@@ -1374,8 +2503,17 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 		codeModified = false;
 		for (PostReferencesResolvedHook& hook : environment.postReferencesResolvedHooks)
 		{
+			InvocationProfileSample profileSample = {};
+			Symbol hookName;
+			if (environment.enableProfiling &&
+			    findCompileTimeFunctionName(environment, (void*)hook, hookName))
+				profileSample = profileInvocationBegin(environment, hookName,
+				                                       ObjectType_CompileTimeFunction);
+
 			bool codeModifiedByHook = false;
-			if (!hook(environment, codeModifiedByHook))
+			bool hookSucceeded = hook(environment, codeModifiedByHook);
+			profileInvocationEnd(environment, profileSample, /*numOutputTokens=*/0);
+			if (!hookSucceeded)
 			{
 				Log("error: hook returned failure\n");
 				numBuildResolveErrors += 1;
@@ -1396,10 +2534,14 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 	if (numBuildResolveErrors)
 		Logf("Failed with %d errors.\n", numBuildResolveErrors);
 
+	// Even a failed build teaches which guesses were wrong
+	if (environment.useCachedFiles)
+		updateWriteReferenceGuessCache(environment);
+
 	int errors = 0;
-	for (const ObjectDefinitionPair& definitionPair : environment.definitions)
+	for (ObjectDefinitionPair& definitionPair : environment.definitions)
 	{
-		const ObjectDefinition& definition = definitionPair.second;
+		ObjectDefinition& definition = definitionPair.second;
 
 		if (definition.isRequired)
 		{
@@ -1422,19 +2564,18 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 			{
 				// Check all references have been resolved for regular generated code
 				std::vector<const Token*> missingDefinitions;
-				for (const ObjectReferenceStatusPair& reference : definition.references)
+				for (ObjectReferenceStatusPair& reference : definition.references)
 				{
-					const ObjectReferenceStatus& referenceStatus = reference.second;
+					ObjectReferenceStatus& referenceStatus = reference.second;
 
-					// TODO: (Performance) Add shortcut in reference
-					ObjectDefinitionMap::iterator findIt =
-					    environment.definitions.find(referenceStatus.name->contents);
-					if (findIt != environment.definitions.end())
+					ObjectDefinition* referencedDefinition =
+					    findReferencedDefinition(environment, referenceStatus);
+					if (referencedDefinition)
 					{
-						if (isCompileTimeObject(findIt->second.type) &&
-						    !isCompileTimeCodeLoaded(environment, findIt->second))
+						if (isCompileTimeObject(referencedDefinition->type) &&
+						    !isCompileTimeCodeLoaded(environment, *referencedDefinition))
 						{
-							missingDefinitions.push_back(findIt->second.definitionInvocation);
+							missingDefinitions.push_back(referencedDefinition->definitionInvocation);
 							++errors;
 						}
 					}
@@ -1455,6 +2596,16 @@ bool EvaluateResolveReferences(EvaluatorEnvironment& environment)
 				}
 			}
 		}
+		else if (definition.type == ObjectType_Function)
+		{
+			// Unused module-local function. Its splice stays in the module output, but is empty
+			if (log.buildOmissions)
+				NoteAtTokenf(*definition.definitionInvocation,
+				             "did not generate %s (not used by anything required)",
+				             definition.name.c_str());
+			if (definition.output)
+				resetGeneratorOutput(*definition.output);
+		}
 		else
 		{
 			if (log.buildOmissions && isCompileTimeObject(definition.type))
@@ -1543,31 +2694,23 @@ void environmentDestroyInvalidateTokens(EvaluatorEnvironment& environment)
 	}
 	environment.compileTimeVariables.clear();
 
-	for (ObjectReferencePoolPair& referencePoolPair : environment.referencePools)
-	{
-		for (ObjectReference& reference : referencePoolPair.second.references)
-		{
-			delete reference.spliceOutput;
-		}
-		referencePoolPair.second.references.clear();
-	}
 	environment.referencePools.clear();
-
-	for (ObjectDefinitionPair& definitionPair : environment.definitions)
-	{
-		ObjectDefinition& definition = definitionPair.second;
-		delete definition.output;
-	}
 	environment.definitions.clear();
 
-	for (GeneratorOutput* output : environment.orphanedOutputs)
-	{
-		delete output;
-	}
-	environment.orphanedOutputs.clear();
+	for (GeneratorOutput* block : environment.outputPool.blocks)
+		delete[] block;
+	environment.outputPool.blocks.clear();
+	environment.outputPool.numUsedInLastBlock = 0;
+	environment.outputPool.text.clear();
+	environment.outputPool.text.shrink_to_fit();
+	if (s_textOutputPool == &environment.outputPool)
+		s_textOutputPool = nullptr;
 
 	for (const std::vector<Token>* comptimeTokens : environment.comptimeTokens)
+	{
+		releaseTokenIndex(*comptimeTokens);
 		delete comptimeTokens;
+	}
 	environment.comptimeTokens.clear();
 }
 
@@ -1615,6 +2758,61 @@ void resetGeneratorOutput(GeneratorOutput& output)
 	output.imports.clear();
 }
 
+GeneratorOutput* newGeneratorOutput(EvaluatorEnvironment& environment)
+{
+	// Most modules have hundreds of definitions and splices, so don't go to malloc for each one
+	static const int generatorOutputPoolBlockSize = 256;
+
+	GeneratorOutputPool& pool = environment.outputPool;
+	s_textOutputPool = &pool;
+	if (pool.blocks.empty() || pool.numUsedInLastBlock >= generatorOutputPoolBlockSize)
+	{
+		pool.blocks.push_back(new GeneratorOutput[generatorOutputPoolBlockSize]);
+		pool.numUsedInLastBlock = 0;
+	}
+
+	return &pool.blocks.back()[pool.numUsedInLastBlock++];
+}
+
+void stringOutputSetText(StringOutput& operation, const char* text, size_t length)
+{
+	operation.symbol = Symbol();
+	operation.textOffset = 0;
+	operation.textLength = 0;
+	if (!length)
+		return;
+
+	// Names are converted through the name conversion cache, which is keyed by symbol
+	bool isName = operation.modifiers & (StringOutMod_ConvertTypeName |
+	                                     StringOutMod_ConvertFunctionName |
+	                                     StringOutMod_ConvertVariableName);
+	if (isName || !s_textOutputPool)
+	{
+		operation.symbol.assign(text, length);
+		return;
+	}
+
+	std::string& poolText = s_textOutputPool->text;
+	operation.textOffset = (uint32_t)poolText.size();
+	operation.textLength = (uint32_t)length;
+	poolText.append(text, length);
+	poolText.push_back('\0');
+}
+
+const char* stringOutputGetText(const StringOutput& operation, size_t* lengthOut)
+{
+	if (!operation.textLength || !s_textOutputPool)
+	{
+		if (lengthOut)
+			*lengthOut = operation.symbol.size();
+		return operation.symbol.c_str();
+	}
+
+	if (lengthOut)
+		*lengthOut = operation.textLength;
+	return s_textOutputPool->text.data() + operation.textOffset;
+}
+
 bool canUseCachedFile(EvaluatorEnvironment& environment, const char* filename,
                       const char* reference)
 {
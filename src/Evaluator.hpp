@@ -1,12 +1,14 @@
 #pragma once
 
+#include "Converters.hpp"
 #include "EvaluatorEnums.hpp"
+#include "HashTable.hpp"
 #include "RunProcess.hpp"
+#include "Symbols.hpp"
 
 #include <string>
-#include <vector>
-// TODO: Replace with fast hash table
 #include <unordered_map>
+#include <vector>
 
 struct GeneratorOutput;
 struct ModuleManager;
@@ -18,15 +20,18 @@ struct Token;
 // output, store output operations instead. This also facilitates source <-> generated mapping data
 struct StringOutput
 {
-	// TODO: Putting this in a union means we need to write a destructor which can detect when to
-	// destroy output
-	// union {
-	std::string output;
-	GeneratorOutput* spliceOutput;
-	// };
-
+	// Operations don't own (or allocate) their text. Text which is already interned (e.g. token
+	// contents) or is a name to convert to C is the symbol. Any other text is copied into the
+	// environment's output pool, and is freed with it. Language tokens (e.g. OpenParen,
+	// EndStatement) and splices have no text; their modifiers are all the writer needs.
+	// Use stringOutputGetText() rather than reading these directly
+	Symbol symbol;
+	uint32_t textOffset;
+	uint32_t textLength;
 	StringOutputModifierFlags modifiers;
 
+	GeneratorOutput* spliceOutput;
+
 	// Used to correlate Cakelisp code with generated output code
 	const Token* startToken;
 };
@@ -73,6 +78,17 @@ struct GeneratorOutput
 // Add members to this as necessary
 void resetGeneratorOutput(GeneratorOutput& output);
 
+// Outputs are referred to by splices from all over, so it is never safe to free one output before
+// the rest. Instead, outputs are allocated in blocks which are all freed at once
+struct GeneratorOutputPool
+{
+	std::vector<GeneratorOutput*> blocks;
+	int numUsedInLastBlock;
+	// Null-terminated StringOutput text which isn't interned. Operations refer to it by offset, so
+	// it can grow without invalidating them
+	std::string text;
+};
+
 // This is frequently copied, so keep it small
 struct EvaluatorContext
 {
@@ -102,13 +118,14 @@ typedef bool (*MacroFunc)(EvaluatorEnvironment& environment, const EvaluatorCont
                           const std::vector<Token>& tokens, int startTokenIndex,
                           std::vector<Token>& output);
 
-// TODO: Replace with fast hash table implementation
-typedef std::unordered_map<std::string, MacroFunc> MacroTable;
-typedef std::unordered_map<std::string, GeneratorFunc> GeneratorTable;
+// Tables are keyed on interned Symbols, so lookups hash and compare integers rather than strings.
+// Strings and token contents convert to Symbol implicitly
+typedef HashTable<Symbol, MacroFunc, SymbolHash> MacroTable;
+typedef HashTable<Symbol, GeneratorFunc, SymbolHash> GeneratorTable;
 typedef MacroTable::iterator MacroIterator;
 typedef GeneratorTable::iterator GeneratorIterator;
 
-typedef std::unordered_map<std::string, const Token*> GeneratorLastReferenceTable;
+typedef std::unordered_map<Symbol, const Token*, SymbolHash> GeneratorLastReferenceTable;
 typedef GeneratorLastReferenceTable::iterator GeneratorLastReferenceTableIterator;
 
 struct ObjectReference
@@ -126,22 +143,43 @@ struct ObjectReference
 	bool isResolved;
 };
 
+struct ObjectDefinition;
+
 // TODO Need to add insertion points for later fixing
 struct ObjectReferenceStatus
 {
 	const Token* name;
+	// Shortcut to the referenced definition, so passes over references don't need to look it up
+	// each time. Use findReferencedDefinition() rather than reading these directly
+	ObjectDefinition* definition;
+	// The environment's numDefinitionsAdded when the definition was last looked up and not found.
+	// There's no point looking again until more definitions have been added
+	int numDefinitionsAddedAtMiss;
 	// We need to guess and check because we don't know what C/C++ functions might be available. The
 	// guessState keeps track of how successful the guess was, so we don't keep recompiling until
 	// some relevant change to our references has occurred
 	ObjectReferenceGuessState guessState;
+	// Whether the referenced object was unknown when the definition was checked for building. What
+	// these references turn out to be is kept in the reference guess cache
+	bool wasUnknownWhenChecked;
 
 	// In the case of multiple references to the same object in the same definition, keep track of
 	// all of them for guessing
 	std::vector<ObjectReference> references;
 };
 
-typedef std::unordered_map<std::string, ObjectReferenceStatus> ObjectReferenceStatusMap;
-typedef std::pair<const std::string, ObjectReferenceStatus> ObjectReferenceStatusPair;
+typedef std::unordered_map<Symbol, ObjectReferenceStatus, SymbolHash> ObjectReferenceStatusMap;
+typedef std::pair<const Symbol, ObjectReferenceStatus> ObjectReferenceStatusPair;
+
+// A definition referring to an object, which may not be defined (yet)
+struct ObjectReferenceEdge
+{
+	Symbol definitionName;
+	Symbol referencedName;
+};
+
+// Reverse edges: for each referenced name, the names of definitions which refer to it
+typedef HashTable<Symbol, std::vector<Symbol>, SymbolHash> ReferencingDefinitionsTable;
 
 struct MacroExpansion
 {
@@ -151,7 +189,7 @@ struct MacroExpansion
 
 struct ObjectDefinition
 {
-	std::string name;
+	Symbol name;
 	// The generator invocation that actually triggered the definition of this object
 	const Token* definitionInvocation;
 	ObjectType type;
@@ -164,9 +202,14 @@ struct ObjectDefinition
 	bool environmentRequired;
 	// If we learn this will always fail compilation, prevent it from continuously being recompiled
 	bool forbidBuild;
+	// Whether it is in EvaluatorEnvironment::definitionsToCheckReferences
+	bool isReferenceCheckQueued;
 
 	// Unique references, for dependency checking
 	ObjectReferenceStatusMap references;
+	// Module-local definitions this one uses which were already defined, so they were output
+	// directly rather than referenced. Only used to propagate required-ness
+	std::vector<Symbol> usedLocalDefinitions;
 
 	// Used to prepare the definition's expanded form, for post-macro-expansion code modification.
 	// EvaluatorEnvironment still handles deleting the tokens array the macro created. Note that
@@ -202,13 +245,14 @@ struct ObjectReferencePool
 };
 
 // NOTE: See comment in BuildEvaluateReferences() before changing this data structure. The current
-// implementation assumes references to values will not be invalidated if the hash map changes
-typedef std::unordered_map<std::string, ObjectDefinition> ObjectDefinitionMap;
-typedef std::pair<const std::string, ObjectDefinition> ObjectDefinitionPair;
-typedef std::unordered_map<std::string, ObjectReferencePool> ObjectReferencePoolMap;
-typedef std::pair<const std::string, ObjectReferencePool> ObjectReferencePoolPair;
-
-typedef std::unordered_map<std::string, void*> CompileTimeFunctionTable;
+// implementation assumes references to values will not be invalidated if the hash map changes,
+// which HashTable guarantees
+typedef HashTable<Symbol, ObjectDefinition, SymbolHash> ObjectDefinitionMap;
+typedef std::pair<const Symbol, ObjectDefinition> ObjectDefinitionPair;
+typedef HashTable<Symbol, ObjectReferencePool, SymbolHash> ObjectReferencePoolMap;
+typedef std::pair<const Symbol, ObjectReferencePool> ObjectReferencePoolPair;
+
+typedef HashTable<Symbol, void*, SymbolHash> CompileTimeFunctionTable;
 typedef CompileTimeFunctionTable::iterator CompileTimeFunctionTableIterator;
 
 struct CompileTimeFunctionMetadata
@@ -217,7 +261,7 @@ struct CompileTimeFunctionMetadata
 	const Token* startArgsToken;
 };
 
-typedef std::unordered_map<std::string, CompileTimeFunctionMetadata>
+typedef std::unordered_map<Symbol, CompileTimeFunctionMetadata, SymbolHash>
     CompileTimeFunctionMetadataTable;
 typedef CompileTimeFunctionMetadataTable::iterator CompileTimeFunctionMetadataTableIterator;
 
@@ -242,10 +286,52 @@ struct CompileTimeVariable
 	// pointer to the appropriate type to make sure destructor is called
 	std::string destroyCompileTimeFuncName;
 };
-typedef std::unordered_map<std::string, CompileTimeVariable> CompileTimeVariableTable;
+typedef HashTable<std::string, CompileTimeVariable> CompileTimeVariableTable;
 typedef CompileTimeVariableTable::iterator CompileTimeVariableTableIterator;
 typedef std::pair<const std::string, CompileTimeVariable> CompileTimeVariableTablePair;
 
+// Collected for each macro, generator, and compile-time function (hook) invoked while
+// EvaluatorEnvironment::enableProfiling. Invocations nest, e.g. a generator evaluating its
+// arguments invokes other generators, and a macro's time includes evaluating its output
+struct InvocationProfile
+{
+	ObjectType type;
+	int numInvocations;
+	// Includes time spent in nested invocations. Recursive invocations are only counted once
+	double inclusiveSeconds;
+	// Excludes time spent in nested invocations which were also profiled
+	double exclusiveSeconds;
+	// Tokens output by macros. For generators, the number of output operations (StringOutputs)
+	unsigned long numOutputTokens;
+
+	// Invocations of this which haven't finished yet, for detecting recursion
+	int numActiveInvocations;
+};
+typedef std::unordered_map<Symbol, InvocationProfile, SymbolHash> InvocationProfileTable;
+typedef std::pair<const Symbol, InvocationProfile> InvocationProfileTablePair;
+
+// Returned by profileInvocationBegin() to pass to profileInvocationEnd()
+struct InvocationProfileSample
+{
+	// Null if not profiling
+	InvocationProfile* profile;
+	double startSeconds;
+};
+
+// What a compile-time definition's unknown references turned out to be the last time it was
+// checked. Keyed by the definition's name, so each definition has at most one entry
+struct CachedReferenceGuesses
+{
+	// A CRC of the definition's tokens, so any change to the definition invalidates the entry
+	uint32_t definitionCrc;
+	// Defined by Cakelisp later (e.g. by a macro expansion), so guessing was wrong
+	std::vector<Symbol> definedReferences;
+	// Never defined, and the definition built, so guessing they were C/C++ functions was right
+	std::vector<Symbol> externalReferences;
+};
+typedef std::unordered_map<std::string, CachedReferenceGuesses> ReferenceGuessCache;
+typedef std::pair<const std::string, CachedReferenceGuesses> ReferenceGuessCachePair;
+
 typedef std::unordered_map<std::string, const char*> RequiredCompileTimeFunctionReasonsTable;
 typedef RequiredCompileTimeFunctionReasonsTable::iterator
     RequiredCompileTimeFunctionReasonsTableIterator;
@@ -277,13 +363,34 @@ struct EvaluatorEnvironment
 	// contents, however
 	std::vector<const std::vector<Token>*> comptimeTokens;
 
-	// When a definition is replaced (e.g. by ReplaceAndEvaluateDefinition()), the original
-	// definition's output is still used, but no longer has a definition to keep track of it. We'll
-	// make sure the orphans get destroyed
-	std::vector<GeneratorOutput*> orphanedOutputs;
+	// Owns every definition, splice, and module output. Use newGeneratorOutput() rather than new
+	GeneratorOutputPool outputPool;
 
 	ObjectDefinitionMap definitions;
 	ObjectReferencePoolMap referencePools;
+	// Incremented whenever a definition is added, so references know when to look for theirs again
+	int numDefinitionsAdded;
+
+	// Required-ness is propagated incrementally (see PropagateRequiredToReferences()), so these
+	// track what changed since the last propagation
+	ReferencingDefinitionsTable referencingDefinitions;
+	std::vector<Symbol> definitionsToPropagate;
+	std::vector<ObjectReferenceEdge> referencesToPropagate;
+	// Definitions whose references or referenced definitions changed since BuildEvaluateReferences()
+	// last checked them. Nothing else could have become buildable
+	std::vector<Symbol> definitionsToCheckReferences;
+
+	// Read from the previous run (unless !useCachedFiles), then updated and written by
+	// EvaluateResolveReferences(). Only a hint: references it says will be defined are waited for
+	// instead of guessed, until nothing else can be built
+	ReferenceGuessCache referenceGuessCache;
+	bool hasReadReferenceGuessCache;
+	// Definitions which couldn't build because they were waiting on the reference guess cache
+	std::vector<Symbol> definitionsWaitingOnCachedGuesses;
+	bool hasStoppedWaitingOnCachedGuesses;
+
+	// Shared by the compile-time and runtime writers, so each name is converted to C only once
+	NameConversionCache nameConversionCache;
 
 	// Used to ensure unique filenames for compile-time artifacts
 	int nextFreeBuildId;
@@ -304,6 +411,30 @@ struct EvaluatorEnvironment
 	// the source file hasn't been modified more recently)
 	bool useCachedFiles;
 
+	// Whether to compile and link all compile-time objects which have no guessed references in a
+	// single translation unit and library per build pass, rather than one per definition. This
+	// saves paying compiler startup and header parsing costs for each definition
+	bool batchCompileTimeBuilds;
+
+	// Whether to feed generated compile-time source to the compiler's stdin rather than writing
+	// it to a file first. Requires a compiler which accepts "-x c++ -" (e.g. GCC or Clang)
+	bool pipeCompileTimeSource;
+
+	// Whether to precompile the headers every compile-time object includes, so that each object
+	// doesn't need to parse them again. The precompiled header is kept in the cache
+	bool usePrecompiledHeaders;
+	// Once the precompiled header is ready, compile-time objects are built with this prelude
+	// header force-included. Empty if there is no precompiled header
+	std::string compileTimePreludeHeader;
+	bool hasPreparedCompileTimePrelude;
+
+	// Whether to record how often and how long each macro, generator and compile-time function is
+	// invoked. Compile-time code may read invocationProfiles at any time
+	bool enableProfiling;
+	InvocationProfileTable invocationProfiles;
+	// Time spent in nested invocations, for each invocation currently being profiled
+	std::vector<double> profileNestedSecondsStack;
+
 	// Added as a search directory for compile time code execution
 	std::string cakelispSrcDir;
 
@@ -352,6 +483,15 @@ struct EvaluatorEnvironment
 // tokens. Essentially, call this as late as possible
 void environmentDestroyInvalidateTokens(EvaluatorEnvironment& environment);
 
+// The output will be valid until environmentDestroyInvalidateTokens(). Do not delete it
+GeneratorOutput* newGeneratorOutput(EvaluatorEnvironment& environment);
+// Names to convert are interned (see StringOutput). Any other text is copied into the output pool
+// of the environment being evaluated
+void stringOutputSetText(StringOutput& operation, const char* text, size_t length);
+// Returns the operation's null-terminated text, which is empty for language tokens and splices.
+// lengthOut may be null
+const char* stringOutputGetText(const StringOutput& operation, size_t* lengthOut);
+
 int EvaluateGenerate_Recursive(EvaluatorEnvironment& environment, const EvaluatorContext& context,
                                const std::vector<Token>& tokens, int startTokenIndex,
                                GeneratorOutput& output);
@@ -376,10 +516,22 @@ bool addObjectDefinition(EvaluatorEnvironment& environment, ObjectDefinition& de
 const ObjectReferenceStatus* addObjectReference(EvaluatorEnvironment& environment,
                                                 const Token& referenceNameToken,
                                                 ObjectReference& reference);
-
+// Module-local functions are only output if something required uses them. Call this wherever a
+// name which could be one is output without adding a reference
+void addObjectLocalUse(EvaluatorEnvironment& environment, const EvaluatorContext& context,
+                       const Token& usedNameToken);
+
+// Pass Symbols (e.g. token contents) where possible. Strings work too, but must be interned first
+GeneratorFunc findGenerator(EvaluatorEnvironment& environment, const Symbol& functionName);
+void* findCompileTimeFunction(EvaluatorEnvironment& environment, const Symbol& functionName);
+ObjectDefinition* findObjectDefinition(EvaluatorEnvironment& environment, const Symbol& name);
+// Names which were never interned can't have been defined, so these don't intern them
 GeneratorFunc findGenerator(EvaluatorEnvironment& environment, const char* functionName);
 void* findCompileTimeFunction(EvaluatorEnvironment& environment, const char* functionName);
 ObjectDefinition* findObjectDefinition(EvaluatorEnvironment& environment, const char* name);
+// Returns null if the referenced object has not been defined (e.g. it is a C function)
+ObjectDefinition* findReferencedDefinition(EvaluatorEnvironment& environment,
+                                           ObjectReferenceStatus& referenceStatus);
 
 // These must take type as string in order to be address agnostic, making caching possible
 // destroyFunc is necessary for any C++ type with a destructor. If nullptr, free() is used
@@ -397,6 +549,20 @@ bool canUseCachedFile(EvaluatorEnvironment& environment, const char* filename,
 
 const char* objectTypeToString(ObjectType type);
 
+// Each begin must be matched by an end. Both do nothing unless environment.enableProfiling
+InvocationProfileSample profileInvocationBegin(EvaluatorEnvironment& environment,
+                                               const Symbol& name, ObjectType type);
+void profileInvocationEnd(EvaluatorEnvironment& environment, InvocationProfileSample& sample,
+                          unsigned long numOutputTokens);
+// Hooks are only stored as function pointers, so their names must be looked up before profiling.
+// Returns false if no compile-time function by that address is loaded
+bool findCompileTimeFunctionName(EvaluatorEnvironment& environment, void* function,
+                                 Symbol& nameOut);
+// Sorted by exclusive time, most expensive first
+void printInvocationProfiles(EvaluatorEnvironment& environment);
+// Writes one tab-separated line per profile, after a header line naming the columns
+bool writeInvocationProfiles(EvaluatorEnvironment& environment, const char* filename);
+
 // shortPath can be "Example.cake" or e.g. "../tests/Example.cake"
 // encounteredInFile becomes an automatic relative search path
 // Returns false if the file does not exist in any of the paths searched
@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <atomic>
+
 #include "Logging.hpp"
 #include "Utilities.hpp"
 
@@ -11,8 +13,12 @@
 #include <fcntl.h>
 #include <libgen.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#elif WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
 #else
 #error Need to implement file utilities for this platform
 #endif
@@ -296,6 +302,29 @@ bool moveFile(const char* srcFilename, const char* destFilename)
 	return true;
 }
 
+void makeUniqueTemporaryFilename(const char* filename, char* bufferOut, int bufferSize)
+{
+	// Threads within this process may be writing temporary files at the same time
+	static std::atomic<unsigned int> s_numTemporaryFilenames(0);
+#ifdef UNIX
+	unsigned long processId = (unsigned long)getpid();
+#elif WINDOWS
+	unsigned long processId = (unsigned long)GetCurrentProcessId();
+#endif
+	SafeSnprinf(bufferOut, bufferSize, "%s.%lu.%u.temp", filename, processId,
+	            s_numTemporaryFilenames++);
+}
+
+bool replaceFile(const char* srcFilename, const char* destFilename)
+{
+#ifdef UNIX
+	return rename(srcFilename, destFilename) == 0;
+#elif WINDOWS
+	// rename() fails if the destination exists on Windows
+	return MoveFileExA(srcFilename, destFilename, MOVEFILE_REPLACE_EXISTING) != 0;
+#endif
+}
+
 void addExecutablePermission(const char* filename)
 {
 #ifdef UNIX
@@ -317,3 +346,107 @@ void addExecutablePermission(const char* filename)
 	}
 #endif
 }
+
+bool fileMapReadOnly(const char* filename, const char** contentsOut, unsigned long* sizeOut)
+{
+	*contentsOut = nullptr;
+	*sizeOut = 0;
+#ifdef UNIX
+	int fileDescriptor = open(filename, O_RDONLY);
+	if (fileDescriptor == -1)
+	{
+		Logf("error: Could not open %s\n", filename);
+		return false;
+	}
+	else if (log.fileSystem)
+		Logf("Opened %s\n", filename);
+
+	struct stat fileStat;
+	if (fstat(fileDescriptor, &fileStat) == -1)
+	{
+		perror("fileMapReadOnly: ");
+		close(fileDescriptor);
+		return false;
+	}
+
+	// mmap() refuses zero-length mappings. An empty file is still a successful read
+	if (fileStat.st_size == 0)
+	{
+		close(fileDescriptor);
+		return true;
+	}
+
+	void* contents = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+	// The mapping holds its own reference to the file
+	close(fileDescriptor);
+	if (contents == MAP_FAILED)
+	{
+		perror("fileMapReadOnly: ");
+		return false;
+	}
+
+	*contentsOut = (const char*)contents;
+	*sizeOut = (unsigned long)fileStat.st_size;
+	return true;
+#elif WINDOWS
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+	                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		Logf("error: Could not open %s\n", filename);
+		return false;
+	}
+	else if (log.fileSystem)
+		Logf("Opened %s\n", filename);
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		Logf("fileMapReadOnly: GetFileSizeEx() failed with error %lu\n", GetLastError());
+		CloseHandle(file);
+		return false;
+	}
+
+	// CreateFileMapping() refuses zero-length mappings. An empty file is still a successful read
+	if (fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return true;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	// The mapping holds its own reference to the file
+	CloseHandle(file);
+	if (!mapping)
+	{
+		Logf("fileMapReadOnly: CreateFileMapping() failed with error %lu\n", GetLastError());
+		return false;
+	}
+
+	// Likewise, the view holds its own reference to the mapping
+	void* contents = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!contents)
+	{
+		Logf("fileMapReadOnly: MapViewOfFile() failed with error %lu\n", GetLastError());
+		return false;
+	}
+
+	*contentsOut = (const char*)contents;
+	*sizeOut = (unsigned long)fileSize.QuadPart;
+	return true;
+#endif
+}
+
+void fileUnmap(const char* contents, unsigned long size)
+{
+	if (!contents)
+		return;
+#ifdef UNIX
+	if (munmap((void*)contents, size) == -1)
+		perror("fileUnmap: ");
+#elif WINDOWS
+	if (!UnmapViewOfFile(contents))
+		Logf("fileUnmap: UnmapViewOfFile() failed with error %lu\n", GetLastError());
+#endif
+}
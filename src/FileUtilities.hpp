@@ -34,4 +34,17 @@ bool copyFileTo(const char* srcFilename, const char* destFilename);
 // Non-binary files only
 bool moveFile(const char* srcFilename, const char* destFilename);
 
+// Sets bufferOut to a filename next to filename which no other process (or call) will use. Write
+// to it, then replaceFile() it over filename, so other processes never see a partially written file
+void makeUniqueTemporaryFilename(const char* filename, char* bufferOut, int bufferSize);
+
+// Renames srcFilename to destFilename, replacing destFilename if it exists. Unlike moveFile(), the
+// contents are not copied, so readers see either the old file or the new one
+bool replaceFile(const char* srcFilename, const char* destFilename);
+
 void addExecutablePermission(const char* filename);
+
+// Maps the entire file into memory. The contents are not null-terminated; use sizeOut instead.
+// Empty files succeed with a null contentsOut. Use fileUnmap() on the contents when done
+bool fileMapReadOnly(const char* filename, const char** contentsOut, unsigned long* sizeOut);
+void fileUnmap(const char* contents, unsigned long size);
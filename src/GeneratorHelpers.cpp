@@ -1,5 +1,8 @@
 #include "GeneratorHelpers.hpp"
 
+#include <assert.h>
+#include <string.h>
+
 #include "Evaluator.hpp"
 #include "Tokenizer.hpp"
 #include "Utilities.hpp"
@@ -16,10 +19,17 @@ void StripInvocation(int& startTokenIndex, int& endTokenIndex)
 }
 
 // Note that the tokenizer should've already confirmed our parenthesis match, so we won't do
-// validation here
+// validation here. Validated token arrays already know their matches; anything else (e.g. tokens a
+// macro is still building) is scanned
 int FindCloseParenTokenIndex(const std::vector<Token>& tokens, int startTokenIndex)
 {
-	if (tokens[startTokenIndex].type != TokenType_OpenParen)
+	if (tokens[startTokenIndex].type == TokenType_OpenParen)
+	{
+		int closeParenIndex = findMatchingParenthesis(tokens, startTokenIndex);
+		if (closeParenIndex != -1)
+			return closeParenIndex;
+	}
+	else
 		Log("Warning: FindCloseParenTokenIndex() expects to start on the opening parenthesis\n");
 
 	int depth = 0;
@@ -104,11 +114,34 @@ bool isSpecialSymbol(const Token& token)
 	}
 }
 
-// This function would be simpler and faster if there was an actual syntax tree, because we wouldn't
-// be repeatedly traversing all the arguments
+// Module and macro expansion tokens are indexed (see validateAndIndexParentheses()), so whole
+// invocations (the usual case) don't need to be walked. Any other token array is scanned instead.
+// Returns -1 if the range isn't an indexed list, otherwise its number of arguments
+static int getIndexedArguments(const std::vector<Token>& tokens, int startTokenIndex,
+                               int endTokenIndex, const int** argumentStartIndicesOut)
+{
+	if (tokens[startTokenIndex].type != TokenType_OpenParen ||
+	    findMatchingParenthesis(tokens, startTokenIndex) != endTokenIndex)
+		return -1;
+	int numArguments = getListChildren(tokens, startTokenIndex, argumentStartIndicesOut);
+	// The index was built from these exact tokens, so disagreeing with them is a bug in indexing
+	assert(numArguments <= 0 || (*argumentStartIndicesOut)[0] == startTokenIndex + 1);
+	return numArguments;
+}
+
 int getArgument(const std::vector<Token>& tokens, int startTokenIndex, int desiredArgumentIndex,
                 int endTokenIndex)
 {
+	const int* argumentStartIndices = nullptr;
+	int numIndexedArguments =
+	    getIndexedArguments(tokens, startTokenIndex, endTokenIndex, &argumentStartIndices);
+	if (numIndexedArguments != -1)
+	{
+		if (desiredArgumentIndex < 0 || desiredArgumentIndex >= numIndexedArguments)
+			return -1;
+		return argumentStartIndices[desiredArgumentIndex];
+	}
+
 	int currentArgumentIndex = 0;
 	for (int i = startTokenIndex + 1; i < endTokenIndex; ++i)
 	{
@@ -141,6 +174,12 @@ int getExpectedArgument(const char* message, const std::vector<Token>& tokens, i
 
 int getNumArguments(const std::vector<Token>& tokens, int startTokenIndex, int endTokenIndex)
 {
+	const int* argumentStartIndices = nullptr;
+	int numIndexedArguments =
+	    getIndexedArguments(tokens, startTokenIndex, endTokenIndex, &argumentStartIndices);
+	if (numIndexedArguments != -1)
+		return numIndexedArguments;
+
 	int currentArgumentIndex = 0;
 	for (int i = startTokenIndex + 1; i < endTokenIndex; ++i)
 	{
@@ -172,18 +211,19 @@ bool ExpectNumArguments(const std::vector<Token>& tokens, int startTokenIndex, i
 
 bool isLastArgument(const std::vector<Token>& tokens, int startTokenIndex, int endTokenIndex)
 {
-	if (tokens[startTokenIndex].type == TokenType_OpenParen &&
-	    FindCloseParenTokenIndex(tokens, startTokenIndex) + 1 < endTokenIndex)
-		return false;
-	else if (tokens[startTokenIndex].type == TokenType_Symbol &&
-	         startTokenIndex + 1 < endTokenIndex)
-		return false;
-	return true;
+	TokenType type = tokens[startTokenIndex].type;
+	if (type != TokenType_OpenParen && type != TokenType_Symbol)
+		return true;
+	return getNextArgument(tokens, startTokenIndex, endTokenIndex) >= endTokenIndex;
 }
 
 int getNextArgument(const std::vector<Token>& tokens, int currentTokenIndex, int endArrayTokenIndex)
 {
-	int nextArgStart = currentTokenIndex;
+	int nextArgStart = findNextSibling(tokens, currentTokenIndex);
+	if (nextArgStart != -1)
+		return nextArgStart;
+
+	nextArgStart = currentTokenIndex;
 	if (tokens[currentTokenIndex].type == TokenType_OpenParen)
 		nextArgStart = FindCloseParenTokenIndex(tokens, currentTokenIndex);
 
@@ -225,7 +265,7 @@ void MakeContextUniqueSymbolName(EvaluatorEnvironment& environment, const Evalua
 	}
 
 	ObjectDefinition* definition =
-	    findObjectDefinition(environment, context.definitionName->contents.c_str());
+	    findObjectDefinition(environment, context.definitionName->contents);
 	if (!definition)
 	{
 		MakeUniqueSymbolName(environment, prefix, tokenToChange);
@@ -375,6 +415,18 @@ void addModifierToStringOutput(StringOutput& operation, StringOutputModifierFlag
 	operation.modifiers = (StringOutputModifierFlags)((int)operation.modifiers | (int)flag);
 }
 
+void addStringOutput(std::vector<StringOutput>& output, const Symbol& symbol,
+                     StringOutputModifierFlags modifiers, const Token* startToken)
+{
+	StringOutput newStringOutput = {};
+	newStringOutput.modifiers = modifiers;
+	newStringOutput.startToken = startToken;
+
+	newStringOutput.symbol = symbol;
+
+	output.push_back(newStringOutput);
+}
+
 void addStringOutput(std::vector<StringOutput>& output, const std::string& symbol,
                      StringOutputModifierFlags modifiers, const Token* startToken)
 {
@@ -382,9 +434,21 @@ void addStringOutput(std::vector<StringOutput>& output, const std::string& symbo
 	newStringOutput.modifiers = modifiers;
 	newStringOutput.startToken = startToken;
 
-	newStringOutput.output = symbol;
+	stringOutputSetText(newStringOutput, symbol.c_str(), symbol.size());
+
+	output.push_back(newStringOutput);
+}
+
+void addStringOutput(std::vector<StringOutput>& output, const char* symbol,
+                     StringOutputModifierFlags modifiers, const Token* startToken)
+{
+	StringOutput newStringOutput = {};
+	newStringOutput.modifiers = modifiers;
+	newStringOutput.startToken = startToken;
+
+	stringOutputSetText(newStringOutput, symbol, strlen(symbol));
 
-	output.push_back(std::move(newStringOutput));
+	output.push_back(newStringOutput);
 }
 
 void addLangTokenOutput(std::vector<StringOutput>& output, StringOutputModifierFlags modifiers,
@@ -394,7 +458,7 @@ void addLangTokenOutput(std::vector<StringOutput>& output, StringOutputModifierF
 	newStringOutput.modifiers = modifiers;
 	newStringOutput.startToken = startToken;
 
-	output.push_back(std::move(newStringOutput));
+	output.push_back(newStringOutput);
 }
 
 void addSpliceOutput(GeneratorOutput& output, GeneratorOutput* spliceOutput,
@@ -409,8 +473,8 @@ void addSpliceOutput(GeneratorOutput& output, GeneratorOutput* spliceOutput,
 
 	// Splice marker must be pushed to both source and header to preserve ordering in case
 	// spliceOutput has both source and header outputs
-	output.source.push_back(std::move(newStringOutput));
-	output.header.push_back(std::move(newStringOutput));
+	output.source.push_back(newStringOutput);
+	output.header.push_back(newStringOutput);
 }
 
 //
@@ -818,8 +882,10 @@ bool CompileTimeFunctionSignatureMatches(EvaluatorEnvironment& environment, cons
                                          const char* compileTimeFunctionName,
                                          const std::vector<Token>& expectedSignature)
 {
-	CompileTimeFunctionMetadataTableIterator findIt =
-	    environment.compileTimeFunctionInfo.find(compileTimeFunctionName);
+	Symbol compileTimeFunctionSymbol;
+	CompileTimeFunctionMetadataTableIterator findIt = environment.compileTimeFunctionInfo.end();
+	if (symbolFind(compileTimeFunctionName, &compileTimeFunctionSymbol))
+		findIt = environment.compileTimeFunctionInfo.find(compileTimeFunctionSymbol);
 	if (findIt == environment.compileTimeFunctionInfo.end())
 	{
 		ErrorAtToken(errorToken,
@@ -905,9 +971,10 @@ bool CStatementOutput(EvaluatorEnvironment& environment, const EvaluatorContext&
 				EvaluatorContext bodyContext = context;
 				bodyContext.scope = EvaluatorScope_ExpressionsOnly;
 				StringOutput spliceDelimiterTemplate = {};
-				spliceDelimiterTemplate.output = operation[i].keywordOrSymbol;
 				addModifierToStringOutput(spliceDelimiterTemplate, StringOutMod_SpaceBefore);
 				addModifierToStringOutput(spliceDelimiterTemplate, StringOutMod_SpaceAfter);
+				stringOutputSetText(spliceDelimiterTemplate, operation[i].keywordOrSymbol,
+				                    strlen(operation[i].keywordOrSymbol));
 				bodyContext.delimiterTemplate = spliceDelimiterTemplate;
 				int numErrors = EvaluateGenerateAll_Recursive(environment, bodyContext, tokens,
 				                                              startSpliceListIndex, output);
@@ -6,6 +6,7 @@
 #include "EvaluatorEnums.hpp"
 #include "TokenEnums.hpp"
 #include "GeneratorHelpersEnums.hpp"
+#include "Symbols.hpp"
 
 struct Token;
 struct EvaluatorContext;
@@ -77,8 +78,13 @@ void PushBackTokenExpression(std::vector<Token>& output, const Token* startToken
 
 void addModifierToStringOutput(StringOutput& operation, StringOutputModifierFlags flag);
 
+// Prefer passing Symbols (e.g. token contents) where they exist, because other text is copied
+void addStringOutput(std::vector<StringOutput>& output, const Symbol& symbol,
+                     StringOutputModifierFlags modifiers, const Token* startToken);
 void addStringOutput(std::vector<StringOutput>& output, const std::string& symbol,
                      StringOutputModifierFlags modifiers, const Token* startToken);
+void addStringOutput(std::vector<StringOutput>& output, const char* symbol,
+                     StringOutputModifierFlags modifiers, const Token* startToken);
 void addLangTokenOutput(std::vector<StringOutput>& output, StringOutputModifierFlags modifiers,
                         const Token* startToken);
 // Splice marker must be pushed to both source and header to preserve ordering in case spliceOutput
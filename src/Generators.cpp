@@ -305,7 +305,7 @@ bool AddCompileTimeHookGenerator(EvaluatorEnvironment& environment, const Evalua
 		return false;
 
 	void* hookFunction =
-	    findCompileTimeFunction(environment, tokens[functionNameIndex].contents.c_str());
+	    findCompileTimeFunction(environment, tokens[functionNameIndex].contents);
 	if (hookFunction)
 	{
 		const Token& hookName = tokens[hookNameIndex];
@@ -406,7 +406,7 @@ bool AddCompileTimeHookGenerator(EvaluatorEnvironment& environment, const Evalua
 		newReference.startIndex = startTokenIndex;
 		newReference.context = context;
 		// We don't need to splice, we need to set the variable. Create it anyways
-		newReference.spliceOutput = new GeneratorOutput;
+		newReference.spliceOutput = newGeneratorOutput(environment);
 
 		const ObjectReferenceStatus* referenceStatus =
 		    addObjectReference(environment, tokens[functionNameIndex], newReference);
@@ -963,7 +963,7 @@ bool DefunGenerator(EvaluatorEnvironment& environment, const EvaluatorContext& c
 
 	// In order to support function definition modification, even runtime functions must have
 	// spliced output, because we might be completely changing the definition
-	GeneratorOutput* functionOutput = new GeneratorOutput;
+	GeneratorOutput* functionOutput = newGeneratorOutput(environment);
 
 	// Register definition before evaluating body, otherwise references in body will be orphaned
 	{
@@ -971,16 +971,13 @@ bool DefunGenerator(EvaluatorEnvironment& environment, const EvaluatorContext& c
 		newFunctionDef.definitionInvocation = &tokens[startTokenIndex];
 		newFunctionDef.name = nameToken.contents.c_str();
 		newFunctionDef.type = isCompileTime ? ObjectType_CompileTimeFunction : ObjectType_Function;
-		// Compile-time objects only get built with compile-time references
-		newFunctionDef.isRequired = isCompileTime ? false : context.isRequired;
+		// Compile-time objects only get built with compile-time references. Module-local functions
+		// are left out unless something uses them
+		newFunctionDef.isRequired = (isCompileTime || isModuleLocal) ? false : context.isRequired;
 		newFunctionDef.context = context;
 		newFunctionDef.output = functionOutput;
 		if (!addObjectDefinition(environment, newFunctionDef))
-		{
-			delete functionOutput;
 			return false;
-		}
-		// Past this point, compile-time output will be handled by environment destruction
 
 		// Regardless of how much the definition is modified, it will still be output at this place
 		// in the module's generated file. Compile-time functions don't splice into module because
@@ -993,7 +990,7 @@ bool DefunGenerator(EvaluatorEnvironment& environment, const EvaluatorContext& c
 			CompileTimeFunctionMetadata newMetadata = {};
 			newMetadata.nameToken = &nameToken;
 			newMetadata.startArgsToken = &argsStart;
-			environment.compileTimeFunctionInfo[nameToken.contents.c_str()] = newMetadata;
+			environment.compileTimeFunctionInfo[nameToken.contents] = newMetadata;
 		}
 	}
 
@@ -1067,7 +1064,6 @@ bool DefunGenerator(EvaluatorEnvironment& environment, const EvaluatorContext& c
 	                                              *functionOutput);
 	if (numErrors)
 	{
-		// Don't delete compile time function output. Evaluate may have caused references to it
 		return false;
 	}
 
@@ -1159,6 +1155,7 @@ bool FunctionInvocationGenerator(EvaluatorEnvironment& environment, const Evalua
 	addStringOutput(output.source, funcNameToken.contents, StringOutMod_ConvertFunctionName,
 	                &funcNameToken);
 	addLangTokenOutput(output.source, StringOutMod_OpenParen, &funcNameToken);
+	addObjectLocalUse(environment, context, funcNameToken);
 
 	// Arguments
 	int startArgsIndex = nameTokenIndex + 1;
@@ -1234,7 +1231,7 @@ bool VariableDeclarationGenerator(EvaluatorEnvironment& environment,
 	// For now, don't bother with variables in functions
 	if (context.scope == EvaluatorScope_Module)
 	{
-		variableOutput = new GeneratorOutput;
+		variableOutput = newGeneratorOutput(environment);
 		{
 			ObjectDefinition newVariableDef = {};
 			newVariableDef.definitionInvocation = &tokens[startTokenIndex];
@@ -1245,11 +1242,7 @@ bool VariableDeclarationGenerator(EvaluatorEnvironment& environment,
 			newVariableDef.context = context;
 			newVariableDef.output = variableOutput;
 			if (!addObjectDefinition(environment, newVariableDef))
-			{
-				delete variableOutput;
 				return false;
-			}
-			// Past this point, output will be handled by environment destruction
 
 			// Regardless of how much the definition is modified, it will still be output at this
 			// place in the module's generated file
@@ -1420,7 +1413,8 @@ static ComptimeTokenArgContainedType ComptimeParseTokenArgumentType(const Token&
 // A domain-specific language for easily extracting and validating tokens from token array
 // Comptime functions have hard-coded signatures, so "arguments" are actually extracted in the body
 // Wow, this is brutal. Great feature, ugly implementation
-static bool ComptimeGenerateTokenArguments(const std::vector<Token>& tokens, int startArgsIndex,
+static bool ComptimeGenerateTokenArguments(EvaluatorEnvironment& environment,
+                                           const std::vector<Token>& tokens, int startArgsIndex,
                                            GeneratorOutput& output)
 {
 	if (!ExpectTokenType("token arguments", tokens[startArgsIndex], TokenType_OpenParen))
@@ -1539,9 +1533,11 @@ static bool ComptimeGenerateTokenArguments(const std::vector<Token>& tokens, int
 			}
 
 			NameStyleSettings nameStyle;
-			char convertedName[MAX_NAME_LENGTH] = {0};
-			lispNameStyleToCNameStyle(nameStyle.variableNameMode, argument.name->contents.c_str(),
-			                          convertedName, sizeof(convertedName), *argument.name);
+			const char* convertedName =
+			    lispNameStyleToCNameStyleCached(environment.nameConversionCache,
+			                                    nameStyle.variableNameMode,
+			                                    argument.name->contents, *argument.name)
+			        .c_str();
 
 #define OutputIndexName()                                                                \
 	{                                                                                    \
@@ -1737,7 +1733,7 @@ bool DefMacroGenerator(EvaluatorEnvironment& environment, const EvaluatorContext
 	if (!ExpectTokenType("defmacro", nameToken, TokenType_Symbol))
 		return false;
 
-	if (findGenerator(environment, nameToken.contents.c_str()))
+	if (findGenerator(environment, nameToken.contents))
 	{
 		ErrorAtToken(nameToken,
 		             "a generator by this name is defined. Generators always take precedence");
@@ -1752,8 +1748,7 @@ bool DefMacroGenerator(EvaluatorEnvironment& environment, const EvaluatorContext
 	if (!ExpectTokenType("defmacro", argsStart, TokenType_OpenParen))
 		return false;
 
-	// Will be cleaned up when the environment is destroyed
-	GeneratorOutput* compTimeOutput = new GeneratorOutput;
+	GeneratorOutput* compTimeOutput = newGeneratorOutput(environment);
 
 	ObjectDefinition newMacroDef = {};
 	newMacroDef.definitionInvocation = &tokens[startTokenIndex];
@@ -1764,10 +1759,7 @@ bool DefMacroGenerator(EvaluatorEnvironment& environment, const EvaluatorContext
 	newMacroDef.context = context;
 	newMacroDef.output = compTimeOutput;
 	if (!addObjectDefinition(environment, newMacroDef))
-	{
-		delete compTimeOutput;
 		return false;
-	}
 
 	// TODO: It would be nice to support global vs. local macros
 	// This only really needs to be an environment distinction, not a code output distinction
@@ -1796,7 +1788,7 @@ bool DefMacroGenerator(EvaluatorEnvironment& environment, const EvaluatorContext
 	int startBodyIndex = endArgsIndex + 1;
 	addLangTokenOutput(compTimeOutput->source, StringOutMod_OpenBlock, &tokens[startBodyIndex]);
 
-	if (!ComptimeGenerateTokenArguments(tokens, argsIndex, *compTimeOutput))
+	if (!ComptimeGenerateTokenArguments(environment, tokens, argsIndex, *compTimeOutput))
 		return false;
 
 	// Evaluate our body!
@@ -1845,8 +1837,7 @@ bool DefGeneratorGenerator(EvaluatorEnvironment& environment, const EvaluatorCon
 	if (!ExpectTokenType("defgenerator", argsStart, TokenType_OpenParen))
 		return false;
 
-	// Will be cleaned up when the environment is destroyed
-	GeneratorOutput* compTimeOutput = new GeneratorOutput;
+	GeneratorOutput* compTimeOutput = newGeneratorOutput(environment);
 
 	ObjectDefinition newGeneratorDef = {};
 	newGeneratorDef.definitionInvocation = &tokens[startTokenIndex];
@@ -1857,10 +1848,7 @@ bool DefGeneratorGenerator(EvaluatorEnvironment& environment, const EvaluatorCon
 	newGeneratorDef.context = context;
 	newGeneratorDef.output = compTimeOutput;
 	if (!addObjectDefinition(environment, newGeneratorDef))
-	{
-		delete compTimeOutput;
 		return false;
-	}
 
 	// TODO: It would be nice to support global vs. local generators
 	// This only really needs to be an environment distinction, not a code output distinction
@@ -1889,7 +1877,7 @@ bool DefGeneratorGenerator(EvaluatorEnvironment& environment, const EvaluatorCon
 	int startBodyIndex = endArgsIndex + 1;
 	addLangTokenOutput(compTimeOutput->source, StringOutMod_OpenBlock, &tokens[startBodyIndex]);
 
-	if (!ComptimeGenerateTokenArguments(tokens, argsIndex, *compTimeOutput))
+	if (!ComptimeGenerateTokenArguments(environment, tokens, argsIndex, *compTimeOutput))
 		return false;
 
 	// Evaluate our body!
@@ -2729,60 +2717,60 @@ bool SquareMacro(EvaluatorEnvironment& environment, const EvaluatorContext& cont
 //
 void importFundamentalGenerators(EvaluatorEnvironment& environment)
 {
-	environment.generators["c-import"] = ImportGenerator;
-	environment.generators["import"] = ImportGenerator;
+	environment.generators[Symbol("c-import")] = ImportGenerator;
+	environment.generators[Symbol("import")] = ImportGenerator;
 
-	environment.generators["defun"] = DefunGenerator;
-	environment.generators["defun-local"] = DefunGenerator;
-	environment.generators["defun-comptime"] = DefunGenerator;
+	environment.generators[Symbol("defun")] = DefunGenerator;
+	environment.generators[Symbol("defun-local")] = DefunGenerator;
+	environment.generators[Symbol("defun-comptime")] = DefunGenerator;
 
-	environment.generators["def-function-signature"] = DefFunctionSignatureGenerator;
-	environment.generators["def-function-signature-local"] = DefFunctionSignatureGenerator;
+	environment.generators[Symbol("def-function-signature")] = DefFunctionSignatureGenerator;
+	environment.generators[Symbol("def-function-signature-local")] = DefFunctionSignatureGenerator;
 
-	environment.generators["def-type-alias"] = DefTypeAliasGenerator;
-	environment.generators["def-type-alias-global"] = DefTypeAliasGenerator;
+	environment.generators[Symbol("def-type-alias")] = DefTypeAliasGenerator;
+	environment.generators[Symbol("def-type-alias-global")] = DefTypeAliasGenerator;
 
-	environment.generators["defmacro"] = DefMacroGenerator;
-	environment.generators["defgenerator"] = DefGeneratorGenerator;
+	environment.generators[Symbol("defmacro")] = DefMacroGenerator;
+	environment.generators[Symbol("defgenerator")] = DefGeneratorGenerator;
 
-	environment.generators["defstruct"] = DefStructGenerator;
-	environment.generators["defstruct-local"] = DefStructGenerator;
+	environment.generators[Symbol("defstruct")] = DefStructGenerator;
+	environment.generators[Symbol("defstruct-local")] = DefStructGenerator;
 
-	environment.generators["var"] = VariableDeclarationGenerator;
-	environment.generators["global-var"] = VariableDeclarationGenerator;
-	environment.generators["static-var"] = VariableDeclarationGenerator;
+	environment.generators[Symbol("var")] = VariableDeclarationGenerator;
+	environment.generators[Symbol("global-var")] = VariableDeclarationGenerator;
+	environment.generators[Symbol("static-var")] = VariableDeclarationGenerator;
 
-	environment.generators["at"] = ArrayAccessGenerator;
-	environment.generators["nth"] = ArrayAccessGenerator;
+	environment.generators[Symbol("at")] = ArrayAccessGenerator;
+	environment.generators[Symbol("nth")] = ArrayAccessGenerator;
 
-	environment.generators["if"] = IfGenerator;
-	environment.generators["cond"] = ConditionGenerator;
+	environment.generators[Symbol("if")] = IfGenerator;
+	environment.generators[Symbol("cond")] = ConditionGenerator;
 
 	// Essentially a block comment, without messing up my highlighting and such
-	environment.generators["ignore"] = IgnoreGenerator;
+	environment.generators[Symbol("ignore")] = IgnoreGenerator;
 
 	// Handle complex pathing, e.g. a->b.c->d.e
-	environment.generators["path"] = ObjectPathGenerator;
+	environment.generators[Symbol("path")] = ObjectPathGenerator;
 
 	// Token manipulation
-	environment.generators["tokenize-push"] = TokenizePushGenerator;
+	environment.generators[Symbol("tokenize-push")] = TokenizePushGenerator;
 
-	environment.generators["rename-builtin"] = RenameBuiltinGenerator;
+	environment.generators[Symbol("rename-builtin")] = RenameBuiltinGenerator;
 
 	// Cakelisp options
-	environment.generators["set-cakelisp-option"] = SetCakelispOption;
-	environment.generators["set-module-option"] = SetModuleOption;
+	environment.generators[Symbol("set-cakelisp-option")] = SetCakelispOption;
+	environment.generators[Symbol("set-module-option")] = SetModuleOption;
 
 	// All things build
-	environment.generators["skip-build"] = SkipBuildGenerator;
-	environment.generators["add-cpp-build-dependency"] = AddDependencyGenerator;
-	environment.generators["add-c-build-dependency"] = AddDependencyGenerator;
-	environment.generators["add-build-options"] = AddBuildOptionGenerator;
-	environment.generators["add-compile-time-hook"] = AddCompileTimeHookGenerator;
-	environment.generators["add-compile-time-hook-module"] = AddCompileTimeHookGenerator;
-	environment.generators["add-c-search-directory"] = AddCSearchDirectoryGenerator;
-	environment.generators["add-cakelisp-search-directory"] = AddCakelispSearchPathGenerator;
-	environment.generators["add-build-config-label"] = AddBuildConfigLabelGenerator;
+	environment.generators[Symbol("skip-build")] = SkipBuildGenerator;
+	environment.generators[Symbol("add-cpp-build-dependency")] = AddDependencyGenerator;
+	environment.generators[Symbol("add-c-build-dependency")] = AddDependencyGenerator;
+	environment.generators[Symbol("add-build-options")] = AddBuildOptionGenerator;
+	environment.generators[Symbol("add-compile-time-hook")] = AddCompileTimeHookGenerator;
+	environment.generators[Symbol("add-compile-time-hook-module")] = AddCompileTimeHookGenerator;
+	environment.generators[Symbol("add-c-search-directory")] = AddCSearchDirectoryGenerator;
+	environment.generators[Symbol("add-cakelisp-search-directory")] = AddCakelispSearchPathGenerator;
+	environment.generators[Symbol("add-build-config-label")] = AddBuildConfigLabelGenerator;
 
 	// Dispatches based on invocation name
 	const char* cStatementKeywords[] = {
@@ -2802,6 +2790,6 @@ void importFundamentalGenerators(EvaluatorEnvironment& environment)
 	    "+", "-", "*", "/", "%", "mod", "++", "--", "incr", "decr"};
 	for (size_t i = 0; i < ArraySize(cStatementKeywords); ++i)
 	{
-		environment.generators[cStatementKeywords[i]] = CStatementGenerator;
+		environment.generators[Symbol(cStatementKeywords[i])] = CStatementGenerator;
 	}
 }
@@ -0,0 +1,372 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <new>
+#include <utility>
+#include <vector>
+
+// An open-addressing hash table with the parts of std::unordered_map's interface Cakelisp uses.
+//
+// Lookups probe a flat array of (hash, entry index) slots with linear probing, so a hit usually
+// touches one slot cache line and the entry itself, rather than walking a bucket's linked list.
+// Entries are stored in fixed-size blocks which are never moved or reallocated, so pointers and
+// references to keys and values stay valid across inserts and rehashes, just like unordered_map.
+// Only erasing an entry invalidates references to that entry.
+//
+// Iteration visits entries in storage order, which is insertion order unless entries have been
+// erased (erased entries' storage is reused by later inserts)
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+struct HashTable
+{
+	typedef Key key_type;
+	typedef Value mapped_type;
+	typedef std::pair<const Key, Value> value_type;
+
+	template <typename TableType, typename PairType>
+	struct IteratorBase
+	{
+		TableType* table;
+		uint32_t entryIndex;
+
+		IteratorBase() : table(nullptr), entryIndex(invalidIndex)
+		{
+		}
+		IteratorBase(TableType* newTable, uint32_t newEntryIndex)
+		    : table(newTable), entryIndex(newEntryIndex)
+		{
+		}
+		// Allows iterator to convert to const_iterator
+		template <typename OtherTableType, typename OtherPairType>
+		IteratorBase(const IteratorBase<OtherTableType, OtherPairType>& other)
+		    : table(other.table), entryIndex(other.entryIndex)
+		{
+		}
+
+		PairType& operator*() const
+		{
+			return table->getEntry(entryIndex);
+		}
+		PairType* operator->() const
+		{
+			return &table->getEntry(entryIndex);
+		}
+		IteratorBase& operator++()
+		{
+			entryIndex = table->findOccupiedEntry(entryIndex + 1);
+			return *this;
+		}
+		IteratorBase operator++(int)
+		{
+			IteratorBase previous = *this;
+			++(*this);
+			return previous;
+		}
+		template <typename OtherTableType, typename OtherPairType>
+		bool operator==(const IteratorBase<OtherTableType, OtherPairType>& other) const
+		{
+			return entryIndex == other.entryIndex;
+		}
+		template <typename OtherTableType, typename OtherPairType>
+		bool operator!=(const IteratorBase<OtherTableType, OtherPairType>& other) const
+		{
+			return entryIndex != other.entryIndex;
+		}
+	};
+
+	typedef IteratorBase<HashTable, value_type> iterator;
+	typedef IteratorBase<const HashTable, const value_type> const_iterator;
+
+	HashTable() : numEntries(0), numOccupied(0)
+	{
+	}
+	HashTable(const HashTable& other) : numEntries(0), numOccupied(0)
+	{
+		*this = other;
+	}
+	HashTable& operator=(const HashTable& other)
+	{
+		if (this == &other)
+			return *this;
+		clear();
+		reserve(other.numOccupied);
+		for (const value_type& pair : other)
+			insert(pair);
+		return *this;
+	}
+	~HashTable()
+	{
+		clear();
+	}
+
+	iterator begin()
+	{
+		return iterator(this, findOccupiedEntry(0));
+	}
+	iterator end()
+	{
+		return iterator(this, invalidIndex);
+	}
+	const_iterator begin() const
+	{
+		return const_iterator(this, findOccupiedEntry(0));
+	}
+	const_iterator end() const
+	{
+		return const_iterator(this, invalidIndex);
+	}
+
+	size_t size() const
+	{
+		return numOccupied;
+	}
+	bool empty() const
+	{
+		return numOccupied == 0;
+	}
+
+	iterator find(const Key& key)
+	{
+		size_t slotIndex = findSlot(key, hashKey(key));
+		if (slotIndex == invalidIndex)
+			return end();
+		return iterator(this, slots[slotIndex].entryIndex);
+	}
+	const_iterator find(const Key& key) const
+	{
+		size_t slotIndex = findSlot(key, hashKey(key));
+		if (slotIndex == invalidIndex)
+			return end();
+		return const_iterator(this, slots[slotIndex].entryIndex);
+	}
+	size_t count(const Key& key) const
+	{
+		return findSlot(key, hashKey(key)) == invalidIndex ? 0 : 1;
+	}
+
+	Value& operator[](const Key& key)
+	{
+		return insert(value_type(key, Value())).first->second;
+	}
+
+	// Does not overwrite the value if the key is already present, like unordered_map
+	std::pair<iterator, bool> insert(const value_type& pair)
+	{
+		uint32_t hash = hashKey(pair.first);
+		size_t slotIndex = findSlot(pair.first, hash);
+		if (slotIndex != invalidIndex)
+			return std::make_pair(iterator(this, slots[slotIndex].entryIndex), false);
+
+		if ((numOccupied + 1) * maxLoadDenominator > slots.size() * maxLoadNumerator)
+		{
+			size_t numSlots = slots.size() * 2;
+			if (!numSlots)
+				numSlots = minSlots;
+			rehash(numSlots);
+		}
+
+		uint32_t entryIndex = allocateEntry();
+		new (&getEntry(entryIndex)) value_type(pair);
+		++numOccupied;
+
+		size_t mask = slots.size() - 1;
+		for (slotIndex = hash & mask; slots[slotIndex].entryIndex != invalidIndex;
+		     slotIndex = (slotIndex + 1) & mask)
+			;
+		slots[slotIndex].hash = hash;
+		slots[slotIndex].entryIndex = entryIndex;
+
+		return std::make_pair(iterator(this, entryIndex), true);
+	}
+
+	// Returns the iterator following the erased entry
+	iterator erase(const_iterator position)
+	{
+		uint32_t erasedEntryIndex = position.entryIndex;
+		eraseSlot(findSlot(getEntry(erasedEntryIndex).first,
+		                   hashKey(getEntry(erasedEntryIndex).first)));
+		return iterator(this, findOccupiedEntry(erasedEntryIndex + 1));
+	}
+	iterator erase(iterator position)
+	{
+		return erase(const_iterator(position));
+	}
+	size_t erase(const Key& key)
+	{
+		size_t slotIndex = findSlot(key, hashKey(key));
+		if (slotIndex == invalidIndex)
+			return 0;
+		eraseSlot(slotIndex);
+		return 1;
+	}
+
+	void clear()
+	{
+		for (uint32_t i = 0; i < numEntries; ++i)
+		{
+			if (entryOccupied[i])
+				getEntry(i).~value_type();
+		}
+		for (EntryStorage* block : blocks)
+			delete[] block;
+		blocks.clear();
+		entryOccupied.clear();
+		freeEntries.clear();
+		slots.clear();
+		numEntries = 0;
+		numOccupied = 0;
+	}
+
+	// Make room for numElements without rehashing
+	void reserve(size_t numElements)
+	{
+		size_t numSlots = minSlots;
+		while (numElements * maxLoadDenominator > numSlots * maxLoadNumerator)
+			numSlots *= 2;
+		if (numSlots > slots.size())
+			rehash(numSlots);
+	}
+
+private:
+	static const uint32_t invalidIndex = 0xffffffff;
+	static const size_t minSlots = 16;
+	static const size_t entriesPerBlockBits = 6;
+	static const size_t entriesPerBlock = 1 << entriesPerBlockBits;
+	// Linear probing degrades quickly past about 3/4 full
+	static const size_t maxLoadNumerator = 3;
+	static const size_t maxLoadDenominator = 4;
+
+	struct Slot
+	{
+		// Full hash, so most mismatches are rejected without looking at the entry
+		uint32_t hash;
+		// invalidIndex if the slot is empty
+		uint32_t entryIndex;
+	};
+
+	struct EntryStorage
+	{
+		alignas(value_type) unsigned char data[sizeof(value_type)];
+	};
+
+	std::vector<Slot> slots;
+	// Blocks of entriesPerBlock entries. Never reallocated, which keeps entry addresses stable
+	std::vector<EntryStorage*> blocks;
+	std::vector<unsigned char> entryOccupied;
+	// Erased entries available for reuse
+	std::vector<uint32_t> freeEntries;
+	// Entries ever allocated, including erased ones
+	uint32_t numEntries;
+	size_t numOccupied;
+
+	value_type& getEntry(uint32_t entryIndex)
+	{
+		return *reinterpret_cast<value_type*>(
+		    blocks[entryIndex >> entriesPerBlockBits][entryIndex & (entriesPerBlock - 1)].data);
+	}
+	const value_type& getEntry(uint32_t entryIndex) const
+	{
+		return *reinterpret_cast<const value_type*>(
+		    blocks[entryIndex >> entriesPerBlockBits][entryIndex & (entriesPerBlock - 1)].data);
+	}
+
+	uint32_t findOccupiedEntry(uint32_t startEntryIndex) const
+	{
+		for (uint32_t i = startEntryIndex; i < numEntries; ++i)
+		{
+			if (entryOccupied[i])
+				return i;
+		}
+		return invalidIndex;
+	}
+
+	// Hashes like SymbolHash (which returns the ID) put similar keys next to each other, so mix the
+	// bits before using them to pick a slot
+	static uint32_t hashKey(const Key& key)
+	{
+		uint64_t hash = (uint64_t)Hash()(key) * 0x9e3779b97f4a7c15ULL;
+		return (uint32_t)(hash >> 32);
+	}
+
+	// Returns invalidIndex if not found
+	size_t findSlot(const Key& key, uint32_t hash) const
+	{
+		if (slots.empty())
+			return invalidIndex;
+
+		size_t mask = slots.size() - 1;
+		for (size_t slotIndex = hash & mask;; slotIndex = (slotIndex + 1) & mask)
+		{
+			const Slot& slot = slots[slotIndex];
+			if (slot.entryIndex == invalidIndex)
+				return invalidIndex;
+			if (slot.hash == hash && getEntry(slot.entryIndex).first == key)
+				return slotIndex;
+		}
+	}
+
+	uint32_t allocateEntry()
+	{
+		uint32_t entryIndex = 0;
+		if (!freeEntries.empty())
+		{
+			entryIndex = freeEntries.back();
+			freeEntries.pop_back();
+		}
+		else
+		{
+			entryIndex = numEntries++;
+			if ((entryIndex >> entriesPerBlockBits) >= blocks.size())
+				blocks.push_back(new EntryStorage[entriesPerBlock]);
+			entryOccupied.push_back(0);
+		}
+		entryOccupied[entryIndex] = 1;
+		return entryIndex;
+	}
+
+	void eraseSlot(size_t slotIndex)
+	{
+		uint32_t entryIndex = slots[slotIndex].entryIndex;
+		getEntry(entryIndex).~value_type();
+		entryOccupied[entryIndex] = 0;
+		freeEntries.push_back(entryIndex);
+		--numOccupied;
+
+		// Backward-shift deletion: move later slots in the same probe run into the hole, so lookups
+		// never need tombstones to know to keep probing
+		size_t mask = slots.size() - 1;
+		size_t hole = slotIndex;
+		for (size_t i = (hole + 1) & mask; slots[i].entryIndex != invalidIndex; i = (i + 1) & mask)
+		{
+			size_t idealSlot = slots[i].hash & mask;
+			// Only move the slot if the hole is between its ideal slot and where it is now
+			if (((i - idealSlot) & mask) >= ((i - hole) & mask))
+			{
+				slots[hole] = slots[i];
+				hole = i;
+			}
+		}
+		slots[hole].entryIndex = invalidIndex;
+	}
+
+	// Only the slots move. Entries stay where they are
+	void rehash(size_t numSlots)
+	{
+		Slot emptySlot = {0, invalidIndex};
+		std::vector<Slot> oldSlots(numSlots, emptySlot);
+		oldSlots.swap(slots);
+
+		size_t mask = numSlots - 1;
+		for (const Slot& oldSlot : oldSlots)
+		{
+			if (oldSlot.entryIndex == invalidIndex)
+				continue;
+			size_t slotIndex = oldSlot.hash & mask;
+			while (slots[slotIndex].entryIndex != invalidIndex)
+				slotIndex = (slotIndex + 1) & mask;
+			slots[slotIndex] = oldSlot;
+		}
+	}
+};
@@ -3,6 +3,7 @@
 
 #include <vector>
 
+#include "Daemon.hpp"
 #include "FileUtilities.hpp"
 #include "Logging.hpp"
 #include "ModuleManager.hpp"
@@ -37,11 +38,31 @@ void OnExecuteProcessOutput(const char* output)
 {
 }
 
-int main(int numArguments, char* arguments[])
+static void outputInvocationProfiles(EvaluatorEnvironment& environment)
+{
+	Log("\nInvocation profile:\n");
+	printInvocationProfiles(environment);
+
+	char profileFilename[MAX_PATH_LENGTH] = {0};
+	PrintfBuffer(profileFilename, "%s/invocation_profile.tsv", cakelispWorkingDir);
+	if (writeInvocationProfiles(environment, profileFilename))
+		Logf("Wrote invocation profile to %s\n", profileFilename);
+}
+
+static int cakelispDaemonBuild(int numArguments, char* arguments[], void* userData);
+
+// residentState is only set when running builds for a daemon
+static int cakelispMain(int numArguments, char* arguments[], ModuleResidentState* residentState)
 {
 	bool ignoreCachedFiles = false;
 	bool executeOutput = false;
 	bool listBuiltInGeneratorsThenQuit = false;
+	bool batchCompileTimeBuilds = false;
+	bool pipeCompileTimeSource = false;
+	bool usePrecompiledHeaders = false;
+	bool runDaemon = false;
+	bool profileInvocations = false;
+	bool useDaemon = false;
 
 	const CommandLineOption options[] = {
 	    {"--ignore-cache", &ignoreCachedFiles,
@@ -55,6 +76,32 @@ int main(int numArguments, char* arguments[])
 	    {"--list-built-ins", &listBuiltInGeneratorsThenQuit,
 	     "List all built-in compile-time procedures, then exit. This list contains every procedure "
 	     "you can possibly call, until you import more or define your own"},
+	    {"--batch-compile-time-builds", &batchCompileTimeBuilds,
+	     "Compile and link the compile-time functions which are ready in each build pass together, "
+	     "in one translation unit and library, rather than one per function. If the batch fails "
+	     "to compile, its functions are compiled individually to find the failure"},
+	    {"--pipe-compile-time-source", &pipeCompileTimeSource,
+	     "Feed generated compile-time code straight to the compiler instead of writing it to "
+	     "source files first. Leave this off when debugging compile-time code, so the source "
+	     "files are kept for inspection"},
+	    {"--precompiled-headers", &usePrecompiledHeaders,
+	     "Precompile the headers included by all compile-time code, and force-include them in "
+	     "every compile-time translation unit. This makes building compile-time functions "
+	     "faster, but requires a compiler which finds <header>.gch files for -include'd headers "
+	     "(e.g. GCC or Clang)"},
+	    {"--daemon", &runDaemon,
+	     "Stay running and serve builds requested with --use-daemon from the same working "
+	     "directory, until interrupted. Only the tokens of unchanged files and the loaded "
+	     "compile-time function libraries are kept between builds; every module is still "
+	     "evaluated and generated each build. No files are needed"},
+	    {"--use-daemon", &useDaemon,
+	     "Have the daemon serving this working directory run the build, if there is one. "
+	     "Otherwise, build as usual"},
+	    {"--profile-invocations", &profileInvocations,
+	     "Time every macro, generator, and compile-time function (hook) invocation. After "
+	     "building, output a table of each one's invocation count, exclusive and inclusive time, "
+	     "and output size, sorted by exclusive time. The same table is written to "
+	     "cakelisp_cache/invocation_profile.tsv for other tools to read"},
 	    // Logging
 	    {"--verbose-phases", &log.phases,
 	     "Output labels for each major phase Cakelisp goes through"},
@@ -158,6 +205,20 @@ int main(int numArguments, char* arguments[])
 		return 0;
 	}
 
+	if (runDaemon)
+	{
+		if (residentState)
+		{
+			Log("error: --daemon: already running in a daemon\n");
+			return 1;
+		}
+
+		residentState = moduleResidentStateCreate();
+		bool served = daemonServe(cakelispDaemonBuild, residentState);
+		moduleResidentStateDestroy(residentState);
+		return served ? 0 : 1;
+	}
+
 	std::vector<const char*> filesToEvaluate;
 	for (int i = startFiles; i < numArguments; ++i)
 		filesToEvaluate.push_back(arguments[i]);
@@ -169,8 +230,19 @@ int main(int numArguments, char* arguments[])
 		return 1;
 	}
 
+	// The daemon receives these same arguments, so it will know not to ask itself
+	if (useDaemon && !residentState)
+	{
+		int exitCode = 0;
+		if (daemonRequestBuild(numArguments, arguments, &exitCode))
+			return exitCode;
+		if (log.phases)
+			Log("No daemon is serving this directory (--use-daemon). Building without one\n");
+	}
+
 	ModuleManager moduleManager = {};
 	moduleManagerInitialize(moduleManager);
+	moduleManager.residentState = residentState;
 
 	// Set options after initialization
 	{
@@ -180,25 +252,34 @@ int main(int numArguments, char* arguments[])
 			    "(--ignore-cache)\n");
 			moduleManager.environment.useCachedFiles = false;
 		}
+
+		moduleManager.environment.batchCompileTimeBuilds = batchCompileTimeBuilds;
+		moduleManager.environment.pipeCompileTimeSource = pipeCompileTimeSource;
+		moduleManager.environment.enableProfiling = profileInvocations;
+		moduleManager.environment.usePrecompiledHeaders = usePrecompiledHeaders;
 	}
 
+	// Tokenize everything we know about in parallel while the first files are being evaluated
+	moduleManagerPretokenizeFiles(moduleManager, filesToEvaluate);
+
+	bool generateSucceeded = true;
 	for (const char* filename : filesToEvaluate)
 	{
 		if (!moduleManagerAddEvaluateFile(moduleManager, filename, /*moduleOut=*/nullptr))
 		{
-			moduleManagerDestroy(moduleManager);
-			return 1;
+			generateSucceeded = false;
+			break;
 		}
 	}
 
-	if (!moduleManagerEvaluateResolveReferences(moduleManager))
-	{
-		moduleManagerDestroy(moduleManager);
-		return 1;
-	}
-
-	if (!moduleManagerWriteGeneratedOutput(moduleManager))
+	generateSucceeded = generateSucceeded &&
+	                    moduleManagerEvaluateResolveReferences(moduleManager) &&
+	                    moduleManagerWriteGeneratedOutput(moduleManager);
+	if (!generateSucceeded)
 	{
+		// Failing or slow macros are often the reason the profile was wanted
+		if (profileInvocations)
+			outputInvocationProfiles(moduleManager.environment);
 		moduleManagerDestroy(moduleManager);
 		return 1;
 	}
@@ -210,7 +291,13 @@ int main(int numArguments, char* arguments[])
 		Log("\nBuild:\n");
 
 	std::vector<std::string> builtOutputs;
-	if (!moduleManagerBuild(moduleManager, builtOutputs))
+	bool buildSucceeded = moduleManagerBuild(moduleManager, builtOutputs);
+
+	// Includes hooks run while building, even if it failed
+	if (profileInvocations)
+		outputInvocationProfiles(moduleManager.environment);
+
+	if (!buildSucceeded)
 	{
 		moduleManagerDestroy(moduleManager);
 		return 1;
@@ -272,3 +359,15 @@ int main(int numArguments, char* arguments[])
 	moduleManagerDestroy(moduleManager);
 	return 0;
 }
+
+static int cakelispDaemonBuild(int numArguments, char* arguments[], void* userData)
+{
+	// Settings from the previous build must not carry over
+	log = {};
+	return cakelispMain(numArguments, arguments, (ModuleResidentState*)userData);
+}
+
+int main(int numArguments, char* arguments[])
+{
+	return cakelispMain(numArguments, arguments, /*residentState=*/nullptr);
+}
@@ -2,7 +2,11 @@
 
 #include <string.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <mutex>
+#include <thread>
 
 #include "Converters.hpp"
 #include "DynamicLoader.hpp"
@@ -63,9 +67,7 @@ void moduleManagerInitialize(ModuleManager& manager)
 			moduleDefinition.context = moduleContext;
 		}
 
-		// Will be cleaned up when the environment is destroyed
-		GeneratorOutput* compTimeOutput = new GeneratorOutput;
-		moduleDefinition.output = compTimeOutput;
+		moduleDefinition.output = newGeneratorOutput(manager.environment);
 		if (!addObjectDefinition(manager.environment, moduleDefinition))
 			Log("error: <global> couldn't be added. Was module manager initialized twice? Things "
 			    "will definitely break\n");
@@ -117,6 +119,11 @@ void moduleManagerInitialize(ModuleManager& manager)
 
 	manager.environment.useCachedFiles = true;
 	makeDirectory(cakelispWorkingDir);
+	{
+		char tokenCacheDir[MAX_PATH_LENGTH] = {0};
+		PrintfBuffer(tokenCacheDir, "%s/tokens", cakelispWorkingDir);
+		makeDirectory(tokenCacheDir);
+	}
 	if (log.fileSystem || log.phases)
 		Logf("Using cache at %s\n", cakelispWorkingDir);
 
@@ -125,94 +132,304 @@ void moduleManagerInitialize(ModuleManager& manager)
 	manager.environment.searchPaths.push_back(".");
 }
 
+static void moduleManagerDestroyTokenizeQueue(ModuleManager& manager);
+
 void moduleManagerDestroy(ModuleManager& manager)
 {
+	moduleManagerDestroyTokenizeQueue(manager);
 	environmentDestroyInvalidateTokens(manager.environment);
 	for (Module* module : manager.modules)
 	{
-		delete module->tokens;
-		delete module->generatedOutput;
+		// Resident tokens are kept for the next build
+		if (module->tokens && !manager.residentState)
+		{
+			releaseTokenIndex(*module->tokens);
+			delete module->tokens;
+		}
 		free((void*)module->filename);
 		delete module;
 	}
 	manager.modules.clear();
-	closeAllDynamicLibraries();
+	if (!manager.residentState)
+		closeAllDynamicLibraries();
 }
 
-bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>** tokensOut)
+//
+// Token cache
+//
+// Validated token arrays are written to the cache so that unchanged files do not need to be
+// tokenized again. Each source file has one cache file, which is only used if the source contents
+// and the tokenizer version match those it was written with. Symbols are stored once each, so
+// loading only needs to intern each distinct string once rather than once per token
+
+static const char tokenCacheMagic[4] = {'C', 'K', 'T', 'K'};
+
+struct TokenCacheHeader
 {
-	*tokensOut = nullptr;
+	char magic[4];
+	uint32_t tokenizerVersion;
+	uint32_t contentsCrc;
+	uint32_t contentsSize;
+	uint32_t numTokens;
+	uint32_t numStrings;
+};
 
-	FILE* file = fileOpen(filename, "r");
-	if (!file)
+struct TokenCacheEntry
+{
+	uint32_t type;
+	uint32_t stringIndex;
+	uint32_t lineNumber;
+	uint16_t columnStart;
+	uint16_t columnEnd;
+};
+
+// Filled in by moduleTokenizeFile() so the token cache can be updated after validation
+struct TokenCacheInfo
+{
+	uint32_t contentsCrc;
+	uint32_t contentsSize;
+	// No need to write the cache again if this is set
+	bool wasReadFromCache;
+};
+
+static void tokenCacheGetFilename(const char* sourceFilename, char* bufferOut, int bufferSize)
+{
+	uint32_t filenameCrc = 0;
+	crc32(sourceFilename, strlen(sourceFilename), &filenameCrc);
+	SafeSnprinf(bufferOut, bufferSize, "%s/tokens/%08x.tokens", cakelispWorkingDir,
+	            (unsigned int)filenameCrc);
+}
+
+// Returns false if there is no cache, or it is out of date
+static bool tokenCacheRead(const char* sourceFilename, const TokenCacheInfo& info,
+                           std::vector<Token>& tokensOut)
+{
+	char cacheFilename[MAX_PATH_LENGTH] = {0};
+	tokenCacheGetFilename(sourceFilename, cacheFilename, sizeof(cacheFilename));
+	if (!fileExists(cacheFilename))
 		return false;
 
-	char lineBuffer[2048] = {0};
-	int lineNumber = 1;
-	// We need to be very careful about when we delete this so as to not invalidate pointers
-	// It is immutable to also disallow any pointer invalidation if we were to resize it
-	const std::vector<Token>* tokens = nullptr;
+	const char* contents = nullptr;
+	unsigned long contentsSize = 0;
+	if (!fileMapReadOnly(cacheFilename, &contents, &contentsSize))
+		return false;
+
+	bool isValid = false;
+	std::vector<Symbol> strings;
+	const char* contentsEnd = contents + contentsSize;
+	TokenCacheHeader header;
+	if (contentsSize >= sizeof(header))
 	{
-		std::vector<Token>* tokens_CREATIONONLY = new std::vector<Token>;
-		bool isFirstLine = true;
-		while (fgets(lineBuffer, sizeof(lineBuffer), file))
-		{
-			if (log.tokenization)
-				Logf("%s", lineBuffer);
+		memcpy(&header, contents, sizeof(header));
+		isValid = memcmp(header.magic, tokenCacheMagic, sizeof(header.magic)) == 0 &&
+		          header.tokenizerVersion == g_tokenizerVersion &&
+		          header.contentsCrc == info.contentsCrc &&
+		          header.contentsSize == info.contentsSize &&
+		          (unsigned long)header.numTokens * sizeof(TokenCacheEntry) <=
+		              contentsSize - sizeof(header);
+	}
 
-			// Check for shebang and ignore this line if found. This allows users to execute their
-			// scripts via e.g. ./MyScript.cake, given #!/usr/bin/cakelisp --execute
-			if (isFirstLine)
+	// Strings follow the tokens, each prefixed by its length
+	const char* entries = contents + sizeof(header);
+	if (isValid)
+	{
+		strings.reserve(header.numStrings);
+		const char* readHead = entries + header.numTokens * sizeof(TokenCacheEntry);
+		for (uint32_t i = 0; i < header.numStrings; ++i)
+		{
+			uint32_t length = 0;
+			if (contentsEnd - readHead < (long)sizeof(length))
 			{
-				isFirstLine = false;
-				if (lineBuffer[0] == '#' && lineBuffer[1] == '!')
-				{
-					if (log.tokenization)
-						Log("Skipping shebang\n");
-					continue;
-				}
+				isValid = false;
+				break;
 			}
-
-			const char* error =
-			    tokenizeLine(lineBuffer, filename, lineNumber, *tokens_CREATIONONLY);
-			if (error != nullptr)
+			memcpy(&length, readHead, sizeof(length));
+			readHead += sizeof(length);
+			if (contentsEnd - readHead < (long)length)
 			{
-				Logf("%s:%d: error: %s\n", filename, lineNumber, error);
+				isValid = false;
+				break;
+			}
 
-				delete tokens_CREATIONONLY;
-				return false;
+			Symbol string;
+			string.assign(readHead, length);
+			strings.push_back(string);
+			readHead += length;
+		}
+	}
+
+	if (isValid)
+	{
+		tokensOut.reserve(header.numTokens);
+		for (uint32_t i = 0; i < header.numTokens; ++i)
+		{
+			TokenCacheEntry entry;
+			memcpy(&entry, entries + i * sizeof(TokenCacheEntry), sizeof(entry));
+			if (entry.type > TokenType_String || entry.stringIndex >= strings.size())
+			{
+				isValid = false;
+				tokensOut.clear();
+				break;
 			}
 
-			lineNumber++;
+			tokensOut.push_back(Token((TokenType)entry.type, strings[entry.stringIndex],
+			                          sourceFilename, entry.lineNumber, entry.columnStart,
+			                          entry.columnEnd));
 		}
+	}
 
-		// Make it const to avoid pointer invalidation due to resize
-		tokens = tokens_CREATIONONLY;
+	fileUnmap(contents, contentsSize);
+
+	if (log.fileSystem)
+		Logf("%s token cache %s for %s\n", isValid ? "Using" : "Ignoring out of date",
+		     cacheFilename, sourceFilename);
+
+	return isValid;
+}
+
+static void tokenCacheWrite(const char* sourceFilename, const TokenCacheInfo& info,
+                            const std::vector<Token>& tokens)
+{
+	char cacheFilename[MAX_PATH_LENGTH] = {0};
+	tokenCacheGetFilename(sourceFilename, cacheFilename, sizeof(cacheFilename));
+	char tempFilename[MAX_PATH_LENGTH] = {0};
+	makeUniqueTemporaryFilename(cacheFilename, tempFilename, sizeof(tempFilename));
+
+	FILE* file = fileOpen(tempFilename, "wb");
+	if (!file)
+		return;
+
+	std::unordered_map<SymbolId, uint32_t> stringIndices;
+	std::vector<Symbol> strings;
+	std::vector<TokenCacheEntry> entries;
+	entries.reserve(tokens.size());
+	for (const Token& token : tokens)
+	{
+		std::unordered_map<SymbolId, uint32_t>::iterator findIt =
+		    stringIndices.find(token.contents.id);
+		uint32_t stringIndex = 0;
+		if (findIt == stringIndices.end())
+		{
+			stringIndex = (uint32_t)strings.size();
+			stringIndices[token.contents.id] = stringIndex;
+			strings.push_back(token.contents);
+		}
+		else
+			stringIndex = findIt->second;
+
+		TokenCacheEntry entry = {(uint32_t)token.type, stringIndex, token.lineNumber,
+		                         token.columnStart, token.columnEnd};
+		entries.push_back(entry);
 	}
 
-	if (log.tokenization)
-		Logf("Tokenized %d lines\n", lineNumber - 1);
+	TokenCacheHeader header;
+	memcpy(header.magic, tokenCacheMagic, sizeof(header.magic));
+	header.tokenizerVersion = g_tokenizerVersion;
+	header.contentsCrc = info.contentsCrc;
+	header.contentsSize = info.contentsSize;
+	header.numTokens = (uint32_t)entries.size();
+	header.numStrings = (uint32_t)strings.size();
+
+	bool writeSucceeded = fwrite(&header, sizeof(header), 1, file) == 1 &&
+	                      fwrite(entries.data(), sizeof(TokenCacheEntry), entries.size(), file) ==
+	                          entries.size();
+	for (const Symbol& string : strings)
+	{
+		if (!writeSucceeded)
+			break;
+		uint32_t length = (uint32_t)string.size();
+		writeSucceeded = fwrite(&length, sizeof(length), 1, file) == 1 &&
+		                 fwrite(string.c_str(), 1, length, file) == length;
+	}
+	fclose(file);
 
-	if (tokens->empty())
+	// Write to a temporary file first so a partially written cache is never read
+	if (!writeSucceeded || !replaceFile(tempFilename, cacheFilename))
 	{
-		Log("error: empty file. Please remove from system, or add (ignore)\n");
-		delete tokens;
+		Logf("error: failed to write token cache %s\n", cacheFilename);
+		remove(tempFilename);
+		return;
+	}
+
+	if (log.fileSystem)
+		Logf("Wrote token cache %s for %s\n", cacheFilename, sourceFilename);
+}
+
+// Errors are only printed if printErrors, so that files can be tokenized speculatively. If
+// tokenCacheInfo is provided, the token cache will be used (if useTokenCache), and tokenCacheInfo
+// will be filled in for writing the cache after validation
+static bool moduleTokenizeFile(const char* filename, std::vector<Token>& tokensOut,
+                               bool printErrors, bool useTokenCache,
+                               TokenCacheInfo* tokenCacheInfo)
+{
+	const char* contents = nullptr;
+	unsigned long contentsSize = 0;
+	if (!fileMapReadOnly(filename, &contents, &contentsSize))
 		return false;
+
+	if (tokenCacheInfo)
+	{
+		tokenCacheInfo->contentsCrc = 0;
+		crc32(contents, contentsSize, &tokenCacheInfo->contentsCrc);
+		tokenCacheInfo->contentsSize = (uint32_t)contentsSize;
+		tokenCacheInfo->wasReadFromCache =
+		    useTokenCache && tokenCacheRead(filename, *tokenCacheInfo, tokensOut);
+		if (tokenCacheInfo->wasReadFromCache)
+		{
+			fileUnmap(contents, contentsSize);
+			return true;
+		}
 	}
 
-	if (!validateParentheses(*tokens))
+	const char* contentsStart = contents;
+	unsigned int lineNumber = 1;
+	// Check for shebang and ignore this line if found. This allows users to execute their
+	// scripts via e.g. ./MyScript.cake, given #!/usr/bin/cakelisp --execute
+	if (contentsSize >= 2 && contents[0] == '#' && contents[1] == '!')
 	{
-		delete tokens;
+		if (log.tokenization)
+			Log("Skipping shebang\n");
+
+		const char* shebangEnd = (const char*)memchr(contents, '\n', contentsSize);
+		contentsStart = shebangEnd ? shebangEnd + 1 : contents + contentsSize;
+		++lineNumber;
+	}
+
+	const char* error = tokenizeFile(contentsStart, contentsSize - (contentsStart - contents),
+	                                 filename, lineNumber, &lineNumber, tokensOut);
+	fileUnmap(contents, contentsSize);
+	if (error != nullptr)
+	{
+		if (printErrors)
+			Logf("%s:%d: error: %s\n", filename, lineNumber, error);
 		return false;
 	}
 
+	if (log.tokenization)
+		Logf("Tokenized %d lines\n", lineNumber);
+
+	return true;
+}
+
+static bool moduleValidateTokens(const std::vector<Token>& tokens)
+{
+	if (tokens.empty())
+	{
+		Log("error: empty file. Please remove from system, or add (ignore)\n");
+		return false;
+	}
+
+	// Modules release their index when they are destroyed
+	if (!validateAndIndexParentheses(tokens))
+		return false;
+
 	if (log.tokenization)
 	{
 		Log("\nResult:\n");
 
 		// No need to validate, we already know it's safe
 		int nestingDepth = 0;
-		for (const Token& token : *tokens)
+		for (const Token& token : tokens)
 		{
 			printIndentToDepth(nestingDepth);
 
@@ -242,13 +459,402 @@ bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>**
 		}
 	}
 
-	fclose(file);
+	return true;
+}
+
+// If tokenCacheInfo is provided, the token cache will be read (if useTokenCache) and written
+static bool moduleLoadTokenizeValidateInternal(const char* filename,
+                                               const std::vector<Token>** tokensOut,
+                                               bool useTokenCache, TokenCacheInfo* tokenCacheInfo)
+{
+	*tokensOut = nullptr;
+
+	// We need to be very careful about when we delete this so as to not invalidate pointers
+	// It is immutable to also disallow any pointer invalidation if we were to resize it
+	const std::vector<Token>* tokens = nullptr;
+	{
+		std::vector<Token>* tokens_CREATIONONLY = new std::vector<Token>;
+		if (!moduleTokenizeFile(filename, *tokens_CREATIONONLY, /*printErrors=*/true,
+		                        useTokenCache, tokenCacheInfo))
+		{
+			delete tokens_CREATIONONLY;
+			return false;
+		}
+
+		// Make it const to avoid pointer invalidation due to resize
+		tokens = tokens_CREATIONONLY;
+	}
+
+	if (!moduleValidateTokens(*tokens))
+	{
+		delete tokens;
+		return false;
+	}
+
+	if (tokenCacheInfo && !tokenCacheInfo->wasReadFromCache)
+		tokenCacheWrite(filename, *tokenCacheInfo, *tokens);
 
 	*tokensOut = tokens;
 
 	return true;
 }
 
+bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>** tokensOut)
+{
+	return moduleLoadTokenizeValidateInternal(filename, tokensOut, /*useTokenCache=*/false,
+	                                          /*tokenCacheInfo=*/nullptr);
+}
+
+//
+// Resident state
+//
+
+struct ResidentModuleTokens
+{
+	// Used as the source of all the tokens, so it is owned here rather than by any module
+	const char* filename;
+	const std::vector<Token>* tokens;
+	uint32_t contentsCrc;
+	uint32_t contentsSize;
+	// Cakelisp modules it imports, so they can be tokenized ahead of time without this file
+	std::vector<std::string> importedFiles;
+};
+
+struct ModuleResidentState
+{
+	std::unordered_map<std::string, ResidentModuleTokens> moduleTokens;
+};
+
+ModuleResidentState* moduleResidentStateCreate()
+{
+	return new ModuleResidentState;
+}
+
+static void residentModuleTokensDestroy(ResidentModuleTokens& residentTokens)
+{
+	releaseTokenIndex(*residentTokens.tokens);
+	delete residentTokens.tokens;
+	free((void*)residentTokens.filename);
+}
+
+void moduleResidentStateDestroy(ModuleResidentState* residentState)
+{
+	for (std::pair<const std::string, ResidentModuleTokens>& tokensPair :
+	     residentState->moduleTokens)
+		residentModuleTokensDestroy(tokensPair.second);
+	delete residentState;
+	closeAllDynamicLibraries();
+}
+
+static bool fileContentsMatch(const char* filename, uint32_t expectedCrc, uint32_t expectedSize)
+{
+	const char* contents = nullptr;
+	unsigned long contentsSize = 0;
+	if (!fileMapReadOnly(filename, &contents, &contentsSize))
+		return false;
+	uint32_t contentsCrc = 0;
+	crc32(contents, contentsSize, &contentsCrc);
+	fileUnmap(contents, contentsSize);
+
+	return contentsCrc == expectedCrc && (uint32_t)contentsSize == expectedSize;
+}
+
+// Returns null if the file's tokens aren't resident, or the file has changed since they were
+static const std::vector<Token>* moduleResidentFindTokens(ModuleResidentState& residentState,
+                                                          const char* normalizedFilename)
+{
+	std::unordered_map<std::string, ResidentModuleTokens>::iterator findIt =
+	    residentState.moduleTokens.find(normalizedFilename);
+	if (findIt == residentState.moduleTokens.end())
+		return nullptr;
+
+	if (!fileContentsMatch(normalizedFilename, findIt->second.contentsCrc,
+	                       findIt->second.contentsSize))
+		return nullptr;
+
+	if (log.fileSystem)
+		Logf("Using resident tokens for %s\n", normalizedFilename);
+	return findIt->second.tokens;
+}
+
+static void findCakelispImports(const std::vector<Token>& tokens, const char* encounteredInFile,
+                                const std::vector<std::string>& searchPaths,
+                                std::vector<std::string>& normalizedFilenamesOut);
+
+// Takes ownership of the tokens and the filename they reference, replacing any out of date tokens
+static void moduleResidentAddTokens(ModuleResidentState& residentState, const char* filename,
+                                    const std::vector<Token>* tokens,
+                                    const TokenCacheInfo& tokenCacheInfo,
+                                    const std::vector<std::string>& searchPaths)
+{
+	ResidentModuleTokens& residentTokens = residentState.moduleTokens[filename];
+	if (residentTokens.tokens)
+		residentModuleTokensDestroy(residentTokens);
+	residentTokens.filename = filename;
+	residentTokens.tokens = tokens;
+	residentTokens.contentsCrc = tokenCacheInfo.contentsCrc;
+	residentTokens.contentsSize = tokenCacheInfo.contentsSize;
+	residentTokens.importedFiles.clear();
+	findCakelispImports(*tokens, filename, searchPaths, residentTokens.importedFiles);
+}
+
+//
+// Parallel tokenization
+//
+
+struct PretokenizedFile
+{
+	// Used as the source of all the tokens. Ownership transfers to the module which takes them
+	const char* normalizedFilename;
+	// Null if tokenization failed. moduleLoadTokenizeValidate() will report the error instead
+	const std::vector<Token>* tokens;
+	TokenCacheInfo tokenCacheInfo;
+	bool isFinished;
+};
+
+// What the pretokenizer needs to know about a file with resident tokens
+struct ResidentFileInfo
+{
+	uint32_t contentsCrc;
+	uint32_t contentsSize;
+	std::vector<std::string> importedFiles;
+};
+
+struct ModuleTokenizeQueue
+{
+	std::mutex mutex;
+	// Signalled whenever a file finishes tokenizing or the queue runs dry
+	std::condition_variable fileFinished;
+
+	// Never erased from, so pointers to values remain valid
+	std::unordered_map<std::string, PretokenizedFile> files;
+	// Breadth-first, so files are generally finished in the order evaluation will want them
+	std::vector<PretokenizedFile*> pendingFiles;
+	size_t nextPendingFile;
+	int numActiveWorkers;
+
+	// Copied so workers don't race with the environment adding search paths during evaluation.
+	// Guessing import paths wrong only means the file will be tokenized when it is imported
+	std::vector<std::string> searchPaths;
+	bool useTokenCache;
+	// Unchanged resident files will use their resident tokens, so only their imports are needed.
+	// Copied so workers don't race with modules replacing out of date resident tokens
+	std::unordered_map<std::string, ResidentFileInfo> residentFiles;
+
+	std::vector<std::thread> workers;
+};
+
+// Must hold the queue mutex (or have no workers yet)
+static void tokenizeQueueAddFile(ModuleTokenizeQueue& queue, const char* normalizedFilename)
+{
+	if (queue.files.find(normalizedFilename) != queue.files.end())
+		return;
+
+	PretokenizedFile& newFile = queue.files[normalizedFilename];
+	newFile.normalizedFilename = strdup(normalizedFilename);
+	newFile.tokens = nullptr;
+	newFile.isFinished = false;
+	queue.pendingFiles.push_back(&newFile);
+}
+
+// Find files in top-level (import) invocations so they can be tokenized before they are reached.
+// This only approximates ImportGenerator(); anything missed will be tokenized once imported
+static void findCakelispImports(const std::vector<Token>& tokens, const char* encounteredInFile,
+                                const std::vector<std::string>& searchPaths,
+                                std::vector<std::string>& normalizedFilenamesOut)
+{
+	int depth = 0;
+	bool isInImport = false;
+	for (size_t i = 0; i < tokens.size(); ++i)
+	{
+		const Token& token = tokens[i];
+		if (token.type == TokenType_OpenParen)
+		{
+			++depth;
+			if (depth == 1 && i + 1 < tokens.size() && tokens[i + 1].type == TokenType_Symbol &&
+			    tokens[i + 1].contents.compare("import") == 0)
+				isInImport = true;
+		}
+		else if (token.type == TokenType_CloseParen)
+		{
+			--depth;
+			if (depth <= 0)
+				isInImport = false;
+		}
+		else if (isInImport && depth == 1 && token.type == TokenType_String &&
+		         !token.contents.empty())
+		{
+			char resolvedPath[MAX_PATH_LENGTH] = {0};
+			if (!searchForFileInPaths(token.contents.c_str(), encounteredInFile, searchPaths,
+			                          resolvedPath, ArraySize(resolvedPath)))
+				continue;
+
+			char normalizedPath[MAX_PATH_LENGTH] = {0};
+			makeAbsoluteOrRelativeToWorkingDir(resolvedPath, normalizedPath,
+			                                   ArraySize(normalizedPath));
+			normalizedFilenamesOut.push_back(normalizedPath);
+		}
+	}
+}
+
+static void tokenizeQueueWorker(ModuleTokenizeQueue* queue)
+{
+	std::unique_lock<std::mutex> lock(queue->mutex);
+	while (true)
+	{
+		if (queue->nextPendingFile >= queue->pendingFiles.size())
+		{
+			// Other workers may still discover imports
+			if (queue->numActiveWorkers == 0)
+			{
+				queue->fileFinished.notify_all();
+				return;
+			}
+			queue->fileFinished.wait(lock);
+			continue;
+		}
+
+		PretokenizedFile* file = queue->pendingFiles[queue->nextPendingFile++];
+		++queue->numActiveWorkers;
+		lock.unlock();
+
+		std::vector<std::string> importedFiles;
+		std::vector<Token>* tokens_CREATIONONLY = nullptr;
+		std::unordered_map<std::string, ResidentFileInfo>::const_iterator residentFile =
+		    queue->residentFiles.find(file->normalizedFilename);
+		// Don't let fileMapReadOnly() print errors for files which may not even be evaluated
+		if (fileExists(file->normalizedFilename))
+		{
+			// The module will reuse the resident tokens, so only the imports are needed
+			if (residentFile != queue->residentFiles.end() &&
+			    fileContentsMatch(file->normalizedFilename, residentFile->second.contentsCrc,
+			                      residentFile->second.contentsSize))
+			{
+				importedFiles = residentFile->second.importedFiles;
+			}
+			else
+			{
+				tokens_CREATIONONLY = new std::vector<Token>;
+				if (moduleTokenizeFile(file->normalizedFilename, *tokens_CREATIONONLY,
+				                       /*printErrors=*/false, queue->useTokenCache,
+				                       &file->tokenCacheInfo))
+				{
+					findCakelispImports(*tokens_CREATIONONLY, file->normalizedFilename,
+					                    queue->searchPaths, importedFiles);
+				}
+				else
+				{
+					delete tokens_CREATIONONLY;
+					tokens_CREATIONONLY = nullptr;
+				}
+			}
+		}
+
+		lock.lock();
+		file->tokens = tokens_CREATIONONLY;
+		file->isFinished = true;
+		for (const std::string& importedFile : importedFiles)
+			tokenizeQueueAddFile(*queue, importedFile.c_str());
+		--queue->numActiveWorkers;
+		queue->fileFinished.notify_all();
+	}
+}
+
+void moduleManagerPretokenizeFiles(ModuleManager& manager,
+                                   const std::vector<const char*>& filenames)
+{
+	// Output from multiple threads would be interleaved and impossible to follow. Workers log
+	// tokenization, import searching, and file (and token cache) reads
+	if (log.tokenization || log.fileSearch || log.fileSystem || manager.tokenizeQueue)
+		return;
+
+	ModuleTokenizeQueue* queue = new ModuleTokenizeQueue;
+	queue->nextPendingFile = 0;
+	queue->numActiveWorkers = 0;
+	queue->searchPaths = manager.environment.searchPaths;
+	queue->useTokenCache = manager.environment.useCachedFiles;
+	if (manager.residentState)
+	{
+		for (const std::pair<const std::string, ResidentModuleTokens>& tokensPair :
+		     manager.residentState->moduleTokens)
+		{
+			const ResidentModuleTokens& residentTokens = tokensPair.second;
+			ResidentFileInfo& residentFile = queue->residentFiles[tokensPair.first];
+			residentFile.contentsCrc = residentTokens.contentsCrc;
+			residentFile.contentsSize = residentTokens.contentsSize;
+			residentFile.importedFiles = residentTokens.importedFiles;
+		}
+	}
+
+	for (const char* filename : filenames)
+	{
+		char normalizedPath[MAX_PATH_LENGTH] = {0};
+		makeAbsoluteOrRelativeToWorkingDir(filename, normalizedPath, ArraySize(normalizedPath));
+		tokenizeQueueAddFile(*queue, normalizedPath);
+	}
+
+	unsigned int numWorkers = std::thread::hardware_concurrency();
+	if (!numWorkers)
+		numWorkers = 1;
+	for (unsigned int i = 0; i < numWorkers; ++i)
+		queue->workers.push_back(std::thread(tokenizeQueueWorker, queue));
+
+	manager.tokenizeQueue = queue;
+}
+
+// Returns false if the file was not tokenized ahead of time (or it failed to tokenize), in which
+// case it should be loaded via moduleLoadTokenizeValidate() instead. Blocks until tokenized
+static bool moduleManagerTakePretokenizedFile(ModuleManager& manager,
+                                              const char* normalizedFilename,
+                                              const char** filenameOut,
+                                              const std::vector<Token>** tokensOut,
+                                              TokenCacheInfo* tokenCacheInfoOut)
+{
+	if (!manager.tokenizeQueue)
+		return false;
+
+	ModuleTokenizeQueue& queue = *manager.tokenizeQueue;
+	std::unique_lock<std::mutex> lock(queue.mutex);
+	std::unordered_map<std::string, PretokenizedFile>::iterator findIt =
+	    queue.files.find(normalizedFilename);
+	if (findIt == queue.files.end())
+		return false;
+
+	PretokenizedFile& file = findIt->second;
+	while (!file.isFinished)
+		queue.fileFinished.wait(lock);
+
+	if (!file.tokens)
+		return false;
+
+	// The module owns these now
+	*filenameOut = file.normalizedFilename;
+	*tokensOut = file.tokens;
+	*tokenCacheInfoOut = file.tokenCacheInfo;
+	file.normalizedFilename = nullptr;
+	file.tokens = nullptr;
+	return true;
+}
+
+static void moduleManagerDestroyTokenizeQueue(ModuleManager& manager)
+{
+	if (!manager.tokenizeQueue)
+		return;
+
+	for (std::thread& worker : manager.tokenizeQueue->workers)
+		worker.join();
+
+	// Clean up anything which was never imported
+	for (std::pair<const std::string, PretokenizedFile>& filePair : manager.tokenizeQueue->files)
+	{
+		delete filePair.second.tokens;
+		free((void*)filePair.second.normalizedFilename);
+	}
+
+	delete manager.tokenizeQueue;
+	manager.tokenizeQueue = nullptr;
+}
+
 bool moduleManagerAddEvaluateFile(ModuleManager& manager, const char* filename, Module** moduleOut)
 {
 	if (moduleOut)
@@ -315,8 +921,42 @@ bool moduleManagerAddEvaluateFile(ModuleManager& manager, const char* filename,
 	Module* newModule = new Module();
 	// We need to keep this memory around for the lifetime of the token, regardless of relocation
 	newModule->filename = normalizedFilename;
+	const char* pretokenizedFilename = nullptr;
+	const std::vector<Token>* pretokenizedTokens = nullptr;
+	TokenCacheInfo tokenCacheInfo = {};
+	const std::vector<Token>* residentTokens =
+	    manager.residentState ? moduleResidentFindTokens(*manager.residentState, normalizedFilename) :
+	                            nullptr;
+	if (residentTokens)
+	{
+		newModule->tokens = residentTokens;
+	}
+	else if (moduleManagerTakePretokenizedFile(manager, normalizedFilename, &pretokenizedFilename,
+	                                           &pretokenizedTokens, &tokenCacheInfo))
+	{
+		// The tokens reference the pretokenized filename, so it must live as long as the module
+		free((void*)normalizedFilename);
+		normalizedFilename = pretokenizedFilename;
+		newModule->filename = normalizedFilename;
+
+		if (!moduleValidateTokens(*pretokenizedTokens))
+		{
+			Logf("error: failed to tokenize %s\n", newModule->filename);
+			delete pretokenizedTokens;
+			delete newModule;
+			free((void*)normalizedFilename);
+			return false;
+		}
+
+		if (!tokenCacheInfo.wasReadFromCache)
+			tokenCacheWrite(newModule->filename, tokenCacheInfo, *pretokenizedTokens);
+
+		newModule->tokens = pretokenizedTokens;
+	}
 	// This stage cleans up after itself if it fails
-	if (!moduleLoadTokenizeValidate(newModule->filename, &newModule->tokens))
+	else if (!moduleLoadTokenizeValidateInternal(newModule->filename, &newModule->tokens,
+	                                             manager.environment.useCachedFiles,
+	                                             &tokenCacheInfo))
 	{
 		Logf("error: failed to tokenize %s\n", newModule->filename);
 		delete newModule;
@@ -324,7 +964,17 @@ bool moduleManagerAddEvaluateFile(ModuleManager& manager, const char* filename,
 		return false;
 	}
 
-	newModule->generatedOutput = new GeneratorOutput;
+	// The resident state takes the tokens and the filename they reference, so the module needs its
+	// own copy of the filename
+	if (manager.residentState && !residentTokens)
+	{
+		moduleResidentAddTokens(*manager.residentState, newModule->filename, newModule->tokens,
+		                        tokenCacheInfo, manager.environment.searchPaths);
+		normalizedFilename = strdup(newModule->filename);
+		newModule->filename = normalizedFilename;
+	}
+
+	newModule->generatedOutput = newGeneratorOutput(manager.environment);
 
 	manager.modules.push_back(newModule);
 
@@ -332,8 +982,8 @@ bool moduleManagerAddEvaluateFile(ModuleManager& manager, const char* filename,
 	moduleContext.module = newModule;
 	moduleContext.scope = EvaluatorScope_Module;
 	moduleContext.definitionName = &manager.globalPseudoInvocationName;
-	// Module always requires all its functions
-	// TODO: Local functions can be left out if not referenced (in fact, they may warn in C if not)
+	// Module always requires all its functions, except module-local functions, which are only
+	// required if used (see addObjectLocalUse())
 	moduleContext.isRequired = true;
 	// A delimiter isn't strictly necessary here, but it is nice to space out things
 	StringOutput moduleDelimiterTemplate = {};
@@ -422,20 +1072,62 @@ static bool createBuildOutputDirectory(EvaluatorEnvironment& environment, std::s
 	return true;
 }
 
-bool moduleManagerWriteGeneratedOutput(ModuleManager& manager)
+//
+// Parallel output writing
+//
+
+struct ModuleOutputJob
 {
-	createBuildOutputDirectory(manager.environment, manager.buildOutputDir);
+	Module* module;
+	GeneratorOutput header;
+	GeneratorOutput footer;
+	WriterOutputSettings outputSettings;
+	bool succeeded;
+};
 
+struct ModuleOutputQueue
+{
+	std::vector<ModuleOutputJob>* jobs;
+	std::atomic<size_t> nextJob;
+};
+
+// Writing only reads the (finished) generated output, and each module has its own files, so modules
+// can be written in any order without changing the results
+static void moduleOutputQueueWorker(ModuleOutputQueue* queue)
+{
 	NameStyleSettings nameSettings;
 	WriterFormatSettings formatSettings;
 
-	for (Module* module : manager.modules)
+	for (size_t jobIndex = queue->nextJob++; jobIndex < queue->jobs->size();
+	     jobIndex = queue->nextJob++)
+	{
+		ModuleOutputJob& job = (*queue->jobs)[jobIndex];
+		job.succeeded = writeGeneratorOutput(*job.module->generatedOutput, nameSettings,
+		                                     formatSettings, job.outputSettings);
+	}
+}
+
+bool moduleManagerWriteGeneratedOutput(ModuleManager& manager)
+{
+	createBuildOutputDirectory(manager.environment, manager.buildOutputDir);
+
+	// Everything which touches the environment or modules is prepared up front, so the writers
+	// only need to read
+	std::vector<ModuleOutputJob> jobs(manager.modules.size());
+	for (size_t moduleIndex = 0; moduleIndex < manager.modules.size(); ++moduleIndex)
 	{
-		WriterOutputSettings outputSettings;
+		Module* module = manager.modules[moduleIndex];
+		ModuleOutputJob& job = jobs[moduleIndex];
+		job.module = module;
+		job.succeeded = false;
+
+		WriterOutputSettings& outputSettings = job.outputSettings;
+		outputSettings = {};
 		outputSettings.sourceCakelispFilename = module->filename;
+		outputSettings.nameConversionCache = &manager.environment.nameConversionCache;
 
-		GeneratorOutput header;
-		GeneratorOutput footer;
+		GeneratorOutput& header = job.header;
+		GeneratorOutput& footer = job.footer;
 		// Something to attach the reason for generating this output
 		const Token* blameToken = &(*module->tokens)[0];
 		// Always include my header file
@@ -468,20 +1160,39 @@ bool moduleManagerWriteGeneratedOutput(ModuleManager& manager)
 		module->headerOutputName = headerOutputName;
 		outputSettings.sourceOutputName = module->sourceOutputName.c_str();
 		outputSettings.headerOutputName = module->headerOutputName.c_str();
+	}
 
-		if (!writeGeneratorOutput(*module->generatedOutput, nameSettings, formatSettings,
-		                          outputSettings))
+	ModuleOutputQueue queue;
+	queue.jobs = &jobs;
+	queue.nextJob = 0;
+
+	unsigned int numWorkers = std::thread::hardware_concurrency();
+	if (numWorkers > jobs.size())
+		numWorkers = (unsigned int)jobs.size();
+	// Metadata output from multiple threads would be interleaved and impossible to follow
+	if (log.metadata)
+		numWorkers = 1;
+
+	// This thread writes too, so there is one fewer worker to start
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < numWorkers; ++i)
+		workers.push_back(std::thread(moduleOutputQueueWorker, &queue));
+	moduleOutputQueueWorker(&queue);
+	for (std::thread& worker : workers)
+		worker.join();
+
+	for (ModuleOutputJob& job : jobs)
+	{
+		if (!job.succeeded)
 			return false;
 	}
 
 	if (log.phases || log.performance)
-		Logf("Processed %d lines\n", g_totalLinesTokenized);
+		Logf("Processed %d lines\n", g_totalLinesTokenized.load());
 
 	return true;
 }
 
-typedef std::unordered_map<std::string, unsigned long> HeaderModificationTimeTable;
-
 // It is essential to scan the #include files to determine if any of the headers have been modified,
 // because changing them could require a rebuild (for e.g., you change the size or order of a struct
 // declared in a header; all source files now need updated sizeof calls). This is annoyingly
@@ -494,7 +1205,7 @@ typedef std::unordered_map<std::string, unsigned long> HeaderModificationTimeTab
 // objects is faster. We must find the absolute time because different build objects may be more
 // recently modified than others, so they shouldn't get built. If we wanted to early out, we cannot
 // share the cache because of this
-static unsigned long GetMostRecentIncludeModified_Recursive(
+unsigned long GetMostRecentIncludeModified_Recursive(
     const std::vector<std::string>& searchDirectories, const char* filename,
     const char* includedInFile, HeaderModificationTimeTable& isModifiedCache)
 {
@@ -716,7 +1427,16 @@ bool moduleManagerBuild(ModuleManager& manager, std::vector<std::string>& builtO
 
 		for (ModulePreBuildHook hook : module->preBuildHooks)
 		{
-			if (!hook(manager, module))
+			InvocationProfileSample profileSample = {};
+			Symbol hookName;
+			if (manager.environment.enableProfiling &&
+			    findCompileTimeFunctionName(manager.environment, (void*)hook, hookName))
+				profileSample = profileInvocationBegin(manager.environment, hookName,
+				                                       ObjectType_CompileTimeFunction);
+
+			bool hookSucceeded = hook(manager, module);
+			profileInvocationEnd(manager.environment, profileSample, /*numOutputTokens=*/0);
+			if (!hookSucceeded)
 			{
 				Log("error: hook returned failure. Aborting build\n");
 				builtObjectsFree(builtObjects);
@@ -1021,7 +1741,17 @@ bool moduleManagerBuild(ModuleManager& manager, std::vector<std::string>& builtO
 		// Hooks should cooperate with eachother, i.e. try to only add things
 		for (PreLinkHook preLinkHook : manager.environment.preLinkHooks)
 		{
-			if (!preLinkHook(manager, linkCommand, linkTimeInputs, ArraySize(linkTimeInputs)))
+			InvocationProfileSample profileSample = {};
+			Symbol hookName;
+			if (manager.environment.enableProfiling &&
+			    findCompileTimeFunctionName(manager.environment, (void*)preLinkHook, hookName))
+				profileSample = profileInvocationBegin(manager.environment, hookName,
+				                                       ObjectType_CompileTimeFunction);
+
+			bool hookSucceeded =
+			    preLinkHook(manager, linkCommand, linkTimeInputs, ArraySize(linkTimeInputs));
+			profileInvocationEnd(manager.environment, profileSample, /*numOutputTokens=*/0);
+			if (!hookSucceeded)
 			{
 				Log("error: hook returned failure. Aborting build\n");
 				builtObjectsFree(builtObjects);
@@ -1153,6 +1883,7 @@ static bool moduleManagerReadCacheFile(ModuleManager& manager)
 				                                        endInvocationIndex);
 				if (artifactIndex == -1)
 				{
+					releaseTokenIndex(*tokens);
 					delete tokens;
 					return false;
 				}
@@ -1160,6 +1891,7 @@ static bool moduleManagerReadCacheFile(ModuleManager& manager)
 				    getExpectedArgument("expected crc", (*tokens), i, 2, endInvocationIndex);
 				if (crcIndex == -1)
 				{
+					releaseTokenIndex(*tokens);
 					delete tokens;
 					return false;
 				}
@@ -1172,6 +1904,7 @@ static bool moduleManagerReadCacheFile(ModuleManager& manager)
 			{
 				Logf("error: unrecognized invocation in %s: %s\n", inputFilename,
 				     invocationToken.contents.c_str());
+				releaseTokenIndex(*tokens);
 				delete tokens;
 				return false;
 			}
@@ -1180,6 +1913,7 @@ static bool moduleManagerReadCacheFile(ModuleManager& manager)
 		}
 	}
 
+	releaseTokenIndex(*tokens);
 	delete tokens;
 	return true;
 }
@@ -47,6 +47,14 @@ struct Module
 	std::vector<ModulePreBuildHook> preBuildHooks;
 };
 
+// Opaque so the threading headers aren't included everywhere (e.g. compile-time functions)
+struct ModuleTokenizeQueue;
+
+// State which outlives any one ModuleManager, so that a resident process (see Daemon.hpp) doesn't
+// need to load it again for every build. Holds the tokens of every module loaded so far, which
+// are reused if the file is unchanged. Loaded dynamic libraries are also kept open
+struct ModuleResidentState;
+
 typedef std::unordered_map<std::string, uint32_t> ArtifactCrcTable;
 typedef std::pair<const std::string, uint32_t> ArtifactCrcTablePair;
 
@@ -67,12 +75,28 @@ struct ModuleManager
 	ArtifactCrcTable cachedCommandCrcs;
 	// If any artifact no longer matches its crc in cachedCommandCrcs, the change will appear here
 	ArtifactCrcTable newCommandCrcs;
+
+	// Null unless moduleManagerPretokenizeFiles() was called
+	ModuleTokenizeQueue* tokenizeQueue;
+
+	// Null unless the manager is one of many builds in the same process. Not owned by the manager
+	ModuleResidentState* residentState;
 };
 
 void moduleManagerInitialize(ModuleManager& manager);
 void moduleManagerDestroy(ModuleManager& manager);
 
+ModuleResidentState* moduleResidentStateCreate();
+// Must only be called once no manager is using the state
+void moduleResidentStateDestroy(ModuleResidentState* residentState);
+
+// The tokens are indexed (see validateAndIndexParentheses()), so call releaseTokenIndex() before
+// deleting them
 bool moduleLoadTokenizeValidate(const char* filename, const std::vector<Token>** tokensOut);
+// Tokenize the given files, and any Cakelisp modules they import, on worker threads. This lets
+// moduleManagerAddEvaluateFile() skip tokenization of those files. Purely an optimization
+void moduleManagerPretokenizeFiles(ModuleManager& manager,
+                                   const std::vector<const char*>& filenames);
 bool moduleManagerAddEvaluateFile(ModuleManager& manager, const char* filename, Module** moduleOut);
 bool moduleManagerEvaluateResolveReferences(ModuleManager& manager);
 bool moduleManagerWriteGeneratedOutput(ModuleManager& manager);
@@ -80,3 +104,11 @@ bool moduleManagerBuild(ModuleManager& manager, std::vector<std::string>& builtO
 
 // Initializes a normal environment and outputs all generators available to it
 void listBuiltInGenerators();
+
+typedef std::unordered_map<std::string, unsigned long> HeaderModificationTimeTable;
+
+// Returns the most recent modification time of the file and everything it #includes which can be
+// found in searchDirectories. isModifiedCache may be shared between calls to save rescanning
+unsigned long GetMostRecentIncludeModified_Recursive(
+    const std::vector<std::string>& searchDirectories, const char* filename,
+    const char* includedInFile, HeaderModificationTimeTable& isModifiedCache);
@@ -4,18 +4,18 @@
 #include "GeneratorHelpers.hpp"
 #include "Utilities.hpp"
 
+static const char* g_compileTimeDefaultIncludes[] = {
+    "Evaluator.hpp", "EvaluatorEnums.hpp", "Tokenizer.hpp", "GeneratorHelpers.hpp",
+    "Utilities.hpp", "ModuleManager.hpp",  "Converters.hpp"};
+
 void makeCompileTimeHeaderFooter(GeneratorOutput& headerOut, GeneratorOutput& footerOut,
                                  GeneratorOutput* spliceAfterHeaders, const Token* blameToken)
 {
-	const char* defaultIncludes[] = {
-	    "Evaluator.hpp", "EvaluatorEnums.hpp", "Tokenizer.hpp", "GeneratorHelpers.hpp",
-	    "Utilities.hpp", "ModuleManager.hpp",  "Converters.hpp"};
-
-	for (unsigned int i = 0; i < ArraySize(defaultIncludes); ++i)
+	for (unsigned int i = 0; i < ArraySize(g_compileTimeDefaultIncludes); ++i)
 	{
 		addStringOutput(headerOut.source, "#include", StringOutMod_SpaceAfter, blameToken);
-		addStringOutput(headerOut.source, defaultIncludes[i], StringOutMod_SurroundWithQuotes,
-		                blameToken);
+		addStringOutput(headerOut.source, g_compileTimeDefaultIncludes[i],
+		                StringOutMod_SurroundWithQuotes, blameToken);
 		addLangTokenOutput(headerOut.source, StringOutMod_NewlineAfter, blameToken);
 	}
 
@@ -35,6 +35,16 @@ void makeCompileTimeHeaderFooter(GeneratorOutput& headerOut, GeneratorOutput& fo
 	addStringOutput(footerOut.source, "}", StringOutMod_None, blameToken);
 }
 
+void makeCompileTimePrelude(std::string& preludeOut)
+{
+	for (unsigned int i = 0; i < ArraySize(g_compileTimeDefaultIncludes); ++i)
+	{
+		preludeOut.append("#include \"");
+		preludeOut.append(g_compileTimeDefaultIncludes[i]);
+		preludeOut.append("\"\n");
+	}
+}
+
 void makeRunTimeHeaderFooter(GeneratorOutput& headerOut, GeneratorOutput& footerOut,
                              const Token* blameToken)
 {
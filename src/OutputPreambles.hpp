@@ -1,9 +1,13 @@
 #pragma once
 
+#include <string>
+
 struct GeneratorOutput;
 struct Token;
 
 void makeCompileTimeHeaderFooter(GeneratorOutput& headerOut, GeneratorOutput& footerOut,
                                  GeneratorOutput* spliceAfterHeaders, const Token* blameToken);
+// The #includes every compile-time object starts with, e.g. for making a precompiled header
+void makeCompileTimePrelude(std::string& preludeOut);
 void makeRunTimeHeaderFooter(GeneratorOutput& headerOut, GeneratorOutput& footerOut,
                              const Token* blameToken);
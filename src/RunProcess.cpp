@@ -5,6 +5,10 @@
 #include <vector>
 
 #ifdef UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <string.h>
 #include <sys/types.h>  // pid
 #include <sys/wait.h>   // waitpid
@@ -26,8 +30,18 @@ struct Subprocess
 {
 	int* statusOut;
 	ProcessId processId;
+	// -1 once the process has closed its output
 	int pipeReadFileDescriptor;
 	std::string command;
+	// Output read so far, if waiting on any process. Held until the process closes so the
+	// output of processes running at the same time isn't interleaved
+	std::string output;
+
+	// Standard input is written while waiting, alongside reading output, so a process which writes
+	// a lot before it finishes reading can't block us (or other processes). -1 once all written
+	int pipeWriteFileDescriptor;
+	std::string input;
+	size_t numInputBytesWritten;
 };
 
 static std::vector<Subprocess> s_subprocesses;
@@ -76,10 +90,30 @@ int runProcess(const RunProcessArguments& arguments, int* statusOut)
 		return 1;
 	}
 
+	int inputPipeFileDescriptors[2] = {-1, -1};
+	if (arguments.standardInput && pipe(inputPipeFileDescriptors) == -1)
+	{
+		perror("RunProcess: ");
+		close(pipeFileDescriptors[PipeRead]);
+		close(pipeFileDescriptors[PipeWrite]);
+		return 1;
+	}
+	// Input is written after other processes may have been spawned, so they must not inherit the
+	// write end. If they did, this process wouldn't see the end of its input until they exited
+	if (arguments.standardInput)
+		fcntl(inputPipeFileDescriptors[PipeWrite], F_SETFD, FD_CLOEXEC);
+
 	pid_t pid = fork();
 	if (pid == -1)
 	{
 		perror("RunProcess fork() error: cannot create child: ");
+		close(pipeFileDescriptors[PipeRead]);
+		close(pipeFileDescriptors[PipeWrite]);
+		if (arguments.standardInput)
+		{
+			close(inputPipeFileDescriptors[PipeRead]);
+			close(inputPipeFileDescriptors[PipeWrite]);
+		}
 		return 1;
 	}
 	// Child
@@ -95,6 +129,18 @@ int runProcess(const RunProcessArguments& arguments, int* statusOut)
 		// Only write
 		close(pipeFileDescriptors[PipeRead]);
 
+		if (arguments.standardInput)
+		{
+			if (dup2(inputPipeFileDescriptors[PipeRead], STDIN_FILENO) == -1)
+			{
+				perror("RunProcess: ");
+				return 1;
+			}
+			// Only read
+			close(inputPipeFileDescriptors[PipeRead]);
+			close(inputPipeFileDescriptors[PipeWrite]);
+		}
+
 		char** nonConstArguments = nullptr;
 		{
 			int numArgs = 0;
@@ -153,7 +199,29 @@ int runProcess(const RunProcessArguments& arguments, int* statusOut)
 			command.append(" ");
 		}
 
-		s_subprocesses.push_back({statusOut, pid, pipeFileDescriptors[PipeRead], command});
+		Subprocess newProcess = {statusOut, pid, pipeFileDescriptors[PipeRead], command, "", -1,
+		                         "", 0};
+		if (arguments.standardInput)
+		{
+			close(inputPipeFileDescriptors[PipeRead]);
+
+			// The input is written by subprocessesPollInputOutput(), so the caller's text may go
+			// away once this returns
+			newProcess.input = arguments.standardInput;
+			if (newProcess.input.empty())
+			{
+				// Closing signals end of input
+				close(inputPipeFileDescriptors[PipeWrite]);
+			}
+			else
+			{
+				fcntl(inputPipeFileDescriptors[PipeWrite], F_SETFL,
+				      fcntl(inputPipeFileDescriptors[PipeWrite], F_GETFL) | O_NONBLOCK);
+				newProcess.pipeWriteFileDescriptor = inputPipeFileDescriptors[PipeWrite];
+			}
+		}
+
+		s_subprocesses.push_back(newProcess);
 	}
 
 	return 0;
@@ -161,6 +229,92 @@ int runProcess(const RunProcessArguments& arguments, int* statusOut)
 	return 1;
 }
 
+#ifdef UNIX
+// Writes as much pending input as the processes will take, and buffers whatever output they have.
+// Blocks until at least one process's input or output is ready (or closed)
+static bool subprocessesPollInputOutput()
+{
+	std::vector<pollfd> pollFileDescriptors;
+	// Index of the process each poll entry belongs to
+	std::vector<size_t> pollProcessIndices;
+	for (size_t i = 0; i < s_subprocesses.size(); ++i)
+	{
+		const Subprocess& process = s_subprocesses[i];
+		if (process.pipeReadFileDescriptor != -1)
+		{
+			pollFileDescriptors.push_back({process.pipeReadFileDescriptor, POLLIN, 0});
+			pollProcessIndices.push_back(i);
+		}
+		if (process.pipeWriteFileDescriptor != -1)
+		{
+			pollFileDescriptors.push_back({process.pipeWriteFileDescriptor, POLLOUT, 0});
+			pollProcessIndices.push_back(i);
+		}
+	}
+
+	if (pollFileDescriptors.empty())
+		return false;
+
+	if (poll(pollFileDescriptors.data(), pollFileDescriptors.size(), /*timeout=*/-1) == -1)
+	{
+		if (errno == EINTR)
+			return true;
+		perror("RunProcess poll() error: ");
+		return false;
+	}
+
+	for (size_t i = 0; i < pollFileDescriptors.size(); ++i)
+	{
+		if (!pollFileDescriptors[i].revents)
+			continue;
+
+		Subprocess& process = s_subprocesses[pollProcessIndices[i]];
+		if (pollFileDescriptors[i].fd == process.pipeWriteFileDescriptor)
+		{
+			// Ignore SIGPIPE so a process which exits before reading all its input is reported by
+			// its status, rather than killing us
+			void (*previousSigPipeHandler)(int) = signal(SIGPIPE, SIG_IGN);
+			ssize_t numBytesWritten =
+			    write(process.pipeWriteFileDescriptor,
+			          process.input.data() + process.numInputBytesWritten,
+			          process.input.size() - process.numInputBytesWritten);
+			signal(SIGPIPE, previousSigPipeHandler);
+
+			if (numBytesWritten > 0)
+				process.numInputBytesWritten += numBytesWritten;
+			else if (numBytesWritten == -1 && (errno == EINTR || errno == EAGAIN))
+				continue;
+
+			if (numBytesWritten <= 0 || process.numInputBytesWritten == process.input.size())
+			{
+				// Closing signals end of input
+				close(process.pipeWriteFileDescriptor);
+				process.pipeWriteFileDescriptor = -1;
+				std::string().swap(process.input);
+			}
+			continue;
+		}
+
+		char processOutputBuffer[1024] = {0};
+		int numBytesRead =
+		    read(process.pipeReadFileDescriptor, processOutputBuffer, sizeof(processOutputBuffer));
+		if (numBytesRead > 0)
+		{
+			process.output.append(processOutputBuffer, numBytesRead);
+			continue;
+		}
+		if (numBytesRead == -1 && errno == EINTR)
+			continue;
+
+		// The process closed its output, so it is exiting (or has exited)
+		close(process.pipeReadFileDescriptor);
+		process.pipeReadFileDescriptor = -1;
+	}
+
+	return true;
+}
+#endif
+
 void waitForAllProcessesClosed(SubprocessOnOutputFunc onOutput)
 {
 	if (s_subprocesses.empty())
@@ -169,19 +323,40 @@ void waitForAllProcessesClosed(SubprocessOnOutputFunc onOutput)
 	for (Subprocess& process : s_subprocesses)
 	{
 #ifdef UNIX
-		char processOutputBuffer[1024] = {0};
-		int numBytesRead =
-		    read(process.pipeReadFileDescriptor, processOutputBuffer, sizeof(processOutputBuffer));
-		while (numBytesRead > 0)
+		// The process may not finish until it has all its input. Meanwhile, the others' output is
+		// buffered, so they can't block either
+		while (process.pipeWriteFileDescriptor != -1)
 		{
-			processOutputBuffer[numBytesRead] = '\0';
-			subprocessReceiveStdOut(processOutputBuffer);
-			onOutput(processOutputBuffer);
-			numBytesRead = read(process.pipeReadFileDescriptor, processOutputBuffer,
-			                    sizeof(processOutputBuffer));
+			if (!subprocessesPollInputOutput())
+			{
+				close(process.pipeWriteFileDescriptor);
+				process.pipeWriteFileDescriptor = -1;
+			}
 		}
 
-		close(process.pipeReadFileDescriptor);
+		if (!process.output.empty())
+		{
+			subprocessReceiveStdOut(process.output.c_str());
+			onOutput(process.output.c_str());
+		}
+
+		if (process.pipeReadFileDescriptor != -1)
+		{
+			// Leave room for the null terminator
+			char processOutputBuffer[1024] = {0};
+			int numBytesRead = read(process.pipeReadFileDescriptor, processOutputBuffer,
+			                        sizeof(processOutputBuffer) - 1);
+			while (numBytesRead > 0)
+			{
+				processOutputBuffer[numBytesRead] = '\0';
+				subprocessReceiveStdOut(processOutputBuffer);
+				onOutput(processOutputBuffer);
+				numBytesRead = read(process.pipeReadFileDescriptor, processOutputBuffer,
+				                    sizeof(processOutputBuffer) - 1);
+			}
+
+			close(process.pipeReadFileDescriptor);
+		}
 
 		waitpid(process.processId, process.statusOut, 0);
 
@@ -194,6 +369,48 @@ void waitForAllProcessesClosed(SubprocessOnOutputFunc onOutput)
 	s_subprocesses.clear();
 }
 
+int* waitForAnyProcessClosed(SubprocessOnOutputFunc onOutput)
+{
+	if (s_subprocesses.empty())
+		return nullptr;
+
+#ifdef UNIX
+	while (true)
+	{
+		for (size_t i = 0; i < s_subprocesses.size(); ++i)
+		{
+			Subprocess& process = s_subprocesses[i];
+			if (process.pipeReadFileDescriptor != -1)
+				continue;
+
+			// A process which closes its output without reading all its input won't read the rest
+			if (process.pipeWriteFileDescriptor != -1)
+				close(process.pipeWriteFileDescriptor);
+
+			waitpid(process.processId, process.statusOut, 0);
+
+			if (!process.output.empty())
+			{
+				subprocessReceiveStdOut(process.output.c_str());
+				onOutput(process.output.c_str());
+			}
+
+			// It's pretty useful to see the command which resulted in failure
+			if (*process.statusOut != 0)
+				Logf("%s\n", process.command.c_str());
+
+			int* statusOut = process.statusOut;
+			s_subprocesses.erase(s_subprocesses.begin() + i);
+			return statusOut;
+		}
+
+		if (!subprocessesPollInputOutput())
+			return nullptr;
+	}
+#endif
+	return nullptr;
+}
+
 void PrintProcessArguments(const char** processArguments)
 {
 	for (const char** argument = processArguments; *argument; ++argument)
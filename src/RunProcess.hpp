@@ -11,6 +11,10 @@ struct RunProcessArguments
 	// nullptr = no change (use parent process's working dir)
 	const char* workingDir;
 	const char** arguments;
+	// nullptr = inherit parent process's stdin. Otherwise, this text is copied, then written to the
+	// process's stdin while waiting on processes (see waitForAnyProcessClosed()). Its stdin is then
+	// closed
+	const char* standardInput;
 };
 
 int runProcess(const RunProcessArguments& arguments, int* statusOut);
@@ -19,6 +23,10 @@ typedef void (*SubprocessOnOutputFunc)(const char* subprocessOutput);
 
 void waitForAllProcessesClosed(SubprocessOnOutputFunc onOutput);
 
+// Waits for whichever process closes first. Returns the statusOut it was run with, which
+// identifies the process to the caller, or nullptr if there are no processes to wait for
+int* waitForAnyProcessClosed(SubprocessOnOutputFunc onOutput);
+
 //
 // Helpers for programmatically constructing arguments
 //
@@ -0,0 +1,157 @@
+#include "Symbols.hpp"
+
+#include <string.h>
+
+#include <mutex>
+#include <unordered_map>
+
+#include "Utilities.hpp"
+
+// Symbols are spread across shards, each with its own lock, so that tokenizing on many threads
+// doesn't contend on a single mutex. The low bits of an ID (minus one, so zero can be empty) select
+// the shard, and the rest are the index within that shard
+static const unsigned int numShardBits = 4;
+static const unsigned int numShards = 1 << numShardBits;
+
+// Strings are stored in fixed-size chunks which are never reallocated. This means looking up an ID
+// never needs to take a lock
+static const unsigned int chunkSizeBits = 12;
+static const unsigned int chunkSize = 1 << chunkSizeBits;
+static const unsigned int maxChunksPerShard = 4096;
+
+// Points into the interned string itself, so lookups don't need to construct a std::string
+struct SymbolKey
+{
+	const char* str;
+	size_t length;
+};
+
+struct SymbolKeyHash
+{
+	size_t operator()(const SymbolKey& key) const
+	{
+		// FNV-1a
+		uint64_t hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < key.length; ++i)
+		{
+			hash ^= (unsigned char)key.str[i];
+			hash *= 1099511628211ULL;
+		}
+		return (size_t)hash;
+	}
+};
+
+struct SymbolKeyEqual
+{
+	bool operator()(const SymbolKey& a, const SymbolKey& b) const
+	{
+		return a.length == b.length && memcmp(a.str, b.str, a.length) == 0;
+	}
+};
+
+typedef std::unordered_map<SymbolKey, SymbolId, SymbolKeyHash, SymbolKeyEqual> SymbolLookupTable;
+
+struct SymbolShard
+{
+	std::mutex mutex;
+	// Created on first use, because this is zero-initialized before any constructors run
+	SymbolLookupTable* lookup;
+	std::string* chunks[maxChunksPerShard];
+	unsigned int numSymbols;
+};
+
+static SymbolShard s_symbolShards[numShards];
+
+SymbolId symbolIntern(const char* str, size_t length)
+{
+	if (!length)
+		return SymbolId_Empty;
+
+	SymbolKey key = {str, length};
+	size_t hash = SymbolKeyHash()(key);
+	unsigned int shardIndex = hash & (numShards - 1);
+	SymbolShard& shard = s_symbolShards[shardIndex];
+
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	if (!shard.lookup)
+		shard.lookup = new SymbolLookupTable;
+
+	SymbolLookupTable::iterator findIt = shard.lookup->find(key);
+	if (findIt != shard.lookup->end())
+		return findIt->second;
+
+	unsigned int index = shard.numSymbols;
+	unsigned int chunkIndex = index >> chunkSizeBits;
+	if (chunkIndex >= maxChunksPerShard)
+	{
+		Log("error: symbol table is full. Cannot intern any more symbols\n");
+		return SymbolId_Empty;
+	}
+	if (!shard.chunks[chunkIndex])
+		shard.chunks[chunkIndex] = new std::string[chunkSize];
+
+	std::string& newString = shard.chunks[chunkIndex][index & (chunkSize - 1)];
+	newString.assign(str, length);
+	++shard.numSymbols;
+
+	SymbolId newSymbol = ((index << numShardBits) | shardIndex) + 1;
+	// The key must refer to the stored string, not the caller's, which may go away
+	SymbolKey storedKey = {newString.c_str(), newString.size()};
+	(*shard.lookup)[storedKey] = newSymbol;
+	return newSymbol;
+}
+
+bool symbolFind(const char* str, size_t length, SymbolId* symbolOut)
+{
+	if (!length)
+	{
+		*symbolOut = SymbolId_Empty;
+		return true;
+	}
+
+	SymbolKey key = {str, length};
+	size_t hash = SymbolKeyHash()(key);
+	SymbolShard& shard = s_symbolShards[hash & (numShards - 1)];
+
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	if (!shard.lookup)
+		return false;
+
+	SymbolLookupTable::iterator findIt = shard.lookup->find(key);
+	if (findIt == shard.lookup->end())
+		return false;
+	*symbolOut = findIt->second;
+	return true;
+}
+
+bool symbolFind(const char* str, Symbol* symbolOut)
+{
+	return symbolFind(str, strlen(str), &symbolOut->id);
+}
+
+bool symbolFind(const std::string& str, Symbol* symbolOut)
+{
+	return symbolFind(str.c_str(), str.size(), &symbolOut->id);
+}
+
+SymbolId symbolIntern(const char* str)
+{
+	return symbolIntern(str, strlen(str));
+}
+
+SymbolId symbolIntern(const std::string& str)
+{
+	return symbolIntern(str.c_str(), str.size());
+}
+
+const std::string& symbolGetString(SymbolId symbol)
+{
+	static const std::string emptyString;
+	if (symbol == SymbolId_Empty)
+		return emptyString;
+
+	unsigned int shardIndexAndIndex = symbol - 1;
+	const SymbolShard& shard = s_symbolShards[shardIndexAndIndex & (numShards - 1)];
+	unsigned int index = shardIndexAndIndex >> numShardBits;
+	return shard.chunks[index >> chunkSizeBits][index & (chunkSize - 1)];
+}
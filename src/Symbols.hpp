@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+// Every distinct symbol (or string) is stored exactly once, and referred to by ID. Symbols are
+// never freed and never move, so IDs and the strings they refer to are valid for the lifetime of
+// the program. Interning and looking up may be done from multiple threads at once
+typedef uint32_t SymbolId;
+
+// Always refers to the empty string. Zero so that zero-initialized structures are empty
+const SymbolId SymbolId_Empty = 0;
+
+SymbolId symbolIntern(const char* str, size_t length);
+SymbolId symbolIntern(const char* str);
+SymbolId symbolIntern(const std::string& str);
+
+// Returns false without interning str if it was never interned. Use this for lookups, e.g. by
+// name in tables keyed by Symbol, so that names which aren't there don't grow the table
+bool symbolFind(const char* str, size_t length, SymbolId* symbolOut);
+
+const std::string& symbolGetString(SymbolId symbol);
+
+// A handle to an interned string. Comparing, hashing, and copying Symbols are all integer
+// operations. It mimics the parts of std::string's interface that generators commonly use, so
+// code written against std::string (e.g. token contents, or table keys) still works.
+// Constructing one from a string interns it for good, so it is explicit. Use symbolFind() to look
+// up names instead
+struct Symbol
+{
+	SymbolId id;
+
+	Symbol() : id(SymbolId_Empty)
+	{
+	}
+	explicit Symbol(const char* str) : id(symbolIntern(str))
+	{
+	}
+	explicit Symbol(const std::string& str) : id(symbolIntern(str))
+	{
+	}
+
+	Symbol& operator=(const char* str)
+	{
+		id = symbolIntern(str);
+		return *this;
+	}
+	Symbol& operator=(const std::string& str)
+	{
+		id = symbolIntern(str);
+		return *this;
+	}
+	void assign(const char* str, size_t length)
+	{
+		id = symbolIntern(str, length);
+	}
+
+	const std::string& str() const
+	{
+		return symbolGetString(id);
+	}
+	operator const std::string&() const
+	{
+		return symbolGetString(id);
+	}
+	const char* c_str() const
+	{
+		return symbolGetString(id).c_str();
+	}
+	size_t size() const
+	{
+		return symbolGetString(id).size();
+	}
+	size_t length() const
+	{
+		return symbolGetString(id).size();
+	}
+	bool empty() const
+	{
+		return id == SymbolId_Empty;
+	}
+	char operator[](size_t index) const
+	{
+		return symbolGetString(id)[index];
+	}
+
+	int compare(const char* other) const
+	{
+		return symbolGetString(id).compare(other);
+	}
+	int compare(const std::string& other) const
+	{
+		return symbolGetString(id).compare(other);
+	}
+	int compare(const Symbol& other) const
+	{
+		if (id == other.id)
+			return 0;
+		return symbolGetString(id).compare(symbolGetString(other.id));
+	}
+
+	bool operator==(const Symbol& other) const
+	{
+		return id == other.id;
+	}
+	bool operator!=(const Symbol& other) const
+	{
+		return id != other.id;
+	}
+};
+
+bool symbolFind(const char* str, Symbol* symbolOut);
+bool symbolFind(const std::string& str, Symbol* symbolOut);
+
+// For use as a hash table key, e.g. std::unordered_map<Symbol, T, SymbolHash>
+struct SymbolHash
+{
+	size_t operator()(const Symbol& symbol) const
+	{
+		return symbol.id;
+	}
+};
@@ -1,11 +1,19 @@
 #include "Tokenizer.hpp"
 
 #include <stdio.h>
-#include <cctype>
+#include <string.h>
+
+#include <unordered_map>
 
 #include "Logging.hpp"
 #include "Utilities.hpp"
 
+// SSE2 is always available on x86-64. AVX2 is used only if the compiler was told to (e.g. with
+// -mavx2 or -march=native)
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 static const char commentCharacter = ';';
 
 enum TokenizeState
@@ -15,53 +23,173 @@ enum TokenizeState
 	TokenizeState_InString
 };
 
-int g_totalLinesTokenized = 0;
+std::atomic<int> g_totalLinesTokenized(0);
 
-// Returns nullptr if no errors, else the error text
-const char* tokenizeLine(const char* inputLine, const char* source, unsigned int lineNumber,
-                         std::vector<Token>& tokensOut)
+//
+// Scanning
+//
+// These find the end of runs of characters the tokenizer doesn't need to look at individually.
+// The vectorized versions compare 32 (AVX2) or 16 (SSE2) characters at a time, then finish with
+// the scalar version once too few characters remain for a full load
+
+// Whitespace other than newlines, which the tokenizer must see in order to count lines. Together
+// with '\n' these are the same as std::isspace() in the "C" locale, without the locale lookup
+static bool isBlank(char c)
 {
-	// For performance estimation only
-	++g_totalLinesTokenized;
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
 
-	const char* A_OK = nullptr;
+static bool isSymbolTerminator(char c)
+{
+	return isBlank(c) || c == '\n' || c == '(' || c == ')';
+}
 
-	TokenizeState tokenizeState = TokenizeState_Normal;
-	char previousChar = 0;
-
-	char contentsBuffer[1024] = {0};
-	char* contentsBufferWrite = contentsBuffer;
-#define WriteContents(character)                                                 \
-	{                                                                            \
-		if (contentsBufferWrite - contentsBuffer < (long)sizeof(contentsBuffer)) \
-		{                                                                        \
-			*contentsBufferWrite = *currentChar;                                 \
-			++contentsBufferWrite;                                               \
-			*contentsBufferWrite = '\0';                                         \
-		}                                                                        \
-		else                                                                     \
-		{                                                                        \
-			return "String too long!";                                           \
-		}                                                                        \
+#if defined(__AVX2__)
+typedef __m256i ScanVector;
+#define ScanVectorSize 32
+#define ScanLoad(at) _mm256_loadu_si256((const __m256i*)(at))
+#define ScanSet(c) _mm256_set1_epi8(c)
+#define ScanEqual(a, b) _mm256_cmpeq_epi8(a, b)
+#define ScanGreater(a, b) _mm256_cmpgt_epi8(a, b)
+#define ScanOr(a, b) _mm256_or_si256(a, b)
+#define ScanAnd(a, b) _mm256_and_si256(a, b)
+#define ScanAndNot(notA, b) _mm256_andnot_si256(notA, b)
+#define ScanMask(a) (unsigned int)_mm256_movemask_epi8(a)
+#define ScanAllMask 0xffffffffu
+#elif defined(__SSE2__)
+typedef __m128i ScanVector;
+#define ScanVectorSize 16
+#define ScanLoad(at) _mm_loadu_si128((const __m128i*)(at))
+#define ScanSet(c) _mm_set1_epi8(c)
+#define ScanEqual(a, b) _mm_cmpeq_epi8(a, b)
+#define ScanGreater(a, b) _mm_cmpgt_epi8(a, b)
+#define ScanOr(a, b) _mm_or_si128(a, b)
+#define ScanAnd(a, b) _mm_and_si128(a, b)
+#define ScanAndNot(notA, b) _mm_andnot_si128(notA, b)
+#define ScanMask(a) (unsigned int)_mm_movemask_epi8(a)
+#define ScanAllMask 0xffffu
+#endif
+
+#ifdef ScanVectorSize
+// Sets bytes which are blank (see isBlank()). \t \n \v \f \r are the contiguous range 9-13. Note
+// the comparisons are signed, which is fine because everything >= 0x80 is negative, i.e. not blank
+static ScanVector scanBlanks(ScanVector chars)
+{
+	ScanVector isControlWhitespace =
+	    ScanAnd(ScanGreater(chars, ScanSet('\t' - 1)), ScanGreater(ScanSet('\r' + 1), chars));
+	ScanVector isNewline = ScanEqual(chars, ScanSet('\n'));
+	return ScanOr(ScanEqual(chars, ScanSet(' ')), ScanAndNot(isNewline, isControlWhitespace));
+}
+
+// The index of the first set bit, i.e. the first matching character
+#define ScanFirstMatch(mask) __builtin_ctz(mask)
+#endif
+
+// Returns the first character in [at, end) which is not blank, or end
+static const char* skipBlanks(const char* at, const char* end)
+{
+#ifdef ScanVectorSize
+	for (; end - at >= ScanVectorSize; at += ScanVectorSize)
+	{
+		unsigned int notBlankMask = ScanMask(scanBlanks(ScanLoad(at))) ^ ScanAllMask;
+		if (notBlankMask)
+			return at + ScanFirstMatch(notBlankMask);
 	}
-#define CopyContentsAndReset(outputString)    \
-	{                                         \
-		outputString = contentsBuffer;        \
-		contentsBufferWrite = contentsBuffer; \
+#endif
+
+	while (at < end && isBlank(*at))
+		++at;
+	return at;
+}
+
+// Returns the first character in [at, end) which finishes a symbol, or end
+static const char* findSymbolEnd(const char* at, const char* end)
+{
+#ifdef ScanVectorSize
+	for (; end - at >= ScanVectorSize; at += ScanVectorSize)
+	{
+		ScanVector chars = ScanLoad(at);
+		ScanVector isParenthesis =
+		    ScanOr(ScanEqual(chars, ScanSet('(')), ScanEqual(chars, ScanSet(')')));
+		ScanVector isTerminator =
+		    ScanOr(ScanOr(scanBlanks(chars), ScanEqual(chars, ScanSet('\n'))), isParenthesis);
+		unsigned int terminatorMask = ScanMask(isTerminator);
+		if (terminatorMask)
+			return at + ScanFirstMatch(terminatorMask);
 	}
+#endif
+
+	while (at < end && !isSymbolTerminator(*at))
+		++at;
+	return at;
+}
+
+// Returns the first quote or newline in [at, end), or end. Escaped quotes are not skipped
+static const char* findStringEnd(const char* at, const char* end)
+{
+#ifdef ScanVectorSize
+	for (; end - at >= ScanVectorSize; at += ScanVectorSize)
+	{
+		ScanVector chars = ScanLoad(at);
+		unsigned int endMask =
+		    ScanMask(ScanOr(ScanEqual(chars, ScanSet('"')), ScanEqual(chars, ScanSet('\n'))));
+		if (endMask)
+			return at + ScanFirstMatch(endMask);
+	}
+#endif
+
+	while (at < end && *at != '"' && *at != '\n')
+		++at;
+	return at;
+}
+
+//
+// Tokenization
+//
+
+// Tokenizes from inputStart up to (exclusive) inputEnd, which may span many lines. The input does
+// not need to be null-terminated, and symbol and string contents are copied directly out of the
+// input, so no intermediate buffers are needed. lineNumberInOut is advanced for each newline, and
+// will be the line the error occurred on if an error is returned.
+// Returns nullptr if no errors, else the error text
+static const char* tokenizeRange(const char* inputStart, const char* inputEnd, const char* source,
+                                 unsigned int* lineNumberInOut, std::vector<Token>& tokensOut)
+{
+	const char* A_OK = nullptr;
+
+	TokenizeState tokenizeState = TokenizeState_Normal;
+
+	unsigned int lineNumber = *lineNumberInOut;
+	const char* lineStart = inputStart;
+	// Start of the symbol or string currently being read. Strings start after the opening quote
+	const char* contentsStart = nullptr;
 
 	int columnStart = 0;
 
-	for (const char* currentChar = inputLine; *currentChar != '\0'; ++currentChar)
+	// For performance estimation only. Tallied locally because multiple threads may tokenize
+	int numLinesTokenized = 1;
+	if (log.tokenization)
 	{
-		int currentColumn = currentChar - inputLine;
+		const char* lineEnd = (const char*)memchr(lineStart, '\n', inputEnd - lineStart);
+		Logf("%.*s\n", (int)((lineEnd ? lineEnd : inputEnd) - lineStart), lineStart);
+	}
+
+	for (const char* currentChar = inputStart; currentChar < inputEnd; ++currentChar)
+	{
+		int currentColumn = currentChar - lineStart;
 
 		switch (tokenizeState)
 		{
 			case TokenizeState_Normal:
-				// The whole rest of the line is ignored
+				// The whole rest of the line is ignored. Skip straight to the newline (if any) so
+				// it can advance the line number
 				if (*currentChar == commentCharacter)
-					return A_OK;
+				{
+					const char* lineEnd =
+					    (const char*)memchr(currentChar, '\n', inputEnd - currentChar);
+					// The comment may run to the end of the input
+					currentChar = lineEnd ? lineEnd : inputEnd - 1;
+				}
 				else if (*currentChar == '(')
 				{
 					Token openParen = {TokenType_OpenParen, EmptyString,   source,
@@ -78,32 +206,47 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 				{
 					tokenizeState = TokenizeState_InString;
 					columnStart = currentColumn;
+					contentsStart = currentChar + 1;
 				}
-				else if (std::isspace(*currentChar))
+				else if (isBlank(*currentChar))
 				{
 					// We could error here if the last symbol was a open paren, but we'll just
-					// ignore it for now and be extra permissive
+					// ignore it for now and be extra permissive. Skip the whole run (e.g.
+					// indentation), stopping on the last blank so the loop steps off of it
+					currentChar = skipBlanks(currentChar + 1, inputEnd) - 1;
+				}
+				else if (*currentChar == '\n')
+				{
+					// Handled after the switch
 				}
 				else
 				{
 					// Basically anything but parens, whitespace, or quotes can be symbols!
 					tokenizeState = TokenizeState_Symbol;
 					columnStart = currentColumn;
-					WriteContents(*currentChar);
+					contentsStart = currentChar;
 				}
 				break;
 			case TokenizeState_Symbol:
 			{
-				bool isParenthesis = *currentChar == ')' || *currentChar == '(';
+				currentChar = findSymbolEnd(currentChar, inputEnd);
+				// Symbols cannot span lines, so lineStart is still valid
+				currentColumn = currentChar - lineStart;
+				if (currentChar == inputEnd)
+				{
+					// Unterminated. Let the loop finish so the error is reported
+					currentChar = inputEnd - 1;
+				}
 				// Finished the symbol
-				if (std::isspace(*currentChar) || *currentChar == '\n' || isParenthesis)
+				else
 				{
-					if (log.tokenization)
-						Logf("%s\n", contentsBuffer);
 					Token symbol = {TokenType_Symbol, EmptyString, source,
 					                lineNumber,       columnStart, currentColumn};
-					CopyContentsAndReset(symbol.contents);
 					tokensOut.push_back(symbol);
+					// Assign in place to avoid copying the contents into the array
+					tokensOut.back().contents.assign(contentsStart, currentChar - contentsStart);
+					if (log.tokenization)
+						Logf("%s\n", tokensOut.back().contents.c_str());
 
 					if (*currentChar == '(')
 					{
@@ -120,36 +263,57 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 
 					tokenizeState = TokenizeState_Normal;
 				}
-				else
-				{
-					WriteContents(*currentChar);
-				}
 				break;
 			}
 			case TokenizeState_InString:
-				if (*currentChar == '"' && previousChar != '\\')
+				currentChar = findStringEnd(currentChar, inputEnd);
+				currentColumn = currentChar - lineStart;
+				if (currentChar == inputEnd)
+				{
+					// Unterminated. Let the loop finish so the error is reported
+					currentChar = inputEnd - 1;
+				}
+				// Strings may not span lines
+				else if (*currentChar == '\n')
+				{
+					g_totalLinesTokenized += numLinesTokenized;
+					*lineNumberInOut = lineNumber;
+					return "Unterminated string";
+				}
+				// The opening quote precedes contentsStart, so there is always a previous character
+				else if (*currentChar == '"' && *(currentChar - 1) != '\\')
 				{
 					Token string = {TokenType_String, EmptyString, source,
 					                lineNumber,       columnStart, currentColumn + 1};
-					CopyContentsAndReset(string.contents);
 					tokensOut.push_back(string);
+					tokensOut.back().contents.assign(contentsStart, currentChar - contentsStart);
 
-					contentsBufferWrite = contentsBuffer;
 					tokenizeState = TokenizeState_Normal;
 				}
-				else
-				{
-					WriteContents(*currentChar);
-				}
 				break;
 			default:
+				g_totalLinesTokenized += numLinesTokenized;
+				*lineNumberInOut = lineNumber;
 				return "Unknown state! Aborting";
 		}
 
-		previousChar = *currentChar;
+		// The symbol state has already finished by now, so we can safely move to the next line
+		if (*currentChar == '\n' && currentChar + 1 < inputEnd)
+		{
+			++lineNumber;
+			lineStart = currentChar + 1;
+
+			++numLinesTokenized;
+			if (log.tokenization)
+			{
+				const char* lineEnd = (const char*)memchr(lineStart, '\n', inputEnd - lineStart);
+				Logf("%.*s\n", (int)((lineEnd ? lineEnd : inputEnd) - lineStart), lineStart);
+			}
+		}
 	}
-#undef WriteContents
-#undef CopyContentsAndReset
+
+	g_totalLinesTokenized += numLinesTokenized;
+	*lineNumberInOut = lineNumber;
 
 	if (tokenizeState != TokenizeState_Normal)
 	{
@@ -167,6 +331,24 @@ const char* tokenizeLine(const char* inputLine, const char* source, unsigned int
 	return A_OK;
 }
 
+// Returns nullptr if no errors, else the error text
+const char* tokenizeLine(const char* inputLine, const char* source, unsigned int lineNumber,
+                         std::vector<Token>& tokensOut)
+{
+	return tokenizeRange(inputLine, inputLine + strlen(inputLine), source, &lineNumber, tokensOut);
+}
+
+const char* tokenizeFile(const char* contents, unsigned long contentsSize, const char* source,
+                         unsigned int firstLineNumber, unsigned int* lineNumberOut,
+                         std::vector<Token>& tokensOut)
+{
+	*lineNumberOut = firstLineNumber;
+	if (!contents || !contentsSize)
+		return nullptr;
+
+	return tokenizeRange(contents, contents + contentsSize, source, lineNumberOut, tokensOut);
+}
+
 const char* tokenTypeToString(TokenType type)
 {
 	switch (type)
@@ -184,43 +366,194 @@ const char* tokenTypeToString(TokenType type)
 	}
 }
 
-bool validateParentheses(const std::vector<Token>& tokens)
+//
+// Token array indices
+//
+// validateAndIndexParentheses() indexes each token array it validates: the matching parenthesis of
+// every parenthesis, and where each list's children start. This lets generators find the end of an
+// invocation or its Nth argument without scanning. Token arrays are immutable once created, so the
+// index stays valid until the array's owner releases it. Arrays nobody indexed (e.g. ones built by
+// user compile-time code) are scanned instead. Only used from the evaluation thread
+
+struct TokenIndex
 {
-	int nestingDepth = 0;
-	const Token* lastTopLevelOpenParen = nullptr;
-	for (const Token& token : tokens)
-	{
-		if (token.type == TokenType_OpenParen)
-		{
-			if (nestingDepth == 0)
-				lastTopLevelOpenParen = &token;
+	// Checked on lookup to catch an array which was destroyed without releasing its index
+	const std::vector<Token>* tokens;
+	size_t numTokens;
+	// The index of the matching parenthesis, or -1 for tokens which aren't parentheses
+	std::vector<int> matchingIndices;
+	// Token i's children are childStartIndices[childListStarts[i]] up to (but not including)
+	// childStartIndices[childListStarts[i + 1]]. Only open parentheses have children
+	std::vector<int> childListStarts;
+	std::vector<int> childStartIndices;
+};
 
-			++nestingDepth;
-		}
-		else if (token.type == TokenType_CloseParen)
+// Keyed on the token array's data rather than the vector, because the data is what must not move
+typedef std::unordered_map<const Token*, TokenIndex> TokenIndexTable;
+static TokenIndexTable s_tokenIndices;
+
+// Most lookups are on the same array as the last one, e.g. while a generator walks its arguments
+static const Token* s_lastIndexTokens = nullptr;
+static const TokenIndex* s_lastIndex = nullptr;
+
+static bool validateParenthesesInternal(const std::vector<Token>& tokens, bool shouldIndex)
+{
+	int numTokens = (int)tokens.size();
+	std::vector<int> matchingIndices(numTokens, -1);
+	std::vector<int> childListStarts(numTokens + 1, 0);
+	std::vector<int> openParenIndices;
+	for (int i = 0; i < numTokens; ++i)
+	{
+		const Token& token = tokens[i];
+		if (token.type == TokenType_CloseParen)
 		{
-			--nestingDepth;
-			if (nestingDepth < 0)
+			if (openParenIndices.empty())
 			{
 				ErrorAtToken(token,
 				             "Mismatched parenthesis. Too many closing parentheses, or missing "
 				             "opening parenthesies");
 				return false;
 			}
+
+			int openParenIndex = openParenIndices.back();
+			openParenIndices.pop_back();
+			matchingIndices[openParenIndex] = i;
+			matchingIndices[i] = openParenIndex;
+			continue;
 		}
+
+		// Count children for now. They are recorded once we know where each list's go
+		if (!openParenIndices.empty())
+			++childListStarts[openParenIndices.back() + 1];
+
+		if (token.type == TokenType_OpenParen)
+			openParenIndices.push_back(i);
 	}
 
-	if (nestingDepth != 0)
+	if (!openParenIndices.empty())
 	{
 		ErrorAtToken(
-		    *lastTopLevelOpenParen,
+		    tokens[openParenIndices.front()],
 		    "Mismatched parenthesis. Missing closing parentheses, or too many opening parentheses");
 		return false;
 	}
 
+	if (tokens.empty() || !shouldIndex)
+		return true;
+
+	for (int i = 0; i < numTokens; ++i)
+		childListStarts[i + 1] += childListStarts[i];
+
+	std::vector<int> childStartIndices(childListStarts[numTokens]);
+	std::vector<int> nextChildWriteIndices(childListStarts.begin(), childListStarts.end() - 1);
+	for (int i = 0; i < numTokens; ++i)
+	{
+		const Token& token = tokens[i];
+		if (token.type == TokenType_CloseParen)
+		{
+			openParenIndices.pop_back();
+			continue;
+		}
+
+		if (!openParenIndices.empty())
+			childStartIndices[nextChildWriteIndices[openParenIndices.back()]++] = i;
+
+		if (token.type == TokenType_OpenParen)
+			openParenIndices.push_back(i);
+	}
+
+	releaseTokenIndex(tokens);
+	TokenIndex& index = s_tokenIndices[tokens.data()];
+	index.tokens = &tokens;
+	index.numTokens = tokens.size();
+	index.matchingIndices.swap(matchingIndices);
+	index.childListStarts.swap(childListStarts);
+	index.childStartIndices.swap(childStartIndices);
+
 	return true;
 }
 
+bool validateParentheses(const std::vector<Token>& tokens)
+{
+	return validateParenthesesInternal(tokens, /*shouldIndex=*/false);
+}
+
+bool validateAndIndexParentheses(const std::vector<Token>& tokens)
+{
+	return validateParenthesesInternal(tokens, /*shouldIndex=*/true);
+}
+
+static const TokenIndex* findTokenIndex(const std::vector<Token>& tokens)
+{
+	if (tokens.empty())
+		return nullptr;
+
+	const TokenIndex* index = nullptr;
+	if (s_lastIndexTokens == tokens.data())
+		index = s_lastIndex;
+	else
+	{
+		TokenIndexTable::iterator findIt = s_tokenIndices.find(tokens.data());
+		if (findIt == s_tokenIndices.end())
+			return nullptr;
+		index = &findIt->second;
+		s_lastIndexTokens = tokens.data();
+		s_lastIndex = index;
+	}
+
+	// Only indexed arrays are in the table, and their owners release them before destroying them.
+	// Still, don't trust an index which doesn't belong to this exact array
+	if (index->tokens != &tokens || index->numTokens != tokens.size())
+		return nullptr;
+
+	return index;
+}
+
+int findMatchingParenthesis(const std::vector<Token>& tokens, int tokenIndex)
+{
+	const TokenIndex* index = findTokenIndex(tokens);
+	if (!index)
+		return -1;
+
+	return index->matchingIndices[tokenIndex];
+}
+
+int findNextSibling(const std::vector<Token>& tokens, int tokenIndex)
+{
+	const TokenIndex* index = findTokenIndex(tokens);
+	if (!index)
+		return -1;
+
+	if (tokens[tokenIndex].type == TokenType_OpenParen)
+		return index->matchingIndices[tokenIndex] + 1;
+	return tokenIndex + 1;
+}
+
+int getListChildren(const std::vector<Token>& tokens, int openParenIndex,
+                    const int** childStartIndicesOut)
+{
+	const TokenIndex* index = findTokenIndex(tokens);
+	if (!index || tokens[openParenIndex].type != TokenType_OpenParen)
+		return -1;
+
+	int firstChild = index->childListStarts[openParenIndex];
+	*childStartIndicesOut = index->childStartIndices.data() + firstChild;
+	return index->childListStarts[openParenIndex + 1] - firstChild;
+}
+
+void releaseTokenIndex(const std::vector<Token>& tokens)
+{
+	if (tokens.empty())
+		return;
+
+	if (s_lastIndexTokens == tokens.data())
+	{
+		s_lastIndexTokens = nullptr;
+		s_lastIndex = nullptr;
+	}
+	s_tokenIndices.erase(tokens.data());
+}
+
 bool appendTokenToString(const Token& token, char** at, char* bufferStart, int bufferSize)
 {
 	switch (token.type)
@@ -1,17 +1,22 @@
 #pragma once
 
-#include <vector>
+#include <atomic>
 #include <string>
+#include <vector>
 
+#include "Symbols.hpp"
 #include "TokenEnums.hpp"
 
 const char* tokenTypeToString(TokenType type);
 
+// Token columns are clamped to this rather than wrapping around. Errors show it as e.g. "65536+"
+const unsigned short maxTokenColumn = 65535;
+
 struct Token
 {
 	TokenType type;
-	// Only non-empty if type is ambiguous
-	std::string contents;
+	// Only non-empty if type is ambiguous. Interned, so comparing contents of tokens is cheap
+	Symbol contents;
 
 	// The origin of this token, for debugging etc.
 	// This is a filename for handwritten code, and something else for macro-generated tokens
@@ -19,9 +24,45 @@ struct Token
 	// Starting at 1, because no text editor starts at "line 0"
 	unsigned int lineNumber;
 	// Includes quotation marks of strings. \t etc. only count as 1 column
-	int columnStart;
+	// Columns past maxTokenColumn are clamped to it. Keeping these small keeps Token at 24 bytes
+	unsigned short columnStart;
 	// Exclusive, e.g. line with "(a" would have start 0 end 1, the 'a' would have start 1 end 2
-	int columnEnd;
+	unsigned short columnEnd;
+
+	Token()
+	    : type(TokenType_OpenParen), source(nullptr), lineNumber(0), columnStart(0), columnEnd(0)
+	{
+	}
+	// Allows the same {type, contents, source, line, start, end} initialization as before columns
+	// were narrowed, without narrowing conversion errors
+	Token(TokenType newType, const Symbol& newContents, const char* newSource,
+	      unsigned int newLineNumber, int newColumnStart, int newColumnEnd)
+	    : type(newType),
+	      contents(newContents),
+	      source(newSource),
+	      lineNumber(newLineNumber),
+	      columnStart(clampColumn(newColumnStart)),
+	      columnEnd(clampColumn(newColumnEnd))
+	{
+	}
+	// Making a token keeps its contents, so these intern them
+	Token(TokenType newType, const char* newContents, const char* newSource,
+	      unsigned int newLineNumber, int newColumnStart, int newColumnEnd)
+	    : Token(newType, Symbol(newContents), newSource, newLineNumber, newColumnStart,
+	            newColumnEnd)
+	{
+	}
+	Token(TokenType newType, const std::string& newContents, const char* newSource,
+	      unsigned int newLineNumber, int newColumnStart, int newColumnEnd)
+	    : Token(newType, Symbol(newContents), newSource, newLineNumber, newColumnStart,
+	            newColumnEnd)
+	{
+	}
+
+	static unsigned short clampColumn(int column)
+	{
+		return column > maxTokenColumn ? maxTokenColumn : (unsigned short)column;
+	}
 };
 
 void destroyToken(Token* token);
@@ -30,11 +71,36 @@ void destroyToken(Token* token);
 // No state past a single line means this could be called in parallel
 const char* tokenizeLine(const char* inputLine, const char* source, unsigned int lineNumber,
                          std::vector<Token>& tokensOut);
+// Tokenizes an entire file's contents in one pass, without needing per-line copies or null
+// termination (e.g. the output of fileMapReadOnly()). lineNumberOut is set to the last line
+// tokenized, which is the line of the error if one is returned.
+// Returns nullptr if no errors, else the error text
+const char* tokenizeFile(const char* contents, unsigned long contentsSize, const char* source,
+                         unsigned int firstLineNumber, unsigned int* lineNumberOut,
+                         std::vector<Token>& tokensOut);
 // Invocations of this are generated by TokenizePushGenerator()
 bool tokenizeLinePrintError(const char* inputLine, const char* source, unsigned int lineNumber,
                             std::vector<Token>& tokensOut);
 
 bool validateParentheses(const std::vector<Token>& tokens);
+// Also indexes the lists in tokens, for findMatchingParenthesis() and getListChildren(). Only for
+// token arrays whose owner is certain to call releaseTokenIndex() before destroying them (modules,
+// macro expansions, etc.); a stale index would give wrong answers for a new array at the same
+// address. tokens must not be modified after being indexed
+bool validateAndIndexParentheses(const std::vector<Token>& tokens);
+// Returns the index of the parenthesis matching the one at tokenIndex, or -1 if tokens were never
+// indexed. Prefer FindCloseParenTokenIndex(), which works on any token array
+int findMatchingParenthesis(const std::vector<Token>& tokens, int tokenIndex);
+// Returns the index of the token after the list or atom starting at tokenIndex, which is where its
+// next sibling starts (or its parent's closing parenthesis). Returns -1 if tokens were never
+// indexed. Prefer getNextArgument(), which works on any token array
+int findNextSibling(const std::vector<Token>& tokens, int tokenIndex);
+// Returns the number of children of the list opened at openParenIndex, and sets
+// childStartIndicesOut to the index of each child's first token. Returns -1 if tokens were never
+// indexed. Prefer getArgument() etc., which work on any token array
+int getListChildren(const std::vector<Token>& tokens, int openParenIndex,
+                    const int** childStartIndicesOut);
+void releaseTokenIndex(const std::vector<Token>& tokens);
 
 void printTokens(const std::vector<Token>& tokens);
 void prettyPrintTokens(const std::vector<Token>& tokens);
@@ -46,4 +112,7 @@ bool writeStringToBufferErrorToken(const char* str, char** at, char* bufferStart
                                    const Token& token);
 bool appendTokenToString(const Token& token, char** at, char* bufferStart, int bufferSize);
 
-extern int g_totalLinesTokenized;
+// Increment whenever a tokenizer change could produce different tokens. Invalidates token caches
+const unsigned int g_tokenizerVersion = 1;
+
+extern std::atomic<int> g_totalLinesTokenized;
@@ -38,21 +38,24 @@ bool writeStringToBuffer(const char* str, char** at, char* bufferStart, int buff
 // The first character is at 1 (at least, in Emacs, when following this error, it takes you
 // to the start of the line with e.g. column 1)
 // TODO: Add Clang-style error arrow note via function "print line N of filename"
-#define ErrorAtTokenf(token, format, ...)                                                \
-	fprintf(stderr, "%s:%d:%d: error: " format "\n", (token).source, (token).lineNumber, \
-	        1 + (token).columnStart, __VA_ARGS__)
+// Tokens on very long lines have clamped columns (see maxTokenColumn)
+#define TokenColumnSuffix(token) ((token).columnStart == maxTokenColumn ? "+" : "")
 
-#define ErrorAtToken(token, message)                                             \
-	fprintf(stderr, "%s:%d:%d: error: %s\n", (token).source, (token).lineNumber, \
-	        1 + (token).columnStart, message)
+#define ErrorAtTokenf(token, format, ...)                                                  \
+	fprintf(stderr, "%s:%d:%d%s: error: " format "\n", (token).source, (token).lineNumber, \
+	        1 + (token).columnStart, TokenColumnSuffix(token), __VA_ARGS__)
 
-#define NoteAtToken(token, message)                                             \
-	fprintf(stderr, "%s:%d:%d: note: %s\n", (token).source, (token).lineNumber, \
-	        1 + (token).columnStart, message)
+#define ErrorAtToken(token, message)                                               \
+	fprintf(stderr, "%s:%d:%d%s: error: %s\n", (token).source, (token).lineNumber, \
+	        1 + (token).columnStart, TokenColumnSuffix(token), message)
 
-#define NoteAtTokenf(token, format, ...)                                                \
-	fprintf(stderr, "%s:%d:%d: note: " format "\n", (token).source, (token).lineNumber, \
-	        1 + (token).columnStart, __VA_ARGS__)
+#define NoteAtToken(token, message)                                               \
+	fprintf(stderr, "%s:%d:%d%s: note: %s\n", (token).source, (token).lineNumber, \
+	        1 + (token).columnStart, TokenColumnSuffix(token), message)
+
+#define NoteAtTokenf(token, format, ...)                                                  \
+	fprintf(stderr, "%s:%d:%d%s: note: " format "\n", (token).source, (token).lineNumber, \
+	        1 + (token).columnStart, TokenColumnSuffix(token), __VA_ARGS__)
 
 #define PushBackAll(dest, src) (dest).insert((dest).end(), (src).begin(), (src).end())
 
@@ -8,77 +8,57 @@
 #include "Utilities.hpp"
 
 // TODO: safe version of strcat
-#include <stdarg.h>  // va_start
 #include <stdio.h>
 #include <string.h>
 
-bool writeIfContentsNewer(const char* tempFilename, const char* outputFilename)
-{
-	// Read temporary file and destination file and compare
-	FILE* newFile = fopen(tempFilename, "r");
-	if (!newFile)
-	{
-		Logf("error: Could not open %s\n", tempFilename);
-		return false;
-	}
-	FILE* oldFile = fopen(outputFilename, "r");
-	if (!oldFile)
-	{
-		// Write new and remove temp
-		if (log.fileSystem)
-			Log("Destination file didn't exist. Writing\n");
+#include <atomic>
 
-		return moveFile(tempFilename, outputFilename);
-	}
-	else
+bool writeIfContentsChanged(const char* contents, unsigned long size, const char* outputFilename)
+{
+	if (fileExists(outputFilename))
 	{
-		if (log.fileSystem)
-			Log("Destination file exists. Comparing\n");
-
-		char newBuffer[1024] = {0};
-		char oldBuffer[1024] = {0};
-		bool identical = true;
-		while (1)
+		// Sizes differ for most changes, so comparing contents is rarely necessary
+		const char* oldContents = nullptr;
+		unsigned long oldSize = 0;
+		if (fileMapReadOnly(outputFilename, &oldContents, &oldSize))
 		{
-			bool newBufferRead = fgets(newBuffer, sizeof(newBuffer), newFile) != nullptr;
-			bool oldBufferRead = fgets(oldBuffer, sizeof(oldBuffer), oldFile) != nullptr;
-			if (!newBufferRead || !oldBufferRead)
-			{
-				if (newBufferRead != oldBufferRead)
-					identical = false;
-				break;
-			}
+			bool isIdentical =
+			    oldSize == size && (size == 0 || memcmp(oldContents, contents, size) == 0);
+			if (oldContents)
+				fileUnmap(oldContents, oldSize);
 
-			if (memcmp(newBuffer, oldBuffer, sizeof(newBuffer)) != 0)
+			if (isIdentical)
 			{
-				identical = false;
-				break;
+				if (log.fileSystem)
+					Logf("%s is identical. Skipping\n", outputFilename);
+				return true;
 			}
 		}
 
-		if (identical)
-		{
-			if (log.fileSystem)
-				Log("Files are identical. Skipping\n");
-
-			fclose(newFile);
-			fclose(oldFile);
-			if (remove(tempFilename) != 0)
-			{
-				Logf("Failed to remove %s\n", tempFilename);
-				return false;
-			}
-			return true;
-		}
-
 		if (log.fileSystem)
-			Log("File changed. writing\n");
-
-		fclose(newFile);
-		fclose(oldFile);
+			Logf("%s changed. Writing\n", outputFilename);
+	}
+	else if (log.fileSystem)
+		Logf("%s didn't exist. Writing\n", outputFilename);
+
+	// Write to a temporary file first, so neither an interrupted write nor another build reading
+	// this output while it's written will ever see a partially written file
+	char tempFilename[MAX_PATH_LENGTH] = {0};
+	makeUniqueTemporaryFilename(outputFilename, tempFilename, sizeof(tempFilename));
+	FILE* file = fileOpen(tempFilename, "wb");
+	if (!file)
+		return false;
 
-		return moveFile(tempFilename, outputFilename);
+	bool isWritten = fwrite(contents, 1, size, file) == size;
+	if (fclose(file) != 0)
+		isWritten = false;
+	if (!isWritten || !replaceFile(tempFilename, outputFilename))
+	{
+		Logf("error: Failed to write %s\n", outputFilename);
+		remove(tempFilename);
+		return false;
 	}
+	return true;
 }
 
 const char* importLanguageToString(ImportLanguage type)
@@ -106,10 +86,10 @@ static NameStyleMode getNameStyleModeForFlags(const NameStyleSettings& settings,
 		++numMatchingFlags;
 		mode = settings.typeNameMode;
 
-		static bool hasWarned = false;
-		if (!hasWarned && mode == NameStyleMode_PascalCase)
+		// Modules may be written from several threads
+		static std::atomic<bool> hasWarned(false);
+		if (mode == NameStyleMode_PascalCase && !hasWarned.exchange(true))
 		{
-			hasWarned = true;
 			Log(
 			    "\nWarning: Use of PascalCase for type names is discouraged because it will "
 			    "destroy lowercase C type names. You should use PascalCaseIfPlural instead, which "
@@ -141,23 +121,35 @@ struct StringOutputState
 	int numCharsOutput;
 	int currentLine;
 	int lastLineIndented;
-	FILE* fileOut;
+	// Output is built in memory, then only written if it differs from what is already on disk
+	std::string* bufferOut;
+	NameConversionCache* nameConversionCache;
 };
 
 // TODO Have writer scan strings for \n?
-static void Writer_Writef(StringOutputState& state, const char* format, ...)
+// Everything written is either text from an operation or a constant, so nothing needs formatting
+static void Writer_Write(StringOutputState& state, const char* text, size_t length)
 {
-	va_list args;
-	va_start(args, format);
-	if (state.fileOut)
-	{
-		state.numCharsOutput += vfprintf(state.fileOut, format, args);
-	}
-	else
-	{
-		state.numCharsOutput += vprintf(format, args);
-	}
-	va_end(args);
+	state.bufferOut->append(text, length);
+	state.numCharsOutput += (int)length;
+}
+
+static void Writer_Write(StringOutputState& state, const char* text)
+{
+	Writer_Write(state, text, strlen(text));
+}
+
+static void Writer_Write(StringOutputState& state, const Symbol& text)
+{
+	const std::string& textString = text.str();
+	Writer_Write(state, textString.data(), textString.size());
+}
+
+static void Writer_Write(StringOutputState& state, const StringOutput& operation)
+{
+	size_t length = 0;
+	const char* text = stringOutputGetText(operation, &length);
+	Writer_Write(state, text, length);
 }
 
 static void printIndentation(const WriterFormatSettings& formatSettings, StringOutputState& state)
@@ -173,7 +165,7 @@ static void printIndentation(const WriterFormatSettings& formatSettings, StringO
 	{
 		for (int i = 0; i < state.blockDepth; ++i)
 		{
-			Writer_Writef(state, "\t");
+			Writer_Write(state, "\t");
 		}
 	}
 	else if (formatSettings.indentStyle == WriterFormatIndentType_Spaces)
@@ -181,7 +173,7 @@ static void printIndentation(const WriterFormatSettings& formatSettings, StringO
 		for (int i = 0; i < state.blockDepth; ++i)
 		{
 			for (int spaces = 0; spaces < formatSettings.indentTabWidth; ++spaces)
-				Writer_Writef(state, " ");
+				Writer_Write(state, " ");
 		}
 	}
 }
@@ -213,27 +205,40 @@ static void writeStringOutput(const NameStyleSettings& nameSettings,
 	updateDepthDoIndentation(formatSettings, outputOperation, state);
 
 	if (outputOperation.modifiers & StringOutMod_SpaceBefore)
-		Writer_Writef(state, " ");
+		Writer_Write(state, " ");
 
 	// TODO Validate flags for e.g. OpenParen | CloseParen, which shouldn't be allowed
 	NameStyleMode mode = getNameStyleModeForFlags(nameSettings, outputOperation.modifiers);
-	if (mode)
+	// Names are interned unless a conversion modifier was added after the text was set
+	if (mode && state.nameConversionCache && !outputOperation.symbol.empty())
+	{
+		Symbol convertedName =
+		    lispNameStyleToCNameStyleCached(*state.nameConversionCache, mode,
+		                                    outputOperation.symbol, *outputOperation.startToken);
+		Writer_Write(state, convertedName);
+	}
+	else if (mode)
 	{
 		char convertedName[MAX_NAME_LENGTH] = {0};
-		lispNameStyleToCNameStyle(mode, outputOperation.output.c_str(), convertedName,
-		                          sizeof(convertedName), *outputOperation.startToken);
-		Writer_Writef(state, "%s", convertedName);
+		lispNameStyleToCNameStyle(mode, stringOutputGetText(outputOperation, nullptr),
+		                          convertedName, sizeof(convertedName),
+		                          *outputOperation.startToken);
+		Writer_Write(state, convertedName);
 	}
 	else if (outputOperation.modifiers & StringOutMod_SurroundWithQuotes)
-		Writer_Writef(state, "\"%s\"", outputOperation.output.c_str());
+	{
+		Writer_Write(state, "\"", 1);
+		Writer_Write(state, outputOperation);
+		Writer_Write(state, "\"", 1);
+	}
 	// Just by changing these we can change the output formatting
 	else if (outputOperation.modifiers & StringOutMod_OpenBlock)
 	{
 		if (formatSettings.uglyPrint)
-			Writer_Writef(state, "{");
+			Writer_Write(state, "{");
 		else if (formatSettings.braceStyle == WriterFormatBraceStyle_Allman)
 		{
-			Writer_Writef(state, "\n");
+			Writer_Write(state, "\n");
 			state.currentLine += 1;
 
 			// Allman brackets are not as deep as their contents, but this bracket was already
@@ -243,54 +248,54 @@ static void writeStringOutput(const NameStyleSettings& nameSettings,
 			printIndentation(formatSettings, state);
 			state.blockDepth += 1;
 
-			Writer_Writef(state, "{\n");
+			Writer_Write(state, "{\n");
 			state.currentLine += 1;
 		}
 		else if (formatSettings.braceStyle == WriterFormatBraceStyle_KandR_1TBS)
 		{
-			Writer_Writef(state, " {\n");
+			Writer_Write(state, " {\n");
 			state.currentLine += 1;
 		}
 	}
 	else if (outputOperation.modifiers & StringOutMod_CloseBlock)
 	{
 		if (formatSettings.uglyPrint)
-			Writer_Writef(state, "}");
+			Writer_Write(state, "}");
 		else
 		{
-			Writer_Writef(state, "}\n");
+			Writer_Write(state, "}\n");
 			++state.currentLine;
 		}
 	}
 	else if (outputOperation.modifiers & StringOutMod_OpenParen)
-		Writer_Writef(state, "(");
+		Writer_Write(state, "(");
 	else if (outputOperation.modifiers & StringOutMod_CloseParen)
-		Writer_Writef(state, ")");
+		Writer_Write(state, ")");
 	else if (outputOperation.modifiers & StringOutMod_OpenList)
-		Writer_Writef(state, "{");
+		Writer_Write(state, "{");
 	else if (outputOperation.modifiers & StringOutMod_CloseList)
-		Writer_Writef(state, "}");
+		Writer_Write(state, "}");
 	else if (outputOperation.modifiers & StringOutMod_EndStatement)
 	{
 		if (formatSettings.uglyPrint)
-			Writer_Writef(state, ";");
+			Writer_Write(state, ";");
 		else
 		{
-			Writer_Writef(state, ";\n");
+			Writer_Write(state, ";\n");
 			++state.currentLine;
 		}
 	}
 	else if (outputOperation.modifiers & StringOutMod_ListSeparator)
-		Writer_Writef(state, ", ");
+		Writer_Write(state, ", ");
 	else
-		Writer_Writef(state, "%s", outputOperation.output.c_str());
+		Writer_Write(state, outputOperation);
 
 	// We assume we cannot ignore these even in ugly print mode
 	if (outputOperation.modifiers & StringOutMod_SpaceAfter)
-		Writer_Writef(state, " ");
+		Writer_Write(state, " ");
 	if (outputOperation.modifiers & StringOutMod_NewlineAfter)
 	{
-		Writer_Writef(state, "\n");
+		Writer_Write(state, "\n");
 		++state.currentLine;
 	}
 }
@@ -304,10 +309,10 @@ void writeOutputFollowSplices_Recursive(const NameStyleSettings& nameSettings,
 	for (const StringOutput& operation : outputOperations)
 	{
 		// Debug print mapping
-		if (!operation.output.empty() && false)
+		if (*stringOutputGetText(operation, nullptr) && false)
 		{
-			Logf("%s \t%d\tline %d\n", operation.output.c_str(), outputState.numCharsOutput + 1,
-			       outputState.currentLine + 1);
+			Logf("%s \t%d\tline %d\n", stringOutputGetText(operation, nullptr),
+			     outputState.numCharsOutput + 1, outputState.currentLine + 1);
 		}
 
 		if (operation.modifiers == StringOutMod_Splice)
@@ -348,26 +353,18 @@ bool writeOutputs(const NameStyleSettings& nameSettings, const WriterFormatSetti
 		StringOutputState outputState;
 		// To determine if anything was actually written
 		StringOutputState stateBeforeOutputWrite;
-		char tempFilename[MAX_PATH_LENGTH];
-	} outputs[] = {{/*isHeader=*/false,
-	                outputSettings.sourceOutputName,
-	                {},
-	                {},
-	                {0}},
-	               {
-	                   /*isHeader=*/true,
-	                   outputSettings.headerOutputName,
-	                   {},
-	                   {},
-	                   {0},
-	               }};
+		std::string buffer;
+	} outputs[] = {{/*isHeader=*/false, outputSettings.sourceOutputName, {}, {}, std::string()},
+	               {/*isHeader=*/true, outputSettings.headerOutputName, {}, {}, std::string()}};
 
 	for (int i = 0; i < static_cast<int>(ArraySize(outputs)); ++i)
 	{
-		// Write to a temporary file
-		PrintfBuffer(outputs[i].tempFilename, "%s.temp", outputs[i].outputFilename);
-		// TODO: If this fails to open, Writer_Writef just won't write to the file, it'll print
-		outputs[i].outputState.fileOut = fileOpen(outputs[i].tempFilename, "w");
+		if (!outputs[i].isHeader && outputSettings.sourceOutputBuffer)
+			outputs[i].outputState.bufferOut = outputSettings.sourceOutputBuffer;
+		else
+			outputs[i].outputState.bufferOut = &outputs[i].buffer;
+		outputs[i].outputState.bufferOut->clear();
+		outputs[i].outputState.nameConversionCache = outputSettings.nameConversionCache;
 
 		if (outputSettings.heading)
 		{
@@ -405,17 +402,10 @@ bool writeOutputs(const NameStyleSettings& nameSettings, const WriterFormatSetti
 		if (outputs[i].outputState.numCharsOutput ==
 		    outputs[i].stateBeforeOutputWrite.numCharsOutput)
 		{
-			if (log.fileSystem)
-				Logf("%s had no meaningful output\n", outputs[i].tempFilename);
+			if (log.fileSystem && outputs[i].outputState.bufferOut == &outputs[i].buffer)
+				Logf("%s had no meaningful output\n", outputs[i].outputFilename);
 
-			fclose(outputs[i].outputState.fileOut);
-			outputs[i].outputState.fileOut = nullptr;
-
-			if (remove(outputs[i].tempFilename) != 0)
-			{
-				Logf("Error: Failed to remove %s\n", outputs[i].tempFilename);
-				return false;
-			}
+			outputs[i].outputState.bufferOut->clear();
 			continue;
 		}
 
@@ -438,13 +428,12 @@ bool writeOutputs(const NameStyleSettings& nameSettings, const WriterFormatSetti
 		// 	}
 		// }
 
-		if (outputs[i].outputState.fileOut)
-		{
-			fclose(outputs[i].outputState.fileOut);
-			outputs[i].outputState.fileOut = nullptr;
-		}
+		// The caller handles its own buffer
+		if (outputs[i].outputState.bufferOut != &outputs[i].buffer)
+			continue;
 
-		if (!writeIfContentsNewer(outputs[i].tempFilename, outputs[i].outputFilename))
+		if (!writeIfContentsChanged(outputs[i].buffer.data(), outputs[i].buffer.size(),
+		                            outputs[i].outputFilename))
 			return false;
 	}
 
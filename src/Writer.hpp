@@ -4,7 +4,10 @@
 #include "EvaluatorEnums.hpp"
 #include "WriterEnums.hpp"
 
+#include <string>
+
 struct NameStyleSettings;
+struct NameConversionCache;
 struct StringOutput;
 struct GeneratorOutput;
 
@@ -22,6 +25,9 @@ struct WriterOutputSettings
 	const char* sourceCakelispFilename;
 
 	const char* sourceOutputName;
+	// If set, the source is written to this buffer instead of sourceOutputName. This is used to
+	// hand generated code straight to a process without a round trip through the file system
+	std::string* sourceOutputBuffer;
 	const char* headerOutputName;
 
 	// User code has less control over these outputs. These are more internal/automatic, e.g.
@@ -29,10 +35,18 @@ struct WriterOutputSettings
 	// Note that these cover both the source and header heading and footer
 	const GeneratorOutput* heading;
 	const GeneratorOutput* footer;
+
+	// Optional. Usually the environment's, so names converted by other writers are reused
+	NameConversionCache* nameConversionCache;
 };
 
 const char* importLanguageToString(ImportLanguage type);
 
+// Writes contents to outputFilename only if they differ from what it already contains, which leaves
+// the output's modification time alone (and caches relying on it valid) when nothing changed.
+// Changed contents are written to a temporary file which then replaces outputFilename
+bool writeIfContentsChanged(const char* contents, unsigned long size, const char* outputFilename);
+
 bool writeGeneratorOutput(const GeneratorOutput& generatedOutput,
                           const NameStyleSettings& nameSettings,
                           const WriterFormatSettings& formatSettings,